@@ -1,11 +1,46 @@
 #include "pire.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace LuaPire {
 
 #define METHOD(name) {#name, WrapCpp<Type::name>::func}
 #define MT_METHOD(klass, name) {"__"#name, WrapCpp<Type::klass##_##name>::func}
 #define STATE_METHOD(name) {#name, WrapCpp<Type::State_##name>::func}
 
+// Multi-regexp scanners are written straight from their tables;
+// other scanner types have no SaveTo() and still go through a stream.
+template<typename Scanner>
+struct Serializer {
+    static Pire::ystring ToString(const Scanner& scanner) {
+        std::stringstream ss;
+        scanner.Save(&ss);
+        return ss.str();
+    }
+
+    static void ToFd(const Scanner& scanner, int fd) {
+        Pire::ystring str = ToString(scanner);
+        Pire::Impl::Chunk chunk = { str.data(), str.size() };
+        Pire::Impl::WriteChunks(fd, Pire::yvector<Pire::Impl::Chunk>(1, chunk));
+    }
+};
+
+template<typename Relocation, typename Shortcutting>
+struct Serializer<Pire::Impl::Scanner<Relocation, Shortcutting> > {
+    typedef Pire::Impl::Scanner<Relocation, Shortcutting> Scanner;
+
+    static Pire::ystring ToString(const Scanner& scanner) {
+        Pire::ystring str(scanner.SerializedSize(), '\0');
+        scanner.SaveTo(&str[0]);
+        return str;
+    }
+
+    static void ToFd(const Scanner& scanner, int fd) {
+        scanner.SaveToFd(fd);
+    }
+};
+
 template<typename Scanner>
 struct ScannerWrapper {
 
@@ -167,30 +202,36 @@ struct ScannerWrapper {
     static int Save(lua_State* L) {
         const LuaScanner* scanner = ToUserData<LuaScanner>(L, 1);
         const char* fname = luaL_checkstring(L, 2);
-        std::ofstream file(fname, std::ios_base::app | std::ios_base::binary);
-        if (!file) {
+        int fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) {
             lua_pushboolean(L, false);
             lua_pushfstring(L, "Failed to open file: %s", fname);
             return 2;
         }
-        std::streampos pos = file.tellp();
-        scanner->scanner.Save(&file);
-        if (!file) {
+        off_t pos = lseek(fd, 0, SEEK_END);
+        bool ok = (pos != -1);
+        try {
+            if (ok)
+                Serializer<Scanner>::ToFd(scanner->scanner, fd);
+        } catch (Pire::Error&) {
+            ok = false;
+        }
+        if (close(fd))
+            ok = false;
+        if (!ok) {
             lua_pushboolean(L, false);
             lua_pushfstring(L, "Failed to save a scanner to file: %s", fname);
             return 2;
         }
         std::streampos* pos_ptr = NewUserData<std::streampos>(L);
-        *pos_ptr = pos;
+        *pos_ptr = std::streampos(pos);
         return 1;
     }
 
     static int SaveToString(lua_State* L) {
         const LuaScanner* scanner = ToUserData<LuaScanner>(L, 1);
-        std::stringstream ss;
-        scanner->scanner.Save(&ss);
-        Pire::ystring str = ss.str();
-        lua_pushlstring(L, str.c_str(), str.size());
+        Pire::ystring str = Serializer<Scanner>::ToString(scanner->scanner);
+        lua_pushlstring(L, str.data(), str.size());
         return 1;
     }
 
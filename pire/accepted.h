@@ -0,0 +1,169 @@
+/*
+ * accepted.h -- bitmasks of regexps accepted by scanner states
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_ACCEPTED_H
+#define PIRE_ACCEPTED_H
+
+
+#include "stub/stl.h"
+#include "defs.h"
+#include "run.h"
+#include "scanners/multi.h"
+
+namespace Pire {
+
+/**
+ * Regexps accepted in each state of a deterministic multiregexp scanner
+ * (with a copyable and ordered State, e.g. Scanner or NonrelocScanner),
+ * as fixed-width bitmasks rather than the lists returned by AcceptedRegexps().
+ *
+ * Regexp `i' is accepted iff bit (i % 64) of word (i / 64) is set;
+ * all the masks are Words() words long, so results of several documents
+ * or several scanners can be combined with plain AND and OR.
+ * Equal masks are stored once, so a glued scanner with many states
+ * but few distinct accepted sets costs little memory.
+ *
+ * The table only keeps a pointer to the scanner, which must outlive it.
+ * Scanner and NonrelocScanner keep such a table of their own
+ * (saved and mmap()-ed along with the rest of the scanner),
+ * so for them nothing is built and the masks are read right from the scanner.
+ */
+template<class Scanner>
+class AcceptedRegexpsMasks {
+public:
+	typedef typename Scanner::State State;
+
+	AcceptedRegexpsMasks(): m_scanner(0), m_words(0), m_distinct(0) {}
+
+	explicit AcceptedRegexpsMasks(const Scanner& scanner)
+		: m_scanner(&scanner)
+		, m_words(ymax<size_t>((scanner.RegexpsCount() + 63) / 64, 1))
+	{
+		// Only reachable states can ever be passed to Mask()
+		yset<State> visited;
+		yvector<State> queue;
+		State initial;
+		scanner.Initialize(initial);
+		visited.insert(initial);
+		queue.push_back(initial);
+
+		ymap<yvector<ui64>, size_t> offsets;
+		m_index.resize(scanner.Size(), 0);
+		yvector<ui64> mask(m_words);
+		for (size_t i = 0; i != queue.size(); ++i) {
+			for (Char ch = 0; ch != MaxCharUnaligned; ++ch) {
+				if (ch == SpecialChar::Epsilon)
+					continue;
+				State next = queue[i];
+				Step(scanner, next, ch);
+				if (visited.insert(next).second)
+					queue.push_back(next);
+			}
+
+			std::fill(mask.begin(), mask.end(), 0);
+			ypair<const size_t*, const size_t*> accepted = scanner.AcceptedRegexps(queue[i]);
+			for (; accepted.first != accepted.second; ++accepted.first)
+				mask[*accepted.first / 64] |= static_cast<ui64>(1) << (*accepted.first % 64);
+
+			typename ymap<yvector<ui64>, size_t>::iterator it = offsets.find(mask);
+			if (it == offsets.end()) {
+				it = offsets.insert(ymake_pair(mask, m_masks.size())).first;
+				m_masks.insert(m_masks.end(), mask.begin(), mask.end());
+			}
+			m_index[scanner.StateIndex(queue[i])] = it->second;
+		}
+		m_distinct = offsets.size();
+	}
+
+	/// The length of each mask, in 64-bit words
+	size_t Words() const { return m_words; }
+
+	/// The number of distinct masks stored
+	size_t Distinct() const { return m_distinct; }
+
+	/// Returns the mask of regexps accepted in the state
+	const ui64* Mask(const State& state) const
+	{
+		YASSERT(m_scanner);
+		return &m_masks[m_index[m_scanner->StateIndex(state)]];
+	}
+
+	/// Checks whether the state accepts the given regexp
+	bool Accepts(const State& state, size_t regexp) const
+	{
+		YASSERT(regexp < m_words * 64);
+		return (Mask(state)[regexp / 64] >> (regexp % 64)) & 1;
+	}
+
+	void Swap(AcceptedRegexpsMasks& m)
+	{
+		DoSwap(m_scanner, m.m_scanner);
+		DoSwap(m_words, m.m_words);
+		DoSwap(m_distinct, m.m_distinct);
+		m_index.swap(m.m_index);
+		m_masks.swap(m.m_masks);
+	}
+
+private:
+	const Scanner* m_scanner;
+	size_t m_words;
+	size_t m_distinct;
+	yvector<size_t> m_index; ///< Offsets of masks in m_masks, by state indices
+	yvector<ui64> m_masks;
+};
+
+template<class Relocation, class Shortcutting>
+class AcceptedRegexpsMasks< Impl::Scanner<Relocation, Shortcutting> > {
+public:
+	typedef Impl::Scanner<Relocation, Shortcutting> ScannerType;
+	typedef typename ScannerType::State State;
+
+	AcceptedRegexpsMasks(): m_scanner(0) {}
+
+	explicit AcceptedRegexpsMasks(const ScannerType& scanner): m_scanner(&scanner) {}
+
+	size_t Words() const { return m_scanner ? m_scanner->MaskWords() : 0; }
+
+	size_t Distinct() const { return m_scanner ? m_scanner->DistinctMasks() : 0; }
+
+	const ui64* Mask(const State& state) const
+	{
+		YASSERT(m_scanner);
+		return m_scanner->AcceptedMask(state);
+	}
+
+	bool Accepts(const State& state, size_t regexp) const
+	{
+		YASSERT(regexp < Words() * 64);
+		return (Mask(state)[regexp / 64] >> (regexp % 64)) & 1;
+	}
+
+	void Swap(AcceptedRegexpsMasks& m) { DoSwap(m_scanner, m.m_scanner); }
+
+private:
+	const ScannerType* m_scanner;
+};
+
+}
+
+#endif
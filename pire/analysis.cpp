@@ -0,0 +1,434 @@
+/*
+ * analysis.cpp -- estimation of automata sizes before compilation
+ *                 and attribution of state blowups to regexps.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "analysis.h"
+#include "determine.h"
+
+namespace Pire {
+namespace Analysis {
+
+namespace {
+	// Chains longer than that make determination hopeless anyway
+	const size_t MaxForkDepth = 64;
+
+	// Returns the length of the longest path from the given state
+	// consisting of transitions on the given letter (self-loops excluded).
+	size_t ChainLength(const Fsm& fsm, size_t state, Char letter, ymap<size_t, size_t>& memo, yset<size_t>& path)
+	{
+		ymap<size_t, size_t>::const_iterator it = memo.find(state);
+		if (it != memo.end())
+			return it->second;
+		if (path.size() >= MaxForkDepth || path.find(state) != path.end())
+			return 0;
+
+		path.insert(state);
+		size_t len = 0;
+		const Fsm::StatesSet& dests = fsm.Destinations(state, letter);
+		for (Fsm::StatesSet::const_iterator i = dests.begin(), ie = dests.end(); i != ie; ++i)
+			if (*i != state)
+				len = ymax(len, 1 + ChainLength(fsm, *i, letter, memo, path));
+		path.erase(state);
+
+		len = ymin(len, MaxForkDepth);
+		memo[state] = len;
+		return len;
+	}
+
+	// Anything with a longer fork chain has more than `limit' states when determined
+	bool Hopeless(size_t forkDepth, size_t limit)
+	{
+		return forkDepth >= 8 * sizeof(size_t) || (static_cast<size_t>(1) << forkDepth) > limit;
+	}
+
+	// Transitions of a deterministic automaton, without any payload:
+	// enough to count states of its product with another one.
+	struct Table {
+		static const size_t NoClass = static_cast<size_t>(-1);
+
+		yvector<size_t> classOf; ///< Letter class of each character (NoClass if never used)
+		size_t classes;
+		yvector<size_t> next;    ///< next[state * classes + class]
+		yvector<bool> final;     ///< Only filled for single regexps
+
+		Table(): classOf(MaxChar, NoClass), classes(0) {}
+		size_t Size() const { return classes ? next.size() / classes : 0; }
+
+		void Swap(Table& t)
+		{
+			classOf.swap(t.classOf);
+			DoSwap(classes, t.classes);
+			next.swap(t.next);
+			final.swap(t.final);
+		}
+	};
+
+	// Runs the subset construction of Fsm::Determine(), only recording
+	// which subset goes where: no FSM is built and nothing is minimized.
+	class SubsetTask {
+	public:
+		typedef yvector<size_t> State;
+		typedef Fsm::LettersTbl LettersTbl;
+		typedef ymap<State, size_t> InvStates;
+
+		SubsetTask(const Fsm& fsm, Table& table)
+			: m_fsm(&fsm)
+			, m_table(&table)
+		{
+			// Final states looping on each letter can never be left, so (as Determine() does)
+			// subsets containing them are not expanded any further
+			for (Fsm::FinalTable::const_iterator i = fsm.Finals().begin(), ie = fsm.Finals().end(); i != ie; ++i) {
+				bool loops = true;
+				for (LettersTbl::ConstIterator l = Letters().Begin(), le = Letters().End(); loops && l != le; ++l)
+					loops = fsm.Connected(*i, *i, l->first);
+				if (loops)
+					m_terminals.insert(*i);
+			}
+
+			m_table->classes = Letters().Size();
+			for (LettersTbl::ConstIterator l = Letters().Begin(), le = Letters().End(); l != le; ++l)
+				for (yvector<Char>::const_iterator ch = l->second.second.begin(), che = l->second.second.end(); ch != che; ++ch)
+					if (*ch < MaxChar)
+						m_table->classOf[*ch] = l->second.first;
+		}
+
+		const LettersTbl& Letters() const { return m_fsm->Letters(); }
+
+		State Initial() const { return State(1, m_fsm->Initial()); }
+
+		bool IsRequired(const State& state) const
+		{
+			for (State::const_iterator i = state.begin(), ie = state.end(); i != ie; ++i)
+				if (m_terminals.find(*i) != m_terminals.end())
+					return false;
+			return true;
+		}
+
+		State Next(const State& state, Char letter) const
+		{
+			State next;
+			for (State::const_iterator from = state.begin(), fromEnd = state.end(); from != fromEnd; ++from) {
+				const Fsm::StatesSet& part = m_fsm->Destinations(*from, letter);
+				std::copy(part.begin(), part.end(), std::back_inserter(next));
+			}
+			std::sort(next.begin(), next.end());
+			next.erase(std::unique(next.begin(), next.end()), next.end());
+			return next;
+		}
+
+		void AcceptStates(const yvector<State>& states)
+		{
+			// Unexpanded states loop on each letter
+			m_table->next.resize(states.size() * m_table->classes);
+			m_table->final.resize(states.size());
+			for (size_t i = 0; i != states.size(); ++i) {
+				std::fill(m_table->next.begin() + i * m_table->classes, m_table->next.begin() + (i + 1) * m_table->classes, i);
+				for (State::const_iterator j = states[i].begin(), je = states[i].end(); j != je; ++j)
+					if (m_fsm->IsFinal(*j))
+						m_table->final[i] = true;
+			}
+		}
+
+		void Connect(size_t from, size_t to, Char letter)
+		{
+			m_table->next[from * m_table->classes + Letters().Index(letter)] = to;
+		}
+
+		typedef bool Result;
+		Result Success() { return true; }
+		Result Failure() { return false; }
+
+	private:
+		const Fsm* m_fsm;
+		Table* m_table;
+		yset<size_t> m_terminals;
+	};
+
+	// Merges equivalent states of the table (by plain Moore's refinement,
+	// which is cheap enough for integer tables of capped size)
+	void Minimize(Table& table)
+	{
+		const size_t size = table.Size();
+		yvector<size_t> cls(size);
+		for (size_t i = 0; i != size; ++i)
+			cls[i] = table.final[i] ? 1 : 0;
+
+		size_t count = 0;
+		for (;;) {
+			ymap<yvector<size_t>, size_t> signatures;
+			yvector<size_t> refined(size);
+			yvector<size_t> sig(table.classes + 1);
+			for (size_t i = 0; i != size; ++i) {
+				sig[0] = cls[i];
+				for (size_t l = 0; l != table.classes; ++l)
+					sig[l + 1] = cls[table.next[i * table.classes + l]];
+				refined[i] = signatures.insert(ymake_pair(sig, signatures.size())).first->second;
+			}
+			cls.swap(refined);
+			if (signatures.size() == count)
+				break;
+			count = signatures.size();
+		}
+
+		yvector<size_t> next(count * table.classes);
+		yvector<bool> final(count);
+		for (size_t i = 0; i != size; ++i) {
+			for (size_t l = 0; l != table.classes; ++l)
+				next[cls[i] * table.classes + l] = cls[table.next[i * table.classes + l]];
+			final[cls[i]] = table.final[i];
+		}
+		table.next.swap(next);
+		table.final.swap(final);
+	}
+
+	// Builds the table of the determined and minimized FSM,
+	// giving up beyond `limit' states before minimization
+	bool Subsets(const Fsm& fsm, size_t limit, Table& table)
+	{
+		Fsm copy(fsm);
+		copy.RemoveEpsilons();
+		SubsetTask task(copy, table);
+		if (!Impl::Determine(task, limit))
+			return false;
+		Minimize(table);
+		return true;
+	}
+
+	// Builds the table of the product of two automata (i.e. of what Glue() would produce),
+	// giving up beyond `limit' states
+	bool Product(const Table& lhs, const Table& rhs, size_t limit, Table& product)
+	{
+		ymap<ypair<size_t, size_t>, size_t> classes;
+		yvector< ypair<size_t, size_t> > letters;
+		for (Char ch = 0; ch != MaxChar; ++ch) {
+			if (lhs.classOf[ch] == Table::NoClass || rhs.classOf[ch] == Table::NoClass)
+				continue;
+			ypair<size_t, size_t> cls(lhs.classOf[ch], rhs.classOf[ch]);
+			ymap<ypair<size_t, size_t>, size_t>::iterator it = classes.find(cls);
+			if (it == classes.end()) {
+				it = classes.insert(ymake_pair(cls, letters.size())).first;
+				letters.push_back(cls);
+			}
+			product.classOf[ch] = it->second;
+		}
+		product.classes = letters.size();
+
+		ymap<ypair<size_t, size_t>, size_t> index;
+		yvector< ypair<size_t, size_t> > states;
+		states.push_back(ymake_pair<size_t, size_t>(0, 0));
+		index.insert(ymake_pair(states.front(), 0));
+		for (size_t i = 0; i != states.size(); ++i) {
+			Impl::CheckBudget(CompileProgress::Determining, states.size(), product.next.size() * sizeof(size_t));
+			for (size_t l = 0; l != letters.size(); ++l) {
+				ypair<size_t, size_t> next(lhs.next[states[i].first * lhs.classes + letters[l].first],
+					rhs.next[states[i].second * rhs.classes + letters[l].second]);
+				ymap<ypair<size_t, size_t>, size_t>::iterator it = index.find(next);
+				if (it == index.end()) {
+					if (states.size() == limit)
+						return false;
+					it = index.insert(ymake_pair(next, states.size())).first;
+					states.push_back(next);
+				}
+				product.next.push_back(it->second);
+			}
+		}
+		return true;
+	}
+
+	struct GrowthGreater {
+		const yvector<PatternReport>* patterns;
+		explicit GrowthGreater(const yvector<PatternReport>& p): patterns(&p) {}
+
+		double Key(size_t i) const
+		{
+			const PatternReport& r = (*patterns)[i];
+			return (r.verdict == PatternReport::Rewrite) ? 1e300 : r.growth;
+		}
+		bool operator()(size_t a, size_t b) const { return Key(a) > Key(b); }
+	};
+}
+
+SizeEstimate DeterminedSize(const Fsm& fsm, size_t limit, Precision precision /* = Estimated */)
+{
+	if (precision == Exact) {
+		Fsm copy(fsm);
+		if (!copy.Determine(limit))
+			return SizeEstimate(limit + 1, false);
+		copy.Minimize();
+		return SizeEstimate(copy.Size(), true);
+	}
+
+	Table table;
+	if (Hopeless(ForkDepth(fsm), limit) || !Subsets(fsm, limit, table))
+		return SizeEstimate(limit + 1, false);
+	return SizeEstimate(table.Size(), true);
+}
+
+size_t ForkDepth(const Fsm& fsm)
+{
+	Fsm copy(fsm);
+	copy.RemoveEpsilons();
+
+	size_t depth = 0;
+	ymap< Char, ymap<size_t, size_t> > memo;
+	yset<size_t> path;
+	for (size_t state = 0; state != copy.Size(); ++state) {
+		yset<Char> letters = copy.OutgoingLetters(state);
+		for (yset<Char>::const_iterator l = letters.begin(), le = letters.end(); l != le; ++l) {
+			const Fsm::StatesSet& dests = copy.Destinations(state, *l);
+			if (dests.size() < 2 || dests.find(state) == dests.end())
+				continue;
+			// The state can either loop or advance on *l
+			for (Fsm::StatesSet::const_iterator i = dests.begin(), ie = dests.end(); i != ie; ++i)
+				if (*i != state)
+					depth = ymax(depth, 1 + ChainLength(copy, *i, *l, memo[*l], path));
+		}
+	}
+	return ymin(depth, MaxForkDepth);
+}
+
+namespace {
+	// Determines, minimizes and glues the regexps for real
+	Report AnalyzeExactly(const yvector<Fsm>& patterns, size_t maxSize)
+	{
+		Report report;
+		Scanner shard;
+
+		for (size_t i = 0; i != patterns.size(); ++i) {
+			PatternReport pr;
+			pr.regexp = i;
+			pr.forkDepth = ForkDepth(patterns[i]);
+			pr.shard = static_cast<size_t>(-1);
+			pr.gluedSize = 0;
+			pr.growth = 0;
+
+			Fsm fsm(patterns[i]);
+			if (!fsm.Determine(maxSize)) {
+				pr.size = SizeEstimate(maxSize + 1, false);
+				pr.verdict = PatternReport::Rewrite;
+				report.patterns.push_back(pr);
+				continue;
+			}
+			fsm.Minimize();
+			pr.size = SizeEstimate(fsm.Size(), true);
+			Scanner sc = fsm.Compile<Scanner>();
+
+			Scanner glued;
+			if (!report.shards.empty())
+				glued = Scanner::Glue(shard, sc, maxSize);
+
+			if (glued.Empty()) {
+				pr.verdict = report.shards.empty() ? PatternReport::Ok : PatternReport::NewShard;
+				pr.gluedSize = sc.Size();
+				pr.growth = 1;
+				report.shards.push_back(yvector<size_t>());
+				shard.Swap(sc);
+			} else {
+				pr.verdict = PatternReport::Ok;
+				pr.gluedSize = glued.Size();
+				pr.growth = static_cast<double>(glued.Size()) / (shard.Size() + sc.Size());
+				shard.Swap(glued);
+			}
+			pr.shard = report.shards.size() - 1;
+			report.shards.back().push_back(i);
+			report.patterns.push_back(pr);
+		}
+		return report;
+	}
+}
+
+Report Analyze(const yvector<Fsm>& patterns, size_t maxSize, Precision precision /* = Estimated */)
+{
+	if (precision == Exact)
+		return AnalyzeExactly(patterns, maxSize);
+
+	Report report;
+	Table shard;
+
+	for (size_t i = 0; i != patterns.size(); ++i) {
+		PatternReport pr;
+		pr.regexp = i;
+		pr.forkDepth = ForkDepth(patterns[i]);
+		pr.shard = static_cast<size_t>(-1);
+		pr.gluedSize = 0;
+		pr.growth = 0;
+
+		Table table;
+		if (Hopeless(pr.forkDepth, maxSize) || !Subsets(patterns[i], maxSize, table)) {
+			pr.size = SizeEstimate(maxSize + 1, false);
+			pr.verdict = PatternReport::Rewrite;
+			report.patterns.push_back(pr);
+			continue;
+		}
+		pr.size = SizeEstimate(table.Size(), true);
+
+		Table glued;
+		if (report.shards.empty() || !Product(shard, table, maxSize, glued)) {
+			pr.verdict = report.shards.empty() ? PatternReport::Ok : PatternReport::NewShard;
+			pr.gluedSize = table.Size();
+			pr.growth = 1;
+			report.shards.push_back(yvector<size_t>());
+			shard.Swap(table);
+		} else {
+			pr.verdict = PatternReport::Ok;
+			pr.gluedSize = glued.Size();
+			pr.growth = static_cast<double>(glued.Size()) / (shard.Size() + table.Size());
+			shard.Swap(glued);
+		}
+		pr.shard = report.shards.size() - 1;
+		report.shards.back().push_back(i);
+		report.patterns.push_back(pr);
+	}
+	return report;
+}
+
+yvector<size_t> Report::Culprits() const
+{
+	yvector<size_t> ret;
+	for (size_t i = 0; i != patterns.size(); ++i)
+		ret.push_back(i);
+	std::stable_sort(ret.begin(), ret.end(), GrowthGreater(patterns));
+	return ret;
+}
+
+yostream& operator << (yostream& s, const Report& report)
+{
+	for (yvector<PatternReport>::const_iterator i = report.patterns.begin(), ie = report.patterns.end(); i != ie; ++i) {
+		s << "regexp " << i->regexp << ": " << (i->size.exact ? "" : "more than ") << i->size.states
+			<< " states, fork depth " << i->forkDepth;
+		if (i->verdict == PatternReport::Rewrite) {
+			s << " [too complicated, rewrite]" << Endl;
+			continue;
+		}
+		s << ", shard " << i->shard << " grows to " << i->gluedSize << " states (x" << i->growth << ")";
+		if (i->verdict == PatternReport::NewShard)
+			s << " [new shard]";
+		s << Endl;
+	}
+	for (size_t i = 0; i != report.shards.size(); ++i)
+		s << "shard " << i << ": " << report.shards[i].size() << " regexps" << Endl;
+	return s;
+}
+
+}
+}
@@ -0,0 +1,173 @@
+/*
+ * analysis.h -- estimation of automata sizes before compilation
+ *               and attribution of state blowups to regexps.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_ANALYSIS_H
+#define PIRE_ANALYSIS_H
+
+
+#include "stub/stl.h"
+#include "fsm.h"
+#include "scanners/multi.h"
+
+namespace Pire {
+namespace Analysis {
+
+/// How sizes of automata are obtained
+enum Precision {
+	/// States are counted by a breadth-first search over sets (for a single regexp)
+	/// or pairs (for a glued one) of states, without building or minimizing any FSM.
+	/// Regexps of the /.*X.{n}/ shape are recognized by ForkDepth() without any search at all.
+	/// The counts may exceed what Determine() and Minimize() would produce, never fall short of it.
+	Estimated,
+
+	/// Regexps are actually determined, minimized and glued (which is much slower).
+	Exact
+};
+
+/// A number of states in an automaton
+struct SizeEstimate {
+	size_t states; ///< Number of states (see Precision) if `exact', a lower bound otherwise
+	bool exact;
+
+	SizeEstimate(size_t st = 0, bool ex = true): states(st), exact(ex) {}
+};
+
+/**
+ * Counts states of the determined FSM, giving up as soon as it has more than `limit' states.
+ * The FSM itself is left intact.
+ */
+SizeEstimate DeterminedSize(const Fsm& fsm, size_t limit, Precision precision = Estimated);
+
+/**
+ * A structural heuristic for patterns like /.*X.{n}/.
+ *
+ * Finds places where the FSM can either stay in a looping state or advance on the same letter,
+ * and returns the longest chain of states which can be advanced on that letter again
+ * (for the pattern above it is n + 1). Each position in such a chain is a "thread" of the NFA
+ * which can be active independently, so the determined FSM has about 2^ForkDepth() states.
+ */
+size_t ForkDepth(const Fsm& fsm);
+
+/**
+ * Counts states of the agglutination of given scanners (i.e. what Glue()-ing all of them
+ * together would produce) without building any transition tables,
+ * giving up as soon as there are more than `limit' states.
+ */
+template<class Scanner>
+SizeEstimate GluedSize(const yvector<const Scanner*>& scanners, size_t limit)
+{
+	typedef yvector<typename Scanner::State> State;
+
+	// Characters are equivalent iff all scanners treat them equally
+	ymap< yvector<Char>, Char > classes;
+	for (Char ch = 0; ch != MaxCharUnaligned; ++ch) {
+		if (ch == Epsilon)
+			continue;
+		yvector<Char> signature;
+		signature.reserve(scanners.size());
+		for (size_t i = 0; i != scanners.size(); ++i)
+			signature.push_back(scanners[i]->Translate(ch));
+		classes.insert(ymake_pair(signature, ch));
+	}
+	yvector<Char> letters;
+	for (typename ymap< yvector<Char>, Char >::const_iterator i = classes.begin(), ie = classes.end(); i != ie; ++i)
+		letters.push_back(i->second);
+
+	State initial(scanners.size());
+	for (size_t i = 0; i != scanners.size(); ++i)
+		scanners[i]->Initialize(initial[i]);
+
+	yset<State> visited;
+	ydeque<State> queue;
+	visited.insert(initial);
+	queue.push_back(initial);
+	while (!queue.empty()) {
+		State st = queue.front();
+		queue.pop_front();
+		for (yvector<Char>::const_iterator l = letters.begin(), le = letters.end(); l != le; ++l) {
+			State next = st;
+			for (size_t i = 0; i != scanners.size(); ++i)
+				scanners[i]->Next(next[i], *l);
+			if (visited.insert(next).second) {
+				if (visited.size() > limit)
+					return SizeEstimate(visited.size(), false);
+				queue.push_back(next);
+			}
+		}
+	}
+	return SizeEstimate(visited.size(), true);
+}
+
+template<class Scanner>
+SizeEstimate GluedSize(const Scanner& lhs, const Scanner& rhs, size_t limit)
+{
+	yvector<const Scanner*> scanners;
+	scanners.push_back(&lhs);
+	scanners.push_back(&rhs);
+	return GluedSize(scanners, limit);
+}
+
+/// Analysis results for a single regexp
+struct PatternReport {
+	enum Verdict {
+		Ok,       ///< The regexp fits into its shard
+		NewShard, ///< The regexp could not be glued to the previous shard, and started a new one
+		Rewrite   ///< The regexp cannot be determined within the limit on its own
+	};
+
+	size_t regexp;       ///< Index of the regexp in the analyzed set
+	SizeEstimate size;   ///< Size of the determined regexp
+	size_t forkDepth;    ///< See ForkDepth()
+	size_t shard;        ///< Index of the shard the regexp is assigned to
+	size_t gluedSize;    ///< Size of the shard right after the regexp has been glued to it
+	double growth;       ///< gluedSize divided by the sum of the shard's previous size and regexp's own size
+	Verdict verdict;
+};
+
+/// Analysis results for a set of regexps
+struct Report {
+	yvector<PatternReport> patterns;
+
+	/// Suggested partition of regexps into separately glued shards
+	/// (regexps marked as Rewrite are not included in any shard).
+	yvector< yvector<size_t> > shards;
+
+	/// Returns regexps in the descending order of their growth factor
+	/// (i.e. first go those which contributed the most to state blowup).
+	yvector<size_t> Culprits() const;
+};
+
+/**
+ * Estimates determined sizes of given regexps and finds a partition of them into shards
+ * such that each shard, when glued, has at most `maxSize' states.
+ * For each regexp, reports how much it has contributed to the size of its shard.
+ */
+Report Analyze(const yvector<Fsm>& patterns, size_t maxSize, Precision precision = Estimated);
+
+yostream& operator << (yostream& s, const Report& report);
+
+}
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * budget.cpp -- limits and observation of regexp compilation.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "budget.h"
+
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#include <windows.h>
+#endif
+
+namespace Pire {
+
+namespace {
+	// Wall clock time in milliseconds
+	ui64 Now()
+	{
+#ifndef _WIN32
+		struct timeval tv;
+		gettimeofday(&tv, 0);
+		return static_cast<ui64>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+#else
+		return GetTickCount64();
+#endif
+	}
+
+	// Clock is only consulted (and progress is only reported) once in that many checks
+	const size_t TicksPerClockCheck = 64;
+	const size_t TicksPerProgress = 1024;
+
+#ifdef PIRE_HAVE_THREAD_LOCAL
+	__thread CompileBudget* currentBudget = 0;
+#else
+	// Budgets cannot be used from several threads simultaneously
+	CompileBudget* currentBudget = 0;
+#endif
+}
+
+CompileBudget::CompileBudget()
+	: m_cancelled(false)
+	, m_hasDeadline(false)
+	, m_deadline(0)
+	, m_memoryLimit(0)
+	, m_progress(0)
+	, m_ticks(0)
+{}
+
+CompileBudget& CompileBudget::SetTimeLimit(size_t milliseconds)
+{
+	m_hasDeadline = true;
+	m_deadline = Now() + milliseconds;
+	return *this;
+}
+
+CompileBudget& CompileBudget::SetMemoryLimit(size_t bytes)
+{
+	m_memoryLimit = bytes;
+	return *this;
+}
+
+void CompileBudget::Check(CompileProgress::Stage stage, size_t states, size_t bytes)
+{
+	if (m_cancelled)
+		throw BudgetExceeded(BudgetExceeded::Cancelled, "regexp compilation cancelled");
+	if (m_memoryLimit && bytes > m_memoryLimit)
+		throw BudgetExceeded(BudgetExceeded::MemoryLimit, "regexp compilation exceeded memory limit");
+
+	++m_ticks;
+	if (m_hasDeadline && m_ticks % TicksPerClockCheck == 1 && Now() > m_deadline)
+		throw BudgetExceeded(BudgetExceeded::TimeLimit, "regexp compilation exceeded time limit");
+	if (m_progress && m_ticks % TicksPerProgress == 1)
+		m_progress->Progress(stage, states, bytes);
+}
+
+CompileBudget* CompileBudget::Current()
+{
+	return currentBudget;
+}
+
+CompileBudget::Scope::Scope(CompileBudget* budget)
+	: m_prev(currentBudget)
+{
+	currentBudget = budget;
+}
+
+CompileBudget::Scope::~Scope()
+{
+	currentBudget = m_prev;
+}
+
+}
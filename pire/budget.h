@@ -0,0 +1,132 @@
+/*
+ * budget.h -- limits and observation of regexp compilation.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_BUDGET_H
+#define PIRE_BUDGET_H
+
+
+#include "stub/stl.h"
+#include "stub/defaults.h"
+
+namespace Pire {
+
+/// An observer of compilation progress (see CompileBudget::SetProgress()).
+class CompileProgress {
+public:
+	enum Stage {
+		Parsing,
+		Building,     ///< NFA construction (concatenation, repetition, etc...)
+		Determining,  ///< Determination or agglutination
+		Minimizing
+	};
+
+	virtual ~CompileProgress() {}
+
+	/// Called periodically from within the compilation.
+	/// `states' is the number of states the stage has produced so far,
+	/// `bytes' is an estimate of memory the stage is holding.
+	virtual void Progress(Stage stage, size_t states, size_t bytes) = 0;
+};
+
+/// Thrown when compilation runs out of its CompileBudget.
+class BudgetExceeded: public Error {
+public:
+	enum Reason {
+		TimeLimit,
+		MemoryLimit,
+		Cancelled
+	};
+
+	BudgetExceeded(Reason reason, const char* msg): Error(msg), m_reason(reason) {}
+	Reason GetReason() const { return m_reason; }
+
+private:
+	Reason m_reason;
+};
+
+/**
+ * Limits wall time and memory spent by regexp compilation,
+ * and allows to cancel or observe it from outside.
+ *
+ * A budget is not passed to each and every Fsm operation explicitly;
+ * instead, it should be activated for the current thread with
+ * a CompileBudget::Scope (Lexer::SetBudget() does it during Parse()).
+ * While active, Lexer, Fsm operations, Fsm::Determine(), Fsm::Minimize()
+ * and scanners' Glue() check the budget and throw BudgetExceeded
+ * as soon as it is exhausted.
+ *
+ * Memory limit applies to estimated size of the largest structure
+ * being built by a single stage, not to the process as a whole.
+ */
+class CompileBudget {
+public:
+	CompileBudget();
+
+	/// Limits the compilation to the given number of milliseconds, starting from now.
+	CompileBudget& SetTimeLimit(size_t milliseconds);
+	CompileBudget& SetMemoryLimit(size_t bytes);
+	CompileBudget& SetProgress(CompileProgress* progress) { m_progress = progress; return *this; }
+
+	/// Requests the compilation to stop. Can be called from any thread.
+	void Cancel() { m_cancelled = true; }
+	bool IsCancelled() const { return m_cancelled; }
+
+	/// Throws BudgetExceeded if the budget is exhausted.
+	void Check(CompileProgress::Stage stage, size_t states, size_t bytes);
+
+	/// Returns the budget active for the current thread, if any.
+	static CompileBudget* Current();
+
+	/// Activates a budget for the current thread during its lifetime.
+	class Scope {
+	public:
+		explicit Scope(CompileBudget* budget);
+		~Scope();
+	private:
+		CompileBudget* m_prev;
+
+		Scope(const Scope&);
+		Scope& operator = (const Scope&);
+	};
+
+private:
+	volatile bool m_cancelled;
+	bool m_hasDeadline;
+	ui64 m_deadline;
+	size_t m_memoryLimit;
+	CompileProgress* m_progress;
+	size_t m_ticks;
+};
+
+namespace Impl {
+	/// Checks the budget active for the current thread (if any).
+	inline void CheckBudget(CompileProgress::Stage stage, size_t states, size_t bytes)
+	{
+		if (CompileBudget* budget = CompileBudget::Current())
+			budget->Check(stage, states, bytes);
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * cache.cpp -- a content-addressed on-disk cache of compiled scanners.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cache.h"
+#include "scanners/common.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace Pire {
+
+namespace {
+	const char FileMagic[8] = { 'P', 'I', 'R', 'E', 'C', 'A', 'C', 'H' };
+	const char FileSuffix[] = ".pire";
+	const char TempSuffix[] = ".tmp.XXXXXX";
+
+	// Temporary files older than that (in seconds) are left by crashed writers
+	const time_t StaleTempAge = 3600;
+
+	// File layout: magic, key length, key, padding, scanner
+	const size_t PayloadAlign = 16;
+
+	size_t PayloadOffset(size_t keyLen)
+	{
+		size_t off = sizeof(FileMagic) + sizeof(ui64) + keyLen;
+		return (off + PayloadAlign - 1) / PayloadAlign * PayloadAlign;
+	}
+
+	ui64 Fnv1a(const ystring& s)
+	{
+		ui64 hash = 14695981039346656037ULL;
+		for (ystring::const_iterator i = s.begin(), ie = s.end(); i != ie; ++i) {
+			hash ^= static_cast<unsigned char>(*i);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	bool HasSuffix(const char* name)
+	{
+		size_t len = strlen(name);
+		size_t suffixLen = sizeof(FileSuffix) - 1;
+		return len > suffixLen && !strcmp(name + len - suffixLen, FileSuffix);
+	}
+
+	bool IsTemp(const char* name)
+	{
+		const char* suffix = strstr(name, FileSuffix);
+		return suffix && !strncmp(suffix + sizeof(FileSuffix) - 1, TempSuffix, sizeof(TempSuffix) - 7);
+	}
+}
+
+CacheKey& CacheKey::Add(const ystring& s)
+{
+	Add(s.size());
+	m_data.append(s);
+	return *this;
+}
+
+CacheKey& CacheKey::Add(size_t n)
+{
+	ui64 val = n;
+	m_data.append(reinterpret_cast<const char*>(&val), sizeof(val));
+	return *this;
+}
+
+CompileCache::CompileCache(const ystring& dir, size_t maxBytes)
+	: m_dir(dir)
+	, m_maxBytes(maxBytes)
+	, m_hits(0)
+	, m_misses(0)
+{}
+
+ystring CompileCache::FullKey(const CacheKey& key, const char* type) const
+{
+	CacheKey full;
+	full.Add(type)
+		.Add(static_cast<size_t>(Header::RE_VERSION))
+		.Add(sizeof(void*))
+		.Add(sizeof(Impl::MaxSizeWord))
+		.Add(key.Data());
+	return full.Data();
+}
+
+ystring CompileCache::FileName(const ystring& fullKey) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(Fnv1a(fullKey)));
+	return m_dir + "/" + name + FileSuffix;
+}
+
+#ifndef _WIN32
+
+CompileCache::~CompileCache()
+{
+	for (yvector< ypair<void*, size_t> >::iterator i = m_maps.begin(), ie = m_maps.end(); i != ie; ++i)
+		munmap(i->first, i->second);
+}
+
+const void* CompileCache::Map(const ystring& fullKey, size_t& size)
+{
+	ystring name = FileName(fullKey);
+	int fd = open(name.c_str(), O_RDONLY);
+	if (fd == -1)
+		return 0;
+
+	struct stat st;
+	void* addr = MAP_FAILED;
+	size_t len = 0;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		len = st.st_size;
+		addr = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (addr == MAP_FAILED)
+		return 0;
+
+	// Make sure this is our file and not a hash collision
+	const char* p = static_cast<const char*>(addr);
+	size_t off = PayloadOffset(fullKey.size());
+	ui64 keyLen = 0;
+	if (len > sizeof(FileMagic) + sizeof(keyLen))
+		memcpy(&keyLen, p + sizeof(FileMagic), sizeof(keyLen));
+	if (len <= off
+		|| memcmp(p, FileMagic, sizeof(FileMagic))
+		|| keyLen != fullKey.size()
+		|| memcmp(p + sizeof(FileMagic) + sizeof(keyLen), fullKey.data(), fullKey.size()))
+	{
+		munmap(addr, len);
+		return 0;
+	}
+
+	// Bump modification time, so LRU eviction works
+	utime(name.c_str(), 0);
+
+	m_maps.push_back(ymake_pair(addr, len));
+	size = len - off;
+	return p + off;
+}
+
+void CompileCache::Unmap(const void* ptr)
+{
+	for (yvector< ypair<void*, size_t> >::iterator i = m_maps.begin(), ie = m_maps.end(); i != ie; ++i) {
+		const char* begin = static_cast<const char*>(i->first);
+		if (ptr >= begin && ptr < begin + i->second) {
+			munmap(i->first, i->second);
+			m_maps.erase(i);
+			return;
+		}
+	}
+}
+
+void CompileCache::Write(const ystring& fullKey, const char* data, size_t size)
+{
+	ystring name = FileName(fullKey);
+	ystring tmp = name + TempSuffix;
+	yvector<char> tmpName(tmp.begin(), tmp.end());
+	tmpName.push_back('\0');
+
+	// A unique name, so neither concurrent writers nor a leftover
+	// of a crashed one can prevent us from storing the file
+	int fd = mkstemp(&tmpName[0]);
+	if (fd == -1)
+		// The directory is not writable; nothing we can do.
+		return;
+	tmp = &tmpName[0];
+	fchmod(fd, 0644);
+
+	ystring header(FileMagic, sizeof(FileMagic));
+	ui64 keyLen = fullKey.size();
+	header.append(reinterpret_cast<const char*>(&keyLen), sizeof(keyLen));
+	header.append(fullKey);
+	header.append(PayloadOffset(fullKey.size()) - header.size(), '\0');
+
+	bool ok = true;
+	const char* chunks[2] = { header.data(), data };
+	size_t sizes[2] = { header.size(), size };
+	for (size_t i = 0; i != 2 && ok; ++i) {
+		const char* p = chunks[i];
+		size_t left = sizes[i];
+		while (left) {
+			ssize_t written = write(fd, p, left);
+			if (written <= 0) {
+				ok = false;
+				break;
+			}
+			p += written;
+			left -= written;
+		}
+	}
+	if (close(fd))
+		ok = false;
+
+	if (!ok || rename(tmp.c_str(), name.c_str())) {
+		unlink(tmp.c_str());
+		return;
+	}
+	if (m_maxBytes)
+		Evict(name);
+}
+
+void CompileCache::Evict(const ystring& keep)
+{
+	DIR* dir = opendir(m_dir.c_str());
+	if (!dir)
+		return;
+
+	yvector< ypair<time_t, ypair<ystring, size_t> > > files;
+	size_t total = 0;
+	time_t now = time(0);
+	while (struct dirent* entry = readdir(dir)) {
+		bool temp = IsTemp(entry->d_name);
+		if (!temp && !HasSuffix(entry->d_name))
+			continue;
+		ystring name = m_dir + "/" + entry->d_name;
+		struct stat st;
+		if (stat(name.c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (temp) {
+			// Files being written right now are none of our business
+			if (st.st_mtime + StaleTempAge < now)
+				unlink(name.c_str());
+			continue;
+		}
+		total += st.st_size;
+		if (name != keep)
+			files.push_back(ymake_pair(st.st_mtime, ymake_pair(name, static_cast<size_t>(st.st_size))));
+	}
+	closedir(dir);
+
+	std::sort(files.begin(), files.end());
+	for (size_t i = 0; i != files.size() && total > m_maxBytes; ++i) {
+		// Mapped files stay valid after unlink()
+		if (!unlink(files[i].second.first.c_str()))
+			total -= files[i].second.second;
+	}
+}
+
+#else
+
+CompileCache::~CompileCache() {}
+const void* CompileCache::Map(const ystring&, size_t&) { return 0; }
+void CompileCache::Unmap(const void*) {}
+void CompileCache::Write(const ystring&, const char*, size_t) {}
+void CompileCache::Evict(const ystring&) {}
+
+#endif
+
+}
@@ -0,0 +1,144 @@
+/*
+ * cache.h -- a content-addressed on-disk cache of compiled scanners.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_CACHE_H
+#define PIRE_CACHE_H
+
+
+#include <typeinfo>
+#include "stub/stl.h"
+#include "stub/memstreams.h"
+#include "fsm.h"
+
+namespace Pire {
+
+/**
+ * Identifies a compiled scanner in a CompileCache.
+ * Should include everything which affects compilation: pattern bytes,
+ * encoding, lexer features and so on (in any form the caller likes).
+ * Scanner type and serialization format details are added by the cache itself.
+ */
+class CacheKey {
+public:
+	CacheKey() {}
+	explicit CacheKey(const ystring& pattern) { Add(pattern); }
+
+	CacheKey& Add(const ystring& s);
+	CacheKey& Add(const char* s) { return Add(ystring(s)); }
+	CacheKey& Add(size_t n);
+
+	const ystring& Data() const { return m_data; }
+
+private:
+	ystring m_data;
+};
+
+/**
+ * A content-addressed on-disk cache of compiled scanners.
+ *
+ * Each scanner is stored in a separate file in the cache directory,
+ * named after a hash of its key. Files are written atomically (via rename()),
+ * so several processes can share the same directory. If the total size of the cache
+ * exceeds the given limit, least recently used files are evicted.
+ *
+ * Scanners found in the cache are mmap()-ed from their files, which stay mapped
+ * until the cache object is destroyed; hence the cache must outlive them.
+ *
+ * Only available on POSIX systems; elsewhere it never finds anything.
+ */
+class CompileCache {
+public:
+	explicit CompileCache(const ystring& dir, size_t maxBytes = 0);
+	~CompileCache();
+
+	/// Looks up the scanner in the cache, mmap()-ing it on success.
+	template<class Scanner>
+	bool Find(const CacheKey& key, Scanner& sc)
+	{
+		size_t size;
+		const void* ptr = Map(FullKey(key, typeid(Scanner).name()), size);
+		if (!ptr)
+			return false;
+		try {
+			sc.Mmap(ptr, size);
+		} catch (Error&) {
+			// Corrupted or incompatible file
+			Unmap(ptr);
+			return false;
+		}
+		return true;
+	}
+
+	/// Puts the scanner into the cache.
+	template<class Scanner>
+	void Store(const CacheKey& key, const Scanner& sc)
+	{
+		BufferOutput buf;
+		sc.Save(&buf);
+		Write(FullKey(key, typeid(Scanner).name()), buf.Buffer().Data(), buf.Buffer().Size());
+	}
+
+	/**
+	 * Returns the cached scanner if there is one; otherwise compiles
+	 * the FSM returned by build() (which can be a function or a functor)
+	 * and puts the result into the cache.
+	 */
+	template<class Scanner, class Builder>
+	Scanner Get(const CacheKey& key, Builder build)
+	{
+		Scanner sc;
+		if (Find(key, sc)) {
+			++m_hits;
+			return sc;
+		}
+		++m_misses;
+		Fsm fsm = build();
+		sc = fsm.Compile<Scanner>();
+		Store(key, sc);
+		return sc;
+	}
+
+	size_t Hits() const { return m_hits; }
+	size_t Misses() const { return m_misses; }
+
+private:
+	ystring m_dir;
+	size_t m_maxBytes;
+	yvector< ypair<void*, size_t> > m_maps;
+	size_t m_hits;
+	size_t m_misses;
+
+	ystring FullKey(const CacheKey& key, const char* type) const;
+	ystring FileName(const ystring& fullKey) const;
+	const void* Map(const ystring& fullKey, size_t& size);
+	void Unmap(const void* ptr);
+	void Write(const ystring& fullKey, const char* data, size_t size);
+	void Evict(const ystring& keep);
+
+	CompileCache(const CompileCache&);
+	CompileCache& operator = (const CompileCache&);
+};
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * codegen.h -- generating C++ code for deterministic scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_CODEGEN_H
+#define PIRE_CODEGEN_H
+
+
+#include "stub/stl.h"
+#include "defs.h"
+#include "scanners/compiled.h"
+
+namespace Pire {
+
+namespace Impl {
+
+	/// Transitions of a single state, renumbered, for every character
+	/// which can appear in the input (i.e. all but Epsilon)
+	struct CodegenState {
+		yvector<size_t> next;
+		ui8 flags;
+		yvector<size_t> accepted;
+	};
+
+	/// Returns the destination taken by the most of the characters below `end'
+	inline size_t MostCommon(const yvector<size_t>& next, Char end)
+	{
+		ymap<size_t, size_t> counts;
+		size_t best = next[0];
+		for (Char ch = 0; ch != end; ++ch)
+			if (ch != SpecialChar::Epsilon && ++counts[next[ch]] > counts[best])
+				best = next[ch];
+		return best;
+	}
+
+	/// Writes case labels of a switch, grouping characters by destinations
+	/// and leaving the most common one to the default label
+	inline void GenerateCases(yostream* s, const yvector<size_t>& next, Char end, const char* indent, const char* jump)
+	{
+		size_t dflt = MostCommon(next, end);
+		ymap< size_t, yvector<Char> > groups;
+		for (Char ch = 0; ch != end; ++ch)
+			if (ch != SpecialChar::Epsilon && next[ch] != dflt)
+				groups[next[ch]].push_back(ch);
+		for (ymap< size_t, yvector<Char> >::const_iterator i = groups.begin(), ie = groups.end(); i != ie; ++i) {
+			(*s) << indent;
+			for (yvector<Char>::const_iterator ch = i->second.begin(), che = i->second.end(); ch != che; ++ch)
+				(*s) << "case " << *ch << ": ";
+			(*s) << jump << i->first << ";\n";
+		}
+		(*s) << indent << "default: " << jump << dflt << ";\n";
+	}
+}
+
+/**
+ * Writes a C++ expression yielding a CompiledScanner equivalent to the given
+ * deterministic scanner (with a copyable and ordered State, e.g. Scanner or SimpleScanner).
+ *
+ * The expression is self-contained (the tables and the state machine live
+ * in a local class) and relies on PIRE_BEGIN_BLOCK_EXPR / PIRE_RETURN_BLOCK_EXPR
+ * from defs.h, so it can be placed anywhere an expression is allowed.
+ * This is what pire_inline emits for regexps with the 'c' option.
+ *
+ * The size of the code is proportional to the number of states
+ * times the number of distinct transitions from each state,
+ * so it is only suitable for reasonably small automata.
+ */
+template<class Scanner>
+void GenerateCode(yostream* s, const Scanner& scanner)
+{
+	typedef typename Scanner::State State;
+
+	// Number all the reachable states in the BFS order, the initial one being 0
+	ymap<State, size_t> index;
+	yvector<State> queue;
+	State initial;
+	scanner.Initialize(initial);
+	index.insert(ymake_pair(initial, 0));
+	queue.push_back(initial);
+
+	yvector<Impl::CodegenState> states;
+	for (size_t i = 0; i != queue.size(); ++i) {
+		Impl::CodegenState st;
+		st.next.resize(MaxCharUnaligned);
+		for (Char ch = 0; ch != MaxCharUnaligned; ++ch) {
+			if (ch == SpecialChar::Epsilon)
+				continue;
+			State next = queue[i];
+			Step(scanner, next, ch);
+			typename ymap<State, size_t>::iterator it = index.find(next);
+			if (it == index.end()) {
+				it = index.insert(ymake_pair(next, queue.size())).first;
+				queue.push_back(next);
+			}
+			st.next[ch] = it->second;
+		}
+		st.next[SpecialChar::Epsilon] = i;
+		st.flags = (scanner.Final(queue[i]) ? CompiledScanner::FinalFlag : 0)
+			| (scanner.Dead(queue[i]) ? CompiledScanner::DeadFlag : 0);
+		ypair<const size_t*, const size_t*> accepted = scanner.AcceptedRegexps(queue[i]);
+		st.accepted.assign(accepted.first, accepted.second);
+		states.push_back(st);
+	}
+
+	(*s) << "PIRE_BEGIN_BLOCK_EXPR(Pire::CompiledScanner)\n";
+	(*s) << "struct PireCompiledScanner {\n";
+
+	(*s) << "\tstatic size_t Step(size_t state, Pire::Char ch)\n\t{\n";
+	(*s) << "\t\tswitch (state) {\n";
+	for (size_t i = 0; i != states.size(); ++i) {
+		(*s) << "\t\tcase " << i << ":\n\t\t\tswitch (ch) {\n";
+		Impl::GenerateCases(s, states[i].next, MaxCharUnaligned, "\t\t\t", "return ");
+		(*s) << "\t\t\t}\n";
+	}
+	(*s) << "\t\tdefault: return state;\n\t\t}\n\t}\n";
+
+	// Each state is a label, so the compiler sees the whole automaton at once
+	(*s) << "\tstatic size_t Run(size_t state, const char* begin, const char* end)\n\t{\n";
+	(*s) << "\t\tconst unsigned char* p = reinterpret_cast<const unsigned char*>(begin);\n";
+	(*s) << "\t\tconst unsigned char* e = reinterpret_cast<const unsigned char*>(end);\n";
+	(*s) << "\t\tswitch (state) {\n";
+	for (size_t i = 0; i != states.size(); ++i)
+		(*s) << "\t\tcase " << i << ": goto S" << i << ";\n";
+	(*s) << "\t\tdefault: return state;\n\t\t}\n";
+	for (size_t i = 0; i != states.size(); ++i) {
+		yvector<Char> exits;
+		for (Char ch = 0; ch != 256; ++ch)
+			if (states[i].next[ch] != i)
+				exits.push_back(ch);
+		(*s) << "\tS" << i << ":\n";
+		if (exits.empty()) {
+			// Nothing can take us out of here
+			(*s) << "\t\treturn " << i << ";\n";
+			continue;
+		} else if (exits.size() == 1) {
+			// Only one character leaves the state, so let memchr() look for it
+			(*s) << "\t\tif ((p = static_cast<const unsigned char*>(memchr(p, " << exits.front() << ", e - p))) == 0)\n";
+			(*s) << "\t\t\treturn " << i << ";\n";
+			(*s) << "\t\t++p;\n\t\tgoto S" << states[i].next[exits.front()] << ";\n";
+			continue;
+		}
+		(*s) << "\t\tif (p == e)\n\t\t\treturn " << i << ";\n";
+		(*s) << "\t\tswitch (*p++) {\n";
+		Impl::GenerateCases(s, states[i].next, 256, "\t\t", "goto S");
+		(*s) << "\t\t}\n";
+	}
+	(*s) << "\t}\n";
+
+	(*s) << "\tstatic const Pire::ui8* Flags()\n\t{\n\t\tstatic const Pire::ui8 flags[] = {";
+	for (size_t i = 0; i != states.size(); ++i)
+		(*s) << (i ? ", " : " ") << static_cast<unsigned>(states[i].flags);
+	(*s) << " };\n\t\treturn flags;\n\t}\n";
+
+	(*s) << "\tstatic const size_t* AcceptPos()\n\t{\n\t\tstatic const size_t pos[] = { 0";
+	size_t acceptCount = 0;
+	for (size_t i = 0; i != states.size(); ++i)
+		(*s) << ", " << (acceptCount += states[i].accepted.size());
+	(*s) << " };\n\t\treturn pos;\n\t}\n";
+
+	// Zero-sized arrays are not allowed, hence a dummy element at the end
+	(*s) << "\tstatic const size_t* Accept()\n\t{\n\t\tstatic const size_t accept[] = {";
+	for (size_t i = 0; i != states.size(); ++i)
+		for (yvector<size_t>::const_iterator re = states[i].accepted.begin(), ree = states[i].accepted.end(); re != ree; ++re)
+			(*s) << " " << *re << ",";
+	(*s) << " 0 };\n\t\treturn accept;\n\t}\n";
+
+	(*s) << "\tstatic Pire::CompiledScanner Make()\n\t{\n";
+	(*s) << "\t\treturn Pire::CompiledScanner(&Step, &Run, Flags(), AcceptPos(), Accept(), "
+		<< states.size() << ", " << scanner.RegexpsCount() << ");\n\t}\n";
+	(*s) << "};\n";
+	(*s) << "PIRE_RETURN_BLOCK_EXPR(PireCompiledScanner::Make())";
+}
+
+}
+
+#endif
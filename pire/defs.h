@@ -99,4 +99,16 @@ namespace Pire {
 #	endif
 #endif
 
+/// Brackets a block of statements usable as an expression of the given type
+/// (the block ends with PIRE_RETURN_BLOCK_EXPR(value))
+#ifndef PIRE_BEGIN_BLOCK_EXPR
+#	if defined(PIRE_HAVE_LAMBDAS)
+#		define PIRE_BEGIN_BLOCK_EXPR(type) ([]() -> type {
+#		define PIRE_RETURN_BLOCK_EXPR(value) return value; })()
+#	elif defined(PIRE_HAVE_SCOPED_EXPR)
+#		define PIRE_BEGIN_BLOCK_EXPR(type) ({
+#		define PIRE_RETURN_BLOCK_EXPR(value) value; })
+#	endif
+#endif
+
 #endif
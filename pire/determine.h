@@ -26,6 +26,7 @@
 
 #include "stub/stl.h"
 #include "partition.h"
+#include "budget.h"
 
 namespace Pire {
 	namespace Impl {
@@ -107,6 +108,8 @@ namespace Pire {
 			for (size_t stateIdx = 0; stateIdx < states.size(); ++stateIdx) {
 				if (!task.IsRequired(states[stateIdx]))
 					continue;
+				Impl::CheckBudget(CompileProgress::Determining, states.size(),
+					states.size() * sizeof(State) + (transitions.size() + 1) * task.Letters().Size() * sizeof(size_t));
 				TransitionTable::value_type row(task.Letters().Size());
 				for (typename Letters::ConstIterator lit = task.Letters().Begin(), lie = task.Letters().End(); lit != lie; ++lit) {
 					State newState = task.Next(states[stateIdx], lit->first);
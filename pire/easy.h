@@ -155,10 +155,13 @@ public:
 	
 	explicit Regexp(Scanner sc): m_scanner(sc) {}
 	explicit Regexp(SlowScanner ssc): m_slow(ssc) {}
+	explicit Regexp(ShengScanner ssc): m_sheng(ssc) {}
 	
 	bool Matches(const char* begin, const char* end) const
 	{
-		if (!m_scanner.Empty())
+		if (!m_sheng.Empty())
+			return Runner(m_sheng).Begin().Run(begin, end).End();
+		else if (!m_scanner.Empty())
 			return Runner(m_scanner).Begin().Run(begin, end).End();
 		else
 			return Runner(m_slow).Begin().Run(begin, end).End();
@@ -187,6 +190,7 @@ public:
 private:
 	Scanner m_scanner;
 	SlowScanner m_slow;
+	ShengScanner m_sheng;
 	
 	ypair<const char*, const char*> PatternBounds(const ystring& pattern)
 	{
@@ -212,9 +216,17 @@ private:
 			fsm.PrependAnything();
 		fsm.AppendAnything();
 		
-		if (fsm.Determine())
-			m_scanner = fsm.Compile<Scanner>();
-		else
+		if (fsm.Determine()) {
+			fsm.Minimize();
+#ifdef __SSSE3__
+			// Tiny automata are run entirely in registers
+			// (without pshufb ShengScanner is no faster than Scanner)
+			if (fsm.Size() <= ShengScanner::MaxStates)
+				m_sheng = fsm.Compile<ShengScanner>();
+			else
+#endif
+				m_scanner = fsm.Compile<Scanner>();
+		} else
 			m_slow = fsm.Compile<SlowScanner>();
 	}
 	
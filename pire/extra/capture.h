@@ -140,6 +140,10 @@ public:
 	
 	void Swap(CapturingScanner& s) { LoadedScanner::Swap(s); }
 	CapturingScanner& operator = (const CapturingScanner& s) { CapturingScanner(s).Swap(*this); return *this; }
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	CapturingScanner(CapturingScanner&& s): LoadedScanner(static_cast<LoadedScanner&&>(s)) {}
+	CapturingScanner& operator = (CapturingScanner&& s) { Swap(s); return *this; }
+#endif
 
 	size_t StateIndex(const State& s) const { return StateIdx(s.m_state); }
 
@@ -209,6 +209,10 @@ public:
 
 	void Swap(CountingScanner& s) { LoadedScanner::Swap(s); }
 	CountingScanner& operator = (const CountingScanner& s) { CountingScanner(s).Swap(*this); return *this; }
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	CountingScanner(CountingScanner&& s): LoadedScanner(static_cast<LoadedScanner&&>(s)) {}
+	CountingScanner& operator = (CountingScanner&& s) { Swap(s); return *this; }
+#endif
 
 	size_t StateIndex(const State& s) const { return StateIdx(s.m_state); }
 
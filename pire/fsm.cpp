@@ -33,6 +33,7 @@
 #include "vbitset.h"
 #include "partition.h"
 #include "determine.h"
+#include "budget.h"
 
 #include <iostream>
 #include <stdio.h>
@@ -190,6 +191,7 @@ namespace {
 
 Fsm::Fsm():
 	m_transitions(1),
+	m_connections(0),
 	initial(0),
 	letters(m_transitions),
 	m_sparsed(false),
@@ -245,6 +247,9 @@ yset<Char> Fsm::OutgoingLetters(size_t state) const
 size_t Fsm::Resize(size_t newSize)
 {
 	size_t ret = Size();
+	for (size_t i = newSize; i < ret; ++i)
+		for (TransitionRow::const_iterator j = m_transitions[i].begin(), je = m_transitions[i].end(); j != je; ++j)
+			m_connections -= j->second.size();
 	m_transitions.resize(newSize);
 	return ret;
 }
@@ -252,6 +257,7 @@ size_t Fsm::Resize(size_t newSize)
 void Fsm::Swap(Fsm& fsm)
 {
 	DoSwap(m_transitions, fsm.m_transitions);
+	DoSwap(m_connections, fsm.m_connections);
 	DoSwap(initial, fsm.initial);
 	DoSwap(m_final, fsm.m_final);
 	DoSwap(letters, fsm.letters);
@@ -390,8 +396,8 @@ void Fsm::Import(const Fsm& rhs)
 			if (targets == outer->end())
 				continue;
 			for (yvector<Char>::const_iterator cit = lit->second.second.begin(), cie = lit->second.second.end(); cit != cie; ++cit)
-				if (*cit != lit->first)
-					outer->insert(ymake_pair(*cit, targets->second));
+				if (*cit != lit->first && outer->insert(ymake_pair(*cit, targets->second)).second)
+					m_connections += targets->second.size();
 		}
 	}
 
@@ -401,7 +407,8 @@ void Fsm::Import(const Fsm& rhs)
 			yset<size_t> targets;
 			std::transform(inner->second.begin(), inner->second.end(), std::inserter(targets, targets.begin()),
 				std::bind2nd(std::plus<size_t>(), oldsize));
-			dest->insert(ymake_pair(inner->first, targets));
+			if (dest->insert(ymake_pair(inner->first, targets)).second)
+				m_connections += targets.size();
 		}
 
 		for (LettersTbl::ConstIterator lit = rhs.letters.Begin(), lie = rhs.letters.End(); lit != lie; ++lit) {
@@ -409,8 +416,8 @@ void Fsm::Import(const Fsm& rhs)
 			if (targets == dest->end())
 				continue;
 			for (yvector<Char>::const_iterator cit = lit->second.second.begin(), cie = lit->second.second.end(); cit != cie; ++cit)
-				if (*cit != lit->first)
-					dest->insert(ymake_pair(*cit, targets->second));
+				if (*cit != lit->first && dest->insert(ymake_pair(*cit, targets->second)).second)
+					m_connections += targets->second.size();
 		}
 	}
 
@@ -426,11 +433,13 @@ void Fsm::Import(const Fsm& rhs)
 		tags.insert(ymake_pair(it->first + oldsize, it->second));
 
 	letters = LettersTbl(LettersEquality(m_transitions));
+	CheckBudget();
 }
 
 void Fsm::Connect(size_t from, size_t to, Char c /* = Epsilon */)
 {
-	m_transitions[from][c].insert(to);
+	if (m_transitions[from][c].insert(to).second)
+		++m_connections;
 	ClearHints();
 }
 
@@ -445,14 +454,14 @@ void Fsm::Disconnect(size_t from, size_t to, Char c)
 {
 	TransitionRow::iterator i = m_transitions[from].find(c);
 	if (i != m_transitions[from].end())
-		i->second.erase(to);
+		m_connections -= i->second.erase(to);
 	ClearHints();
 }
 
 void Fsm::Disconnect(size_t from, size_t to)
 {
 	for (TransitionRow::iterator i = m_transitions[from].begin(), ie = m_transitions[from].end(); i != ie; ++i)
-		i->second.erase(to);
+		m_connections -= i->second.erase(to);
 	ClearHints();
 }
 
@@ -705,6 +714,7 @@ void Fsm::RemoveDeadEnds()
 			for (TransitionRow::iterator k = j->begin(), ke = j->end(); k != ke; ++k)
 				k->second.erase(*i);
 	}
+	RecountConnections();
 	ClearHints();
 
 	PIRE_IFDEBUG(Cdbg << "Result:" << Endl << *this << Endl);
@@ -817,6 +827,7 @@ void Fsm::RemoveEpsilons()
 	// Drop all epsilon transitions
 	for (TransitionTable::iterator i = m_transitions.begin(), ie = m_transitions.end(); i != ie; ++i)
 		i->erase(Epsilon);
+	RecountConnections();
 	
 	Sparse();
 	ClearHints();
@@ -854,6 +865,7 @@ void Fsm::Unsparse()
 			for (yvector<Char>::const_iterator j = lit->second.second.begin(), je = lit->second.second.end(); j != je; ++j)
 				(*i)[*j] = (*i)[lit->first];
 	m_sparsed = false;
+	RecountConnections();
 }
 
 // Returns a set of 'terminal states', which are those of the final states,
@@ -1023,6 +1035,7 @@ bool Fsm::Determine(size_t maxsize /* = 0 */)
 	
 	RemoveEpsilons();
 	PIRE_IFDEBUG(Cdbg << "=== After all epsilons removed" << Endl << *this << Endl);
+	CheckBudget();
 	
 	Impl::FsmDetermineTask task(*this);
 	if (Pire::Impl::Determine(task, maxsize ? maxsize : MaxSize)) {
@@ -1099,6 +1112,7 @@ void Fsm::Minimize()
 
 	PIRE_IFDEBUG(Cdbg << "=== Minimizing ===" << Endl << *this << Endl);
 
+	Impl::CheckBudget(CompileProgress::Minimizing, Size(), Size() * MaxChar * sizeof(size_t));
 	DeterminedTransitions detTran(Size() * MaxChar);
 	for (TransitionTable::const_iterator j = m_transitions.begin(), je = m_transitions.end(); j != je; ++j) {
 		for (TransitionRow::const_iterator k = j->begin(), ke = j->end(); k != ke; ++k) {
@@ -1129,6 +1143,7 @@ void Fsm::Minimize()
 	// Iteratively split states into equality classes
 	while (UpdateStateClassMap(stateClassMap, last)) {
 		PIRE_IFDEBUG(Cdbg << "Stage " << cnt++ << ": state classes = " << last << Endl);
+		Impl::CheckBudget(CompileProgress::Minimizing, last.Size(), detTran.size() * sizeof(size_t));
 		last.Split(MinimizeEquality(detTran, distinctLetters, &stateClassMap));
 	}
 
@@ -1138,6 +1153,7 @@ void Fsm::Minimize()
 	Outputs oldOutputs;
 	Tags oldTags;
 	m_transitions.swap(oldTransitions);
+	m_connections = 0;
 	m_final.swap(oldFinal);
 	outputs.swap(oldOutputs);
 	tags.swap(oldTags);
@@ -1219,9 +1235,33 @@ Fsm& Fsm::Surround()
 {
 	PrependAnything();
 	AppendAnything();
+	CheckBudget();
 	return *this;
 }
 
+void Fsm::CheckBudget() const
+{
+	CompileBudget* budget = CompileBudget::Current();
+	if (!budget)
+		return;
+
+	// Approximate overhead of a tree node in TransitionRow and StatesSet.
+	// Each transition is counted as if it had a row entry of its own,
+	// which overestimates rows with several destinations for a letter.
+	static const size_t NodeOverhead = 4 * sizeof(void*);
+	size_t bytes = m_transitions.size() * sizeof(TransitionRow)
+		+ m_connections * (sizeof(TransitionRow::value_type) + sizeof(size_t) + 2 * NodeOverhead);
+	budget->Check(CompileProgress::Building, Size(), bytes);
+}
+
+void Fsm::RecountConnections()
+{
+	m_connections = 0;
+	for (TransitionTable::const_iterator i = m_transitions.begin(), ie = m_transitions.end(); i != ie; ++i)
+		for (TransitionRow::const_iterator j = i->begin(), je = i->end(); j != je; ++j)
+			m_connections += j->second.size();
+}
+
 void Fsm::Divert(size_t from, size_t to, size_t dest)
 {
 	if (to == dest)
@@ -1243,7 +1283,8 @@ void Fsm::Divert(size_t from, size_t to, size_t dest)
 		TransitionRow::mapped_type::iterator di = i->second.find(to);
 		if (di != i->second.end()) {
 			i->second.erase(di);
-			i->second.insert(dest);
+			if (!i->second.insert(dest).second)
+				--m_connections;
 		}
 	}
 
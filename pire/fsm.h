@@ -119,6 +119,11 @@ namespace Pire {
 		void DumpState(yostream& s, size_t state) const;
 		void DumpTo(yostream& s, const ystring& name = "") const;
 
+		/// Serializes the FSM (including letter classes, outputs and tags),
+		/// so it can be loaded later and used for further building or compiling.
+		void Save(yostream* s) const;
+		void Load(yistream* s);
+
 		typedef yset<size_t> StatesSet;
 		typedef ymap<size_t, StatesSet> TransitionRow;
 		typedef yvector<TransitionRow> TransitionTable;
@@ -208,6 +213,10 @@ namespace Pire {
 		/// Transitions table :: Q x V -> exp(Q)
 		TransitionTable m_transitions;
 
+		/// The number of (from, letter, to) triples in m_transitions,
+		/// so CheckBudget() does not have to walk the table
+		size_t m_connections;
+
 		/// Initial state
 		size_t initial;
 
@@ -240,6 +249,12 @@ namespace Pire {
 		Char Translate(Char c) const;
 		
 		void ClearHints() { isAlternative = false; }
+
+		/// Checks the compilation budget (if any) against the estimated size of the FSM
+		void CheckBudget() const;
+
+		/// Recomputes m_connections after the table has been rewritten in place
+		void RecountConnections();
 		
 		friend class Impl::FsmDetermineTask;
 	};
@@ -0,0 +1,195 @@
+/*
+ * glue_tree.h -- a balanced tree of glued scanners,
+ *                allowing incremental addition and removal of regexps.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_GLUE_TREE_H
+#define PIRE_GLUE_TREE_H
+
+
+#include "stub/stl.h"
+
+namespace Pire {
+
+/**
+ * Keeps a set of compiled components (single regexps or pre-glued shards)
+ * as leaves of a balanced binary tree, each inner node holding the glued
+ * scanner of its subtree, so the whole set is available as Result().
+ *
+ * Adding a component reglues only the nodes on the path from its leaf
+ * to the root (i.e. O(log n) glues instead of n). Removing a component
+ * does not reglue anything: its regexps are just dropped from the final
+ * tables of the ancestors (see Scanner::DropRegexps()); the leaf is reused
+ * (and its path reglued cleanly) by the next Add().
+ *
+ * Regexp indices reported by Result().AcceptedRegexps() are positional and
+ * change as components come and go; use Locate() to map them back
+ * to component handles returned by Add().
+ */
+template<class Scanner>
+class GlueTree {
+public:
+	explicit GlueTree(size_t maxSize = 0)
+		: m_maxSize(maxSize)
+		, m_levels(1, yvector<Scanner>(1))
+		, m_used(1, false)
+		, m_free(1, 0)
+	{}
+
+	/// Builds a tree over the given components at once (n - 1 glues in total).
+	/// Handles of the components are their positions in the range.
+	template<class Iter>
+	GlueTree(Iter begin, Iter end, size_t maxSize = 0)
+		: m_maxSize(maxSize)
+		, m_levels(1, yvector<Scanner>(1))
+		, m_used(1, false)
+	{
+		size_t count = std::distance(begin, end);
+		while (Capacity() < count)
+			Grow();
+		for (size_t i = 0; begin != end; ++begin, ++i) {
+			Leaf(i) = *begin;
+			m_used[i] = true;
+		}
+		m_free.clear();
+		for (size_t i = Capacity(); i != count; --i)
+			m_free.push_back(i - 1);
+
+		for (size_t level = 1; level != m_levels.size(); ++level)
+			for (size_t i = 0; i != m_levels[level].size(); ++i)
+				if (!Glue(m_levels[level - 1][2 * i], m_levels[level - 1][2 * i + 1], m_levels[level][i]))
+					throw Error("Pire::GlueTree: glued scanner is too large");
+		Reindex();
+	}
+
+	/// Adds a component, returning its handle.
+	/// Throws if the resulting scanner would exceed the size limit;
+	/// the tree is left unchanged in this case.
+	size_t Add(const Scanner& sc)
+	{
+		if (m_free.empty())
+			Grow();
+		size_t leaf = m_free.back();
+
+		// Build the new path aside, so a failure leaves the tree intact
+		yvector<Scanner> path(m_levels.size());
+		path[0] = sc;
+		for (size_t level = 1, i = leaf; level != m_levels.size(); ++level, i >>= 1) {
+			const Scanner& sibling = m_levels[level - 1][i ^ 1];
+			if (!((i & 1) ? Glue(sibling, path[level - 1], path[level]) : Glue(path[level - 1], sibling, path[level])))
+				throw Error("Pire::GlueTree: glued scanner is too large");
+		}
+		for (size_t level = 0, i = leaf; level != m_levels.size(); ++level, i >>= 1)
+			m_levels[level][i].Swap(path[level]);
+
+		m_free.pop_back();
+		m_used[leaf] = true;
+		Reindex();
+		return leaf;
+	}
+
+	/// Removes a component previously returned by Add().
+	void Remove(size_t handle)
+	{
+		if (handle >= Capacity() || !m_used[handle])
+			throw Error("Pire::GlueTree: no such component");
+
+		size_t count = Leaf(handle).RegexpsCount();
+		size_t offset = 0;
+		Scanner().Swap(Leaf(handle));
+		for (size_t level = 1, i = handle; level != m_levels.size(); ++level, i >>= 1) {
+			if (i & 1)
+				offset += m_levels[level - 1][i - 1].RegexpsCount();
+			Scanner& node = m_levels[level][i >> 1];
+			node.DropRegexps(offset, offset + count).Swap(node);
+		}
+
+		m_free.push_back(handle);
+		m_used[handle] = false;
+		Reindex();
+	}
+
+	/// Returns the scanner for all the components
+	const Scanner& Result() const { return m_levels.back()[0]; }
+
+	/// Returns the component the given regexp of Result() belongs to,
+	/// and the index of the regexp inside that component.
+	ypair<size_t, size_t> Locate(size_t regexp) const
+	{
+		YASSERT(regexp < m_owners.size());
+		return m_owners[regexp];
+	}
+
+	/// Returns the component with the given handle
+	const Scanner& Component(size_t handle) const { return Leaf(handle); }
+
+	size_t Size() const { return Capacity() - m_free.size(); }
+
+private:
+	size_t m_maxSize;
+	yvector< yvector<Scanner> > m_levels; // m_levels[0] are leaves, m_levels.back() is the root
+	yvector<bool> m_used; // whether a leaf holds a component (which can be an empty scanner as well)
+	yvector<size_t> m_free; // unused leaves
+	yvector< ypair<size_t, size_t> > m_owners;
+
+	size_t Capacity() const { return m_levels.front().size(); }
+	Scanner& Leaf(size_t i) { return m_levels.front()[i]; }
+	const Scanner& Leaf(size_t i) const { return m_levels.front()[i]; }
+
+	bool Glue(const Scanner& lhs, const Scanner& rhs, Scanner& result) const
+	{
+		Scanner glued = Scanner::Glue(lhs, rhs, m_maxSize);
+		if (glued.Empty() && !(lhs.Empty() && rhs.Empty()))
+			return false;
+		result.Swap(glued);
+		return true;
+	}
+
+	// Doubles the number of leaves; the old tree becomes the left subtree of the new root.
+	void Grow()
+	{
+		size_t oldCapacity = Capacity();
+		for (size_t level = 0; level != m_levels.size(); ++level) {
+			yvector<Scanner> nodes(m_levels[level].size() * 2);
+			for (size_t i = 0; i != m_levels[level].size(); ++i)
+				nodes[i].Swap(m_levels[level][i]);
+			m_levels[level].swap(nodes);
+		}
+		m_levels.push_back(yvector<Scanner>(1, m_levels.back()[0]));
+		m_used.resize(Capacity(), false);
+
+		for (size_t i = Capacity(); i != oldCapacity; --i)
+			m_free.push_back(i - 1);
+	}
+
+	void Reindex()
+	{
+		m_owners.clear();
+		for (size_t leaf = 0; leaf != Capacity(); ++leaf)
+			for (size_t i = 0; i != Leaf(leaf).RegexpsCount(); ++i)
+				m_owners.push_back(ymake_pair(leaf, i));
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * handle.cpp -- scanners replaceable while being used
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "handle.h"
+
+#ifdef PIRE_HAVE_PTHREAD_H
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Pire {
+namespace Impl {
+
+#if defined(PIRE_HAVE_ATOMIC_BUILTINS) && defined(PIRE_HAVE_PTHREAD_H)
+
+namespace {
+	// Slots are never freed: a thread which exits releases its slot
+	// for another thread to pick up.
+	struct Slot {
+		ui64 Active;   ///< The epoch the owner has entered, or zero if it is idle
+		size_t Nesting;
+		int InUse;
+		Slot* Next;
+		// Keep slots of different threads in different cache lines
+		char Padding[64];
+	};
+
+	Slot* g_slots = 0;
+	ui64 g_epoch = 1;
+	pthread_key_t g_slotKey;
+	pthread_once_t g_slotKeyOnce = PTHREAD_ONCE_INIT;
+#ifdef PIRE_HAVE_THREAD_LOCAL
+	__thread Slot* t_slot = 0;
+#endif
+
+	void ReleaseSlot(void* slot)
+	{
+		__atomic_store_n(&static_cast<Slot*>(slot)->InUse, 0, __ATOMIC_RELEASE);
+	}
+
+	void CreateSlotKey()
+	{
+		pthread_key_create(&g_slotKey, &ReleaseSlot);
+	}
+
+	Slot* AcquireSlot()
+	{
+		for (Slot* s = __atomic_load_n(&g_slots, __ATOMIC_ACQUIRE); s; s = s->Next) {
+			int idle = 0;
+			if (__atomic_compare_exchange_n(&s->InUse, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return s;
+		}
+		Slot* s = new Slot;
+		s->Active = 0;
+		s->Nesting = 0;
+		s->InUse = 1;
+		s->Next = __atomic_load_n(&g_slots, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&g_slots, &s->Next, s, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+		return s;
+	}
+
+	inline Slot* CurrentSlot()
+	{
+#ifdef PIRE_HAVE_THREAD_LOCAL
+		if (t_slot)
+			return t_slot;
+#endif
+		pthread_once(&g_slotKeyOnce, &CreateSlotKey);
+		Slot* s = static_cast<Slot*>(pthread_getspecific(g_slotKey));
+		if (!s) {
+			s = AcquireSlot();
+			pthread_setspecific(g_slotKey, s);
+		}
+#ifdef PIRE_HAVE_THREAD_LOCAL
+		t_slot = s;
+#endif
+		return s;
+	}
+}
+
+void EpochDomain::Enter()
+{
+	Slot* s = CurrentSlot();
+	if (!s->Nesting++) {
+		__atomic_store_n(&s->Active, __atomic_load_n(&g_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		// The writer must see us active before we read the pointer
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+void EpochDomain::Leave()
+{
+	Slot* s = CurrentSlot();
+	if (!--s->Nesting)
+		__atomic_store_n(&s->Active, 0, __ATOMIC_RELEASE);
+}
+
+void* EpochDomain::Replace(void* volatile* ptr, void* val)
+{
+	void* old = __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+	ui64 epoch = __atomic_add_fetch(&g_epoch, 1, __ATOMIC_SEQ_CST);
+	for (Slot* s = __atomic_load_n(&g_slots, __ATOMIC_ACQUIRE); s; s = s->Next)
+		for (;;) {
+			ui64 active = __atomic_load_n(&s->Active, __ATOMIC_ACQUIRE);
+			if (!active || active >= epoch)
+				break;
+			sched_yield();
+		}
+	return old;
+}
+
+#elif defined(PIRE_HAVE_PTHREAD_H)
+
+namespace {
+	pthread_rwlock_t g_lock = PTHREAD_RWLOCK_INITIALIZER;
+}
+
+void EpochDomain::Enter() { pthread_rwlock_rdlock(&g_lock); }
+void EpochDomain::Leave() { pthread_rwlock_unlock(&g_lock); }
+
+void* EpochDomain::Replace(void* volatile* ptr, void* val)
+{
+	pthread_rwlock_wrlock(&g_lock);
+	void* old = *ptr;
+	*ptr = val;
+	pthread_rwlock_unlock(&g_lock);
+	return old;
+}
+
+#else
+
+void EpochDomain::Enter() {}
+void EpochDomain::Leave() {}
+
+void* EpochDomain::Replace(void* volatile* ptr, void* val)
+{
+	void* old = *ptr;
+	*ptr = val;
+	return old;
+}
+
+#endif
+
+}
+}
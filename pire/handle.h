@@ -0,0 +1,155 @@
+/*
+ * handle.h -- scanners replaceable while being used
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_HANDLE_H
+#define PIRE_HANDLE_H
+
+
+#include "stub/stl.h"
+#include "stub/noncopyable.h"
+#include "defs.h"
+#include "mapped.h"
+
+namespace Pire {
+
+namespace Impl {
+	/**
+	 * Epoch-based reclamation shared by all ScannerHandles.
+	 *
+	 * Each reader thread owns a slot where it marks the epoch it has entered;
+	 * entering and leaving only write to that slot, never to shared memory.
+	 * A writer replaces the pointer, advances the global epoch and waits
+	 * until every slot is either idle or has entered the new epoch.
+	 *
+	 * Without atomic builtins it falls back to a read-write lock,
+	 * and without threads it does nothing at all.
+	 */
+	class EpochDomain {
+	public:
+		static void Enter();
+		static void Leave();
+
+		static void* Load(void* const volatile* ptr)
+		{
+#ifdef PIRE_HAVE_ATOMIC_BUILTINS
+			return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+			return *ptr;
+#endif
+		}
+
+		/// Stores @p val into @p ptr, waits until no reader can see the old value, and returns it
+		static void* Replace(void* volatile* ptr, void* val);
+	};
+}
+
+/**
+ * A scanner which can be replaced while other threads are matching against it.
+ *
+ *   ScannerHandle<Scanner> handle(sc);
+ *   // Readers
+ *   {
+ *       ScannerHandle<Scanner>::ReadGuard guard(handle);
+ *       Runner(*guard).Run(...);
+ *   }
+ *   // Writer
+ *   handle.Publish(newScanner);
+ *
+ * Publish() blocks until all readers which could have seen the previous
+ * scanner leave their guards, then destroys it. Guards may be nested,
+ * but must not be held by the thread calling Publish().
+ */
+template<class Scanner>
+class ScannerHandle: NonCopyable {
+private:
+	struct Version {
+		Scanner Sc;
+		// Keeps mmap()-ed scanners mapped until readers are done with them
+		MappedScanner<Scanner> Mapping;
+	};
+
+public:
+	ScannerHandle(): m_current(new Version) {}
+
+	explicit ScannerHandle(const Scanner& sc): m_current(new Version)
+	{
+		static_cast<Version*>(m_current)->Sc = sc;
+	}
+
+	explicit ScannerHandle(const MappedScanner<Scanner>& mapped): m_current(new Version)
+	{
+		static_cast<Version*>(m_current)->Sc = mapped.Get();
+		static_cast<Version*>(m_current)->Mapping = mapped;
+	}
+
+	/// No readers must be inside their guards by now
+	~ScannerHandle() { delete static_cast<Version*>(m_current); }
+
+	/// Replaces the scanner with a copy of @p sc (mmap()-ed memory is not copied and must stay mapped)
+	void Publish(const Scanner& sc)
+	{
+		Version* v = new Version;
+		v->Sc = sc;
+		Replace(v);
+	}
+
+	/// Replaces the scanner with a file-backed one, which is unmapped once it is replaced in turn
+	void Publish(const MappedScanner<Scanner>& mapped)
+	{
+		Version* v = new Version;
+		v->Sc = mapped.Get();
+		v->Mapping = mapped;
+		Replace(v);
+	}
+
+	/// Pins the current scanner, so it is not destroyed while the guard is alive
+	class ReadGuard: NonCopyable {
+	public:
+		explicit ReadGuard(const ScannerHandle& handle)
+		{
+			Impl::EpochDomain::Enter();
+			m_version = static_cast<const Version*>(Impl::EpochDomain::Load(&handle.m_current));
+		}
+
+		~ReadGuard() { Impl::EpochDomain::Leave(); }
+
+		const Scanner& Get() const { return m_version->Sc; }
+		const Scanner& operator * () const { return Get(); }
+		const Scanner* operator -> () const { return &Get(); }
+
+	private:
+		const Version* m_version;
+	};
+
+private:
+	void* volatile m_current;
+
+	void Replace(Version* v)
+	{
+		delete static_cast<Version*>(Impl::EpochDomain::Replace(&m_current, v));
+	}
+};
+
+}
+
+#endif
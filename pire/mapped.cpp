@@ -0,0 +1,233 @@
+/*
+ * mapped.cpp -- scanners mmap()-ed right from files
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "mapped.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef PIRE_HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+namespace Pire {
+
+struct MappedFile::WarmUpState {
+	const char* Data;
+	size_t Size;
+	WarmUpFunc Fn;
+	void* Ctx;
+	volatile bool Stop;
+#ifdef PIRE_HAVE_PTHREAD_H
+	bool Running;
+	bool Started;
+	pthread_t Thread;
+	mutable pthread_mutex_t Lock;
+	pthread_cond_t Finished;
+
+	static void* Worker(void* state)
+	{
+		WarmUpState* self = static_cast<WarmUpState*>(state);
+		self->Run();
+		pthread_mutex_lock(&self->Lock);
+		self->Running = false;
+		pthread_cond_broadcast(&self->Finished);
+		pthread_mutex_unlock(&self->Lock);
+		return 0;
+	}
+#endif
+
+	void Run()
+	{
+		try {
+			Fn(Ctx, &Stop);
+		} catch (...) {
+			// Warm-up is merely a hint; the scanner is usable anyway
+		}
+#ifndef _WIN32
+		size_t page = sysconf(_SC_PAGESIZE);
+#else
+		size_t page = 4096;
+#endif
+		volatile char sink = 0;
+		for (size_t offset = 0; offset < Size && !Stop; offset += page)
+			sink += Data[offset];
+	}
+};
+
+#ifndef _WIN32
+
+MappedFile::MappedFile(const ystring& path, const MapOptions& options)
+	: m_data(0)
+	, m_size(0)
+	, m_warmUp(0)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw Error("Cannot open " + path + ": " + strerror(errno));
+	try {
+		Map(fd, path, options);
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+}
+
+MappedFile::MappedFile(int fd, const ystring& name, const MapOptions& options)
+	: m_data(0)
+	, m_size(0)
+	, m_warmUp(0)
+{
+	Map(fd, name, options);
+}
+
+void MappedFile::Map(int fd, const ystring& name, const MapOptions& options)
+{
+	struct stat st;
+	if (fstat(fd, &st))
+		throw Error("Cannot stat " + name + ": " + strerror(errno));
+	if (st.st_size <= 0)
+		throw Error("Cannot map " + name + ": file is empty");
+
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (options.Populate)
+		flags |= MAP_POPULATE;
+#endif
+	void* data = mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+	if (data == MAP_FAILED)
+		throw Error("Cannot map " + name + ": " + strerror(errno));
+
+	// Advices are only hints, so their failures are ignored
+#ifdef MADV_WILLNEED
+	if (options.WillNeed)
+		madvise(data, st.st_size, MADV_WILLNEED);
+#endif
+#ifdef MADV_HUGEPAGE
+	if (options.HugePages)
+		madvise(data, st.st_size, MADV_HUGEPAGE);
+#endif
+	if (options.Lock && mlock(data, st.st_size)) {
+		int err = errno;
+		munmap(data, st.st_size);
+		throw Error("Cannot lock " + name + " in memory: " + strerror(err));
+	}
+	m_data = data;
+	m_size = st.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_warmUp) {
+		m_warmUp->Stop = true;
+		WaitWarmUp();
+#ifdef PIRE_HAVE_PTHREAD_H
+		if (m_warmUp->Started)
+			pthread_join(m_warmUp->Thread, 0);
+		pthread_cond_destroy(&m_warmUp->Finished);
+		pthread_mutex_destroy(&m_warmUp->Lock);
+#endif
+		delete m_warmUp;
+	}
+	munmap(m_data, m_size);
+}
+
+#else
+
+MappedFile::MappedFile(const ystring& path, const MapOptions&)
+	: m_data(0)
+	, m_size(0)
+	, m_warmUp(0)
+{
+	throw Error("Cannot map " + path + ": mapping files is not supported on this platform");
+}
+
+MappedFile::MappedFile(int, const ystring& name, const MapOptions&)
+	: m_data(0)
+	, m_size(0)
+	, m_warmUp(0)
+{
+	throw Error("Cannot map " + name + ": mapping files is not supported on this platform");
+}
+
+MappedFile::~MappedFile() {}
+
+#endif
+
+void MappedFile::StartWarmUp(WarmUpFunc fn, void* ctx)
+{
+	if (m_warmUp)
+		throw Error("Warm-up of a mapped file can only be started once");
+	m_warmUp = new WarmUpState;
+	m_warmUp->Data = static_cast<const char*>(m_data);
+	m_warmUp->Size = m_size;
+	m_warmUp->Fn = fn;
+	m_warmUp->Ctx = ctx;
+	m_warmUp->Stop = false;
+#ifdef PIRE_HAVE_PTHREAD_H
+	pthread_mutex_init(&m_warmUp->Lock, 0);
+	pthread_cond_init(&m_warmUp->Finished, 0);
+	m_warmUp->Started = m_warmUp->Running = !pthread_create(&m_warmUp->Thread, 0, &WarmUpState::Worker, m_warmUp);
+	if (!m_warmUp->Running)
+		// No threads for us; do the job ourselves
+		m_warmUp->Run();
+#else
+	m_warmUp->Run();
+#endif
+}
+
+bool MappedFile::WarmedUp() const
+{
+#ifdef PIRE_HAVE_PTHREAD_H
+	if (!m_warmUp)
+		return true;
+	pthread_mutex_lock(&m_warmUp->Lock);
+	bool done = !m_warmUp->Running;
+	pthread_mutex_unlock(&m_warmUp->Lock);
+	return done;
+#else
+	return true;
+#endif
+}
+
+void MappedFile::WaitWarmUp()
+{
+#ifdef PIRE_HAVE_PTHREAD_H
+	if (!m_warmUp)
+		return;
+	pthread_mutex_lock(&m_warmUp->Lock);
+	while (m_warmUp->Running)
+		pthread_cond_wait(&m_warmUp->Finished, &m_warmUp->Lock);
+	pthread_mutex_unlock(&m_warmUp->Lock);
+#endif
+}
+
+}
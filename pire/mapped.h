@@ -0,0 +1,201 @@
+/*
+ * mapped.h -- scanners mmap()-ed right from files
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_MAPPED_H
+#define PIRE_MAPPED_H
+
+
+#include "stub/stl.h"
+#include "scanners/common.h"
+#include "scanners/multi.h"
+
+namespace Pire {
+
+/// Controls how a file is mapped and faulted in
+struct MapOptions {
+	bool Populate;    ///< Fault in the whole file right in mmap() (MAP_POPULATE, where available)
+	bool WillNeed;    ///< Ask the kernel to start reading the file ahead (MADV_WILLNEED)
+	bool HugePages;   ///< Ask for transparent huge pages (MADV_HUGEPAGE, where available)
+	bool Lock;        ///< Lock the mapping in memory (mlock()), so it is never paged out
+	bool WarmUp;      ///< Touch the mapping in a background thread, hottest parts first
+	MmapMode Mode;    ///< Passed to Scanner::Mmap()
+	BackgroundVerifier* Verifier; ///< Required for MmapVerifyInBackground
+
+	MapOptions()
+		: Populate(false), WillNeed(false), HugePages(false), Lock(false), WarmUp(false)
+		, Mode(MmapTrust), Verifier(0)
+	{}
+};
+
+/**
+ * A read-only private mapping of a whole file, unmapped on destruction.
+ * If warm-up is requested, runs it in a background thread, which
+ * is stopped and joined before the file gets unmapped.
+ */
+class MappedFile {
+public:
+	typedef void (*WarmUpFunc)(void* ctx, const volatile bool* stop);
+
+	explicit MappedFile(const ystring& path, const MapOptions& options = MapOptions());
+
+	/// Maps the whole file referred to by @p fd (which is not closed); @p name is used in error messages
+	MappedFile(int fd, const ystring& name, const MapOptions& options = MapOptions());
+
+	~MappedFile();
+
+	const void* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+
+	/**
+	 * Calls fn(ctx, stop) in a background thread (or right away, if threads
+	 * are not available), then reads one byte of each page of the mapping.
+	 * Both stop as soon as *stop is set by the destructor.
+	 */
+	void StartWarmUp(WarmUpFunc fn, void* ctx);
+
+	/// Returns true if there is no warm-up running
+	bool WarmedUp() const;
+	void WaitWarmUp();
+
+private:
+	struct WarmUpState;
+
+	void* m_data;
+	size_t m_size;
+	WarmUpState* m_warmUp;
+
+	void Map(int fd, const ystring& name, const MapOptions& options);
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+};
+
+namespace Impl {
+	template<class Sc>
+	inline void MmapMapped(Sc& sc, const MappedFile& file, const MapOptions& options)
+	{
+		if (options.Mode != MmapTrust)
+			throw Error("This scanner type can only be mapped with MmapTrust");
+		sc.Mmap(file.Data(), file.Size());
+	}
+
+	template<class Shortcutting>
+	inline void MmapMapped(Scanner<Relocatable, Shortcutting>& sc, const MappedFile& file, const MapOptions& options)
+	{
+		sc.Mmap(file.Data(), file.Size(), options.Mode, options.Verifier);
+	}
+
+	// Scanners which know nothing about their access patterns
+	// are warmed up by MappedFile page by page.
+	template<class Sc>
+	inline void WarmUpMapped(const Sc&, const volatile bool*) {}
+
+	template<class Relocation, class Shortcutting>
+	inline void WarmUpMapped(const Scanner<Relocation, Shortcutting>& sc, const volatile bool* stop) { sc.WarmUp(stop); }
+}
+
+/**
+ * A scanner mmap()-ed from a file, along with the mapping itself.
+ * Copies of a handle share the same mapping, which is unmapped
+ * when the last of them is destroyed. The handles themselves are
+ * not thread-safe: do not copy or destroy a handle while another thread
+ * is copying or destroying a handle to the same mapping.
+ */
+template<class Scanner>
+class MappedScanner {
+public:
+	MappedScanner(): m_shared(0) {}
+
+	MappedScanner(const ystring& path, const MapOptions& options = MapOptions())
+		: m_shared(new Shared(path, options))
+	{
+		try {
+			Impl::MmapMapped(m_shared->Sc, m_shared->File, options);
+		} catch (...) {
+			delete m_shared;
+			throw;
+		}
+		if (options.WarmUp)
+			m_shared->File.StartWarmUp(&WarmUpScanner, &m_shared->Sc);
+	}
+
+	MappedScanner(const MappedScanner& s): m_shared(s.m_shared)
+	{
+		if (m_shared)
+			++m_shared->Refs;
+	}
+
+	MappedScanner& operator = (const MappedScanner& s)
+	{
+		MappedScanner(s).Swap(*this);
+		return *this;
+	}
+
+	~MappedScanner()
+	{
+		if (m_shared && !--m_shared->Refs)
+			delete m_shared;
+	}
+
+	void Swap(MappedScanner& s) { DoSwap(m_shared, s.m_shared); }
+
+	bool Empty() const { return !m_shared; }
+
+	const Scanner& Get() const { return m_shared->Sc; }
+	const Scanner& operator * () const { return Get(); }
+	const Scanner* operator -> () const { return &Get(); }
+
+	const MappedFile& File() const { return m_shared->File; }
+
+	bool WarmedUp() const { return !m_shared || m_shared->File.WarmedUp(); }
+	void WaitWarmUp() { if (m_shared) m_shared->File.WaitWarmUp(); }
+
+private:
+	struct Shared {
+		// The scanner must outlive the mapping, since the warm-up
+		// thread (stopped by ~MappedFile()) reads it.
+		Scanner Sc;
+		MappedFile File;
+		size_t Refs;
+
+		Shared(const ystring& path, const MapOptions& options): File(path, options), Refs(1) {}
+	};
+
+	Shared* m_shared;
+
+	static void WarmUpScanner(void* ctx, const volatile bool* stop)
+	{
+		Impl::WarmUpMapped(*static_cast<const Scanner*>(ctx), stop);
+	}
+};
+
+/// Maps a scanner file saved by Scanner::Save() or Scanner::SaveToFd()
+template<class Scanner>
+MappedScanner<Scanner> MapScannerFile(const ystring& path, const MapOptions& options = MapOptions())
+{
+	return MappedScanner<Scanner>(path, options);
+}
+
+}
+
+#endif
@@ -25,6 +25,7 @@
 #define PIRE_PIRE_H
 
 
+#include "budget.h"
 #include "re_lexer.h"
 #include "fsm.h"
 #include "encoding.h"
@@ -33,6 +34,21 @@
 #include "scanners/multi.h"
 #include "scanners/simple.h"
 #include "scanners/slow.h"
+#include "scanners/bitparallel.h"
+#include "scanners/sheng.h"
+#include "scanners/stride2.h"
+#include "scanners/compiled.h"
+#include "scanners/jit.h"
 #include "scanners/pair.h"
+#include "scanners/tuple.h"
+
+#include "glue_tree.h"
+#include "analysis.h"
+#include "accepted.h"
+#include "cache.h"
+#include "mapped.h"
+#include "registry.h"
+#include "handle.h"
+#include "codegen.h"
 
 #endif
@@ -58,6 +58,14 @@
 #endif
 #endif
 
+#ifndef PIRE_PREFETCH
+#ifdef __GNUC__
+#define PIRE_PREFETCH(addr) __builtin_prefetch((addr))
+#else
+#define PIRE_PREFETCH(addr)
+#endif
+#endif
+
 #ifdef _MSC_VER
 #include <stdio.h>
 #include <stdarg.h>
@@ -141,6 +141,7 @@ Term Lexer::DoLex()
 
 Term Lexer::Lex()
 {
+	Impl::CheckBudget(CompileProgress::Parsing, 0, m_input.size() * sizeof(wchar32));
 	Term t = DoLex();
 
 	for (yvector<Feature*>::reverse_iterator i = m_features.rbegin(), ie = m_features.rend(); i != ie; ++i)
@@ -335,6 +336,7 @@ void Lexer::InstallDefaultFeatures()
 
 Fsm Lexer::Parse()
 {
+	CompileBudget::Scope scope(m_budget ? m_budget : CompileBudget::Current());
 	if (!Impl::yre_parse(*this))
 		return m_retval.As<Fsm>();
 	else {
@@ -27,6 +27,7 @@
 
 #include "encoding.h"
 #include "any.h"
+#include "budget.h"
 #include "stub/defaults.h"
 #include "stub/stl.h"
 #include <vector>
@@ -110,16 +111,19 @@ public:
 	// One-size-fits-all constructor set.
 	Lexer()
 		: m_encoding(&Encodings::Latin1())
+		, m_budget(0)
 	{ InstallDefaultFeatures(); }
 
 	explicit Lexer(const char* str)
 		: m_encoding(&Encodings::Latin1())
+		, m_budget(0)
 	{
 		InstallDefaultFeatures();
 		Assign(str, str + strlen(str));
 	}
 	template<class T> explicit Lexer(const T& t)
 		: m_encoding(&Encodings::Latin1())
+		, m_budget(0)
 	{
 		InstallDefaultFeatures();
 		Assign(t.begin(), t.end());
@@ -127,6 +131,7 @@ public:
 
 	template<class Iter> Lexer(Iter begin, Iter end)
 		: m_encoding(&Encodings::Latin1())
+		, m_budget(0)
 	{
 		InstallDefaultFeatures();
 		Assign(begin, end);
@@ -152,6 +157,12 @@ public:
 
 	Any& Retval() { return m_retval; }
 
+	/// A BudgetExceeded postponed by the parser until it has released its stack
+	Any& BudgetError() { return m_budgetError; }
+
+	/// Makes Parse() (and everything called from it) obey the given budget.
+	Lexer& SetBudget(CompileBudget* budget) { m_budget = budget; return *this; }
+
 	Fsm Parse();
 
 	void Parenthesized(Fsm& fsm);
@@ -171,7 +182,9 @@ private:
 	const Pire::Encoding* m_encoding;
 	yvector<Feature*> m_features;
 	Any m_retval;
+	Any m_budgetError;
 	ystring m_errmsg;
+	CompileBudget* m_budget;
 
 	friend class Feature;
 
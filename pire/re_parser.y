@@ -55,6 +55,7 @@ void yyerror(const char*);
 void yyerror(Pire::Lexer&, const char*);
 
 Fsm& ConvertToFSM(const Encoding& encoding, Any* any);
+void Abandon(Lexer& rlex, const BudgetExceeded& e, Any* a, Any* b = 0, Any* c = 0);
 void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& cr);
 
 #ifdef YYBYACC
@@ -75,43 +76,82 @@ void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& c
 %term YRE_AND
 %term YRE_NOT
 
+%destructor { delete $$; } <>
+
 %%
 
 regexp
 	: alternative
 		{
-			ConvertToFSM(rlex.Encoding(), $1);
+			try {
+				ConvertToFSM(rlex.Encoding(), $1);
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $1);
+				YYABORT;
+			}
 			DoSwap(rlex.Retval(), *$1);
 			delete $1;
+			$$ = 0;
 		}
 	;
 
 alternative
 	: conjunction
-	| alternative '|' conjunction { ConvertToFSM(rlex.Encoding(), ($$ = $1)) |= ConvertToFSM(rlex.Encoding(), $3); delete $3; }
+	| alternative '|' conjunction
+		{
+			try {
+				ConvertToFSM(rlex.Encoding(), ($$ = $1)) |= ConvertToFSM(rlex.Encoding(), $3);
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $1, $3);
+				YYABORT;
+			}
+			delete $3;
+		}
 	;
 
 conjunction
 	: negation
-	| conjunction YRE_AND negation { ConvertToFSM(rlex.Encoding(), ($$ = $1)) &= ConvertToFSM(rlex.Encoding(), $3); delete $3; }
+	| conjunction YRE_AND negation
+		{
+			try {
+				ConvertToFSM(rlex.Encoding(), ($$ = $1)) &= ConvertToFSM(rlex.Encoding(), $3);
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $1, $3);
+				YYABORT;
+			}
+			delete $3;
+		}
 	;
 
 negation
 	: concatenation
-	| YRE_NOT concatenation { ConvertToFSM(rlex.Encoding(), ($$ = $2)).Complement(); }
+	| YRE_NOT concatenation
+		{
+			try {
+				ConvertToFSM(rlex.Encoding(), ($$ = $2)).Complement();
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $2);
+				YYABORT;
+			}
+		}
 	;
 
 concatenation
 	: { $$ = new Any(Fsm()); }
 	| concatenation iteration
 		{
-			Fsm& a = ConvertToFSM(rlex.Encoding(), ($$ = $1));
-			if ($2->IsA<Term::CharacterRange>() && !$2->As<Term::CharacterRange>().second)
-				AppendRange(rlex.Encoding(), a, $2->As<Term::CharacterRange>());
-			else if ($2->IsA<Term::DotTag>())
-				rlex.Encoding().AppendDot(a);
-			else
-				a += ConvertToFSM(rlex.Encoding(), $2);
+			try {
+				Fsm& a = ConvertToFSM(rlex.Encoding(), ($$ = $1));
+				if ($2->IsA<Term::CharacterRange>() && !$2->As<Term::CharacterRange>().second)
+					AppendRange(rlex.Encoding(), a, $2->As<Term::CharacterRange>());
+				else if ($2->IsA<Term::DotTag>())
+					rlex.Encoding().AppendDot(a);
+				else
+					a += ConvertToFSM(rlex.Encoding(), $2);
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $1, $2);
+				YYABORT;
+			}
 			delete $2;
 		}
 	;
@@ -120,26 +160,31 @@ iteration
 	: term
 	| term YRE_COUNT
 		{
-			Fsm& orig = ConvertToFSM(rlex.Encoding(), $1);
-			$$ = new Any(orig);
-			Fsm& cur = $$->As<Fsm>();
-			const Term::RepetitionCount& repc = $2->As<Term::RepetitionCount>();
-
-
-			if (repc.first == 0 && repc.second == 1) {
-				Fsm empty;
-				cur |= empty;
-			} else if (repc.first == 0 && repc.second == Inf) {
-				cur.Iterate();
-			} else if (repc.first == 1 && repc.second == Inf) {
-				cur += *cur;
-			} else {
-				cur *= repc.first;
-				if (repc.second == Inf) {
-					cur += *orig;
-				} else if (repc.second != repc.first) {
-					cur += (orig | Fsm()) * (repc.second - repc.first);
+			$$ = 0;
+			try {
+				Fsm& orig = ConvertToFSM(rlex.Encoding(), $1);
+				$$ = new Any(orig);
+				Fsm& cur = $$->As<Fsm>();
+				const Term::RepetitionCount& repc = $2->As<Term::RepetitionCount>();
+
+				if (repc.first == 0 && repc.second == 1) {
+					Fsm empty;
+					cur |= empty;
+				} else if (repc.first == 0 && repc.second == Inf) {
+					cur.Iterate();
+				} else if (repc.first == 1 && repc.second == Inf) {
+					cur += *cur;
+				} else {
+					cur *= repc.first;
+					if (repc.second == Inf) {
+						cur += *orig;
+					} else if (repc.second != repc.first) {
+						cur += (orig | Fsm()) * (repc.second - repc.first);
+					}
 				}
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $$, $1, $2);
+				YYABORT;
 			}
 			delete $1;
 			delete $2;
@@ -151,18 +196,31 @@ term
 	| YRE_DOT
 	| '^'
 	| '$'
-	| '(' alternative ')'      { $$ = $2; rlex.Parenthesized($$->As<Fsm>()); }
+	| '(' alternative ')'
+		{
+			try {
+				rlex.Parenthesized(($$ = $2)->As<Fsm>());
+			} catch (BudgetExceeded& e) {
+				Abandon(rlex, e, $1, $2, $3);
+				YYABORT;
+			}
+		}
 	;
 
 %%
 
 int yylex(YYSTYPE* lval, Pire::Lexer& rlex)
 {
+	*lval = 0;
 	try {
 		Pire::Term term = rlex.Lex();
 		if (!term.Value().Empty())
 			*lval = new Any(term.Value());
 		return term.Type();
+	} catch (Pire::BudgetExceeded& e) {
+		// Throwing through yyparse() would leak everything on its stack
+		rlex.BudgetError() = e;
+		return 0;
 	} catch (Pire::Error &e) {
 		rlex.SetErrMsg(e.what());
 		return 0;
@@ -181,6 +239,16 @@ void yyerror(Pire::Lexer& rlex, const char* str)
 	yyerror(str);
 }
 
+/// Releases values of the rule being reduced (which yyparse() does not
+/// destroy on YYABORT) and postpones the error until yyparse() returns
+void Abandon(Lexer& rlex, const BudgetExceeded& e, Any* a, Any* b, Any* c)
+{
+	delete a;
+	delete b;
+	delete c;
+	rlex.BudgetError() = e;
+}
+
 void AppendRange(const Encoding& encoding, Fsm& a, const Term::CharacterRange& cr)
 {
 	yvector<ystring> strings;
@@ -238,6 +306,16 @@ Fsm& ConvertToFSM(const Encoding& encoding, Any* any)
 
 } // namespace
 
+namespace {
+	void RethrowBudgetError(Pire::Lexer& rlex)
+	{
+		Pire::Any err;
+		err.Swap(rlex.BudgetError());
+		if (err.IsA<Pire::BudgetExceeded>())
+			throw err.As<Pire::BudgetExceeded>();
+	}
+}
+
 #if defined(PPP) && !defined(HAVE_CONFIG_H)
 // Workaround for some braindamaged byaccs which cannot decide what yyparse() should look like 
 static int yyparse(void*, Pire::Lexer& rlex);
@@ -248,6 +326,7 @@ namespace Pire {
 		{
 			int rc = yyparse(0, rlex);
 
+			RethrowBudgetError(rlex);
 			if (!rlex.ErrMsg().empty())
 				throw Error(rlex.ErrMsg());
 			return rc;
@@ -261,6 +340,7 @@ namespace Pire {
 		{
 			int rc = yyparse(rlex);
 
+			RethrowBudgetError(rlex);
 			if (!rlex.ErrMsg().empty())
 				throw Error(rlex.ErrMsg());
 			return rc;
@@ -0,0 +1,273 @@
+/*
+ * registry.cpp -- scanners shared between processes
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "registry.h"
+#include "stub/memstreams.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef PIRE_HAVE_SHM_OPEN
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Pire {
+
+struct SharedGeneration::Shared {
+	MappedFile File;
+	Archive Scanners;
+	ui64 Number;
+	size_t Refs;
+
+	Shared(int fd, const ystring& name, const MapOptions& options, ui64 number)
+		: File(fd, name, options), Number(number), Refs(1)
+	{}
+};
+
+SharedGeneration::SharedGeneration(const SharedGeneration& g)
+	: m_shared(g.m_shared)
+{
+	if (m_shared)
+		++m_shared->Refs;
+}
+
+SharedGeneration& SharedGeneration::operator = (const SharedGeneration& g)
+{
+	SharedGeneration(g).Swap(*this);
+	return *this;
+}
+
+SharedGeneration::~SharedGeneration()
+{
+	if (m_shared && !--m_shared->Refs)
+		delete m_shared;
+}
+
+ui64 SharedGeneration::Number() const
+{
+	return m_shared ? m_shared->Number : 0;
+}
+
+const Archive& SharedGeneration::Scanners() const
+{
+	if (!m_shared)
+		throw Error("Pire::SharedGeneration is not attached");
+	return m_shared->Scanners;
+}
+
+SharedRegistry::SharedRegistry(const ystring& name)
+	: m_name(name)
+{
+	if (name.size() < 2 || name[0] != '/' || name.find('/', 1) != ystring::npos)
+		throw Error("Invalid shared registry name '" + name + "'");
+}
+
+ystring SharedRegistry::GenerationName(ui64 generation) const
+{
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%llu", static_cast<unsigned long long>(generation));
+	return m_name + suffix;
+}
+
+#ifdef PIRE_HAVE_SHM_OPEN
+
+namespace {
+	struct RegistryState {
+		ui64 Magic;
+		volatile ui64 Generation;
+	};
+
+	static const ui64 RegistryMagic = 0x5952545349474552ULL; // "REGISTRY" on little-endian
+
+	// A newer generation can be published (and ours unlinked) between
+	// reading the number and opening the generation; just try again then.
+	static const size_t MaxAttachAttempts = 16;
+
+	class Descriptor {
+	public:
+		explicit Descriptor(int fd): m_fd(fd) {}
+		~Descriptor() { if (m_fd != -1) close(m_fd); }
+		int Get() const { return m_fd; }
+	private:
+		int m_fd;
+
+		Descriptor(const Descriptor&);
+		Descriptor& operator = (const Descriptor&);
+	};
+
+	class SharedMapping {
+	public:
+		SharedMapping(int fd, size_t size, int prot): m_size(size)
+		{
+			m_data = mmap(0, size, prot, MAP_SHARED, fd, 0);
+			if (m_data == MAP_FAILED)
+				throw Error(ystring("Cannot map shared memory: ") + strerror(errno));
+		}
+		~SharedMapping() { munmap(m_data, m_size); }
+		void* Get() const { return m_data; }
+	private:
+		void* m_data;
+		size_t m_size;
+
+		SharedMapping(const SharedMapping&);
+		SharedMapping& operator = (const SharedMapping&);
+	};
+
+	ystring Describe(const ystring& what, const ystring& name)
+	{
+		return "Cannot " + what + " " + name + ": " + strerror(errno);
+	}
+
+	void CheckMagic(const RegistryState* state, const ystring& name)
+	{
+		if (state->Magic != RegistryMagic)
+			throw Error(name + " is not a Pire shared registry");
+	}
+}
+
+ui64 SharedRegistry::Publish(const ArchiveWriter& scanners)
+{
+	BufferOutput buf;
+	scanners.Save(&buf);
+	const MemBuffer& data = buf.Buffer();
+
+	Descriptor fd(shm_open(m_name.c_str(), O_RDWR | O_CREAT, 0644));
+	if (fd.Get() == -1)
+		throw Error(Describe("open", m_name));
+	// The lock is released as soon as the descriptor gets closed
+	if (lockf(fd.Get(), F_LOCK, 0))
+		throw Error(Describe("lock", m_name));
+	struct stat st;
+	if (fstat(fd.Get(), &st))
+		throw Error(Describe("stat", m_name));
+	bool created = static_cast<size_t>(st.st_size) < sizeof(RegistryState);
+	if (created && ftruncate(fd.Get(), sizeof(RegistryState)))
+		throw Error(Describe("resize", m_name));
+	SharedMapping stateMap(fd.Get(), sizeof(RegistryState), PROT_READ | PROT_WRITE);
+	RegistryState* state = static_cast<RegistryState*>(stateMap.Get());
+	if (created)
+		state->Magic = RegistryMagic;
+	CheckMagic(state, m_name);
+
+	ui64 generation = state->Generation + 1;
+	ystring name = GenerationName(generation);
+	// Might be left by a publisher which has died halfway
+	shm_unlink(name.c_str());
+	{
+		Descriptor gfd(shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644));
+		if (gfd.Get() == -1)
+			throw Error(Describe("create", name));
+		try {
+			if (ftruncate(gfd.Get(), data.Size()))
+				throw Error(Describe("resize", name));
+			SharedMapping map(gfd.Get(), data.Size(), PROT_READ | PROT_WRITE);
+			memcpy(map.Get(), data.Data(), data.Size());
+		} catch (...) {
+			shm_unlink(name.c_str());
+			throw;
+		}
+	}
+
+	// The generation is complete and unmapped by now, so readers
+	// which see the new number will find it in place.
+	state->Generation = generation;
+	if (generation > 1)
+		shm_unlink(GenerationName(generation - 1).c_str());
+	return generation;
+}
+
+ui64 SharedRegistry::Generation() const
+{
+	Descriptor fd(shm_open(m_name.c_str(), O_RDONLY, 0));
+	if (fd.Get() == -1) {
+		if (errno == ENOENT)
+			return 0;
+		throw Error(Describe("open", m_name));
+	}
+	struct stat st;
+	if (fstat(fd.Get(), &st))
+		throw Error(Describe("stat", m_name));
+	if (static_cast<size_t>(st.st_size) < sizeof(RegistryState))
+		// The very first publisher has not initialized it yet
+		return 0;
+	SharedMapping stateMap(fd.Get(), sizeof(RegistryState), PROT_READ);
+	const RegistryState* state = static_cast<const RegistryState*>(stateMap.Get());
+	CheckMagic(state, m_name);
+	return state->Generation;
+}
+
+SharedGeneration SharedRegistry::Attach(const MapOptions& options) const
+{
+	for (size_t attempt = 1; ; ++attempt) {
+		ui64 generation = Generation();
+		if (!generation)
+			throw Error("Nothing has been published in " + m_name + " yet");
+		ystring name = GenerationName(generation);
+		Descriptor fd(shm_open(name.c_str(), O_RDONLY, 0));
+		if (fd.Get() == -1) {
+			if (errno == ENOENT && attempt < MaxAttachAttempts)
+				continue;
+			throw Error(Describe("open", name));
+		}
+
+		SharedGeneration g;
+		g.m_shared = new SharedGeneration::Shared(fd.Get(), name, options, generation);
+		g.m_shared->Scanners.Mmap(g.m_shared->File.Data(), g.m_shared->File.Size());
+		return g;
+	}
+}
+
+void SharedRegistry::Remove()
+{
+	ui64 generation = Generation();
+	if (generation)
+		shm_unlink(GenerationName(generation).c_str());
+	shm_unlink(m_name.c_str());
+}
+
+#else
+
+ui64 SharedRegistry::Publish(const ArchiveWriter&)
+{
+	throw Error("Shared memory is not supported on this platform");
+}
+
+ui64 SharedRegistry::Generation() const
+{
+	throw Error("Shared memory is not supported on this platform");
+}
+
+SharedGeneration SharedRegistry::Attach(const MapOptions&) const
+{
+	throw Error("Shared memory is not supported on this platform");
+}
+
+void SharedRegistry::Remove() {}
+
+#endif
+
+}
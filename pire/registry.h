@@ -0,0 +1,107 @@
+/*
+ * registry.h -- scanners shared between processes
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_REGISTRY_H
+#define PIRE_REGISTRY_H
+
+
+#include "stub/stl.h"
+#include "scanners/common.h"
+#include "mapped.h"
+
+namespace Pire {
+
+/**
+ * One published generation of a SharedRegistry, attached to by a process.
+ * Copies of a handle share the same mapping, which stays valid (even after
+ * newer generations are published) until the last of them is destroyed.
+ * Like MappedScanner, the handles themselves are not thread-safe.
+ */
+class SharedGeneration {
+public:
+	SharedGeneration(): m_shared(0) {}
+	SharedGeneration(const SharedGeneration& g);
+	SharedGeneration& operator = (const SharedGeneration& g);
+	~SharedGeneration();
+
+	void Swap(SharedGeneration& g) { DoSwap(m_shared, g.m_shared); }
+
+	bool Empty() const { return !m_shared; }
+
+	ui64 Number() const;
+	const Archive& Scanners() const;
+
+	/// Mmaps the scanner with the given name right from the shared memory
+	template<class Scanner>
+	Scanner Get(const ystring& name) const
+	{
+		Scanner sc;
+		Scanners().Mmap(name, sc);
+		return sc;
+	}
+
+private:
+	struct Shared;
+	Shared* m_shared;
+
+	friend class SharedRegistry;
+};
+
+/**
+ * A named set of scanners in POSIX shared memory (shm_open()),
+ * which any number of processes can attach to without copying the tables.
+ *
+ * The registry object @p name keeps the number of the current generation;
+ * each generation is a separate object "<name>.<number>" holding an Archive.
+ * Publishing a generation never modifies the previous one: it is only
+ * unlinked, so processes which are still attached to it keep using it
+ * until they detach.
+ *
+ * Publishers are serialized with a lock on the registry object.
+ */
+class SharedRegistry {
+public:
+	/// @p name must start with a slash and contain no other slashes, as shm_open() requires
+	explicit SharedRegistry(const ystring& name);
+
+	/// Publishes a new generation holding all scanners of the writer; returns its number
+	ui64 Publish(const ArchiveWriter& scanners);
+
+	/// Returns the number of the current generation, or zero if nothing is published yet
+	ui64 Generation() const;
+
+	/// Attaches to the current generation
+	SharedGeneration Attach(const MapOptions& options = MapOptions()) const;
+
+	/// Unlinks the registry and its current generation (attached processes are not affected)
+	void Remove();
+
+private:
+	ystring m_name;
+
+	ystring GenerationName(ui64 generation) const;
+};
+
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include "stub/stl.h"
 #include "stub/memstreams.h"
 #include "scanners/pair.h"
+#include "scanners/tuple.h"
 #include "platform.h"
 
 namespace Pire {
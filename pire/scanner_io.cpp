@@ -28,6 +28,24 @@
 #include "scanners/loaded.h"
 #include "align.h"
 #include "scanners/loaded.h"
+#include "fsm.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#else
+#include <io.h>
+#endif
+
+#ifdef PIRE_HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 namespace Pire {
 	
@@ -59,7 +77,7 @@ void SimpleScanner::Load(yistream* s)
 	if (empty) {
 		sc.Alias(Null());
 	} else {
-		sc.m_buffer = new char[sc.BufSize()];
+		sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
 		Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
 		sc.Markup(sc.m_buffer);
 		sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
@@ -76,26 +94,13 @@ void SlowScanner::Save(yostream* s) const
 	SavePodType(s, Empty());
 	Impl::AlignSave(s, sizeof(Empty()));
 	if (!Empty()) {
-		YASSERT(!m_vec.empty());
+		size_t jumpPosSize = m.statesCount * m.lettersCount + 1;
 		Impl::AlignedSaveArray(s, m_letters, MaxChar);
 		Impl::AlignedSaveArray(s, m_finals, m.statesCount);
-
-		size_t c = 0;
-		SavePodType<size_t>(s, 0);
-		for (yvector< yvector< unsigned > >::const_iterator i = m_vec.begin(), ie = m_vec.end(); i != ie; ++i) {
-			size_t n = c + i->size();
-			SavePodType(s, n);
-			c = n;
-		}
-		Impl::AlignSave(s, (m_vec.size() + 1) * sizeof(size_t));
-
-		size_t size = 0;
-		for (yvector< yvector< unsigned > >::const_iterator i = m_vec.begin(), ie = m_vec.end(); i != ie; ++i)
-			if (!i->empty()) {
-				SavePodArray(s, &(*i)[0], i->size());
-				size += sizeof(unsigned) * i->size();
-			}
-		Impl::AlignSave(s, size);
+		Impl::AlignedSaveArray(s, m_jumpPos, jumpPosSize);
+		Impl::AlignedSaveArray(s, m_jumps, m_jumpPos[jumpPosSize - 1]);
+		Impl::AlignedSaveArray(s, m_acceptPos, m.statesCount + 1);
+		Impl::AlignedSaveArray(s, m_accept, m_acceptPos[m.statesCount]);
 	}
 }
 
@@ -111,8 +116,8 @@ void SlowScanner::Load(yistream* s)
 	if (empty) {
 		sc.Alias(Null());
 	} else {
-		sc.m_vec.resize(sc.m.lettersCount * sc.m.statesCount);
-		sc.m_vecptr = &sc.m_vec;
+		size_t jumpPosSize = sc.m.statesCount * sc.m.lettersCount + 1;
+		sc.m_tables = new Tables;
 
 		sc.alloc(sc.m_letters, MaxChar);
 		Impl::AlignedLoadArray(s, sc.m_letters, MaxChar);
@@ -120,23 +125,17 @@ void SlowScanner::Load(yistream* s)
 		sc.alloc(sc.m_finals, sc.m.statesCount);
 		Impl::AlignedLoadArray(s, sc.m_finals, sc.m.statesCount);
 
-		size_t c;
-		LoadPodType(s, c);
-		for (yvector< yvector< unsigned > >::iterator i = sc.m_vec.begin(), ie = sc.m_vec.end(); i != ie; ++i) {
-			size_t n;
-			LoadPodType(s, n);
-			i->resize(n - c);
-			c = n;
-		}
-		Impl::AlignLoad(s, (m_vec.size() + 1) * sizeof(size_t));
-
-		size_t size = 0;
-		for (yvector< yvector< unsigned > >::iterator i = sc.m_vec.begin(), ie = sc.m_vec.end(); i != ie; ++i)
-			if (!i->empty()) { 
-				LoadPodArray(s, &(*i)[0], i->size());
-				size += sizeof(unsigned) * i->size();
-			}
-		Impl::AlignLoad(s, size);
+		sc.alloc(sc.m_jumpPos, jumpPosSize);
+		Impl::AlignedLoadArray(s, sc.m_jumpPos, jumpPosSize);
+
+		sc.alloc(sc.m_jumps, sc.m_jumpPos[jumpPosSize - 1]);
+		Impl::AlignedLoadArray(s, sc.m_jumps, sc.m_jumpPos[jumpPosSize - 1]);
+
+		sc.alloc(sc.m_acceptPos, sc.m.statesCount + 1);
+		Impl::AlignedLoadArray(s, sc.m_acceptPos, sc.m.statesCount + 1);
+
+		sc.alloc(sc.m_accept, sc.m_acceptPos[sc.m.statesCount]);
+		Impl::AlignedLoadArray(s, sc.m_accept, sc.m_acceptPos[sc.m.statesCount]);
 	}
 	Swap(sc);
 }
@@ -161,7 +160,7 @@ void LoadedScanner::Load(yistream* s)
 	Header header = Impl::ValidateHeader(s, 4, sizeof(sc.m));
 	LoadPodType(s, sc.m);
 	Impl::AlignLoad(s, sizeof(sc.m));
-	sc.m_buffer = new char[sc.BufSize()];
+	sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
 	sc.Markup(sc.m_buffer);
 	Impl::AlignedLoadArray(s, sc.m_letters, MaxChar);
 	Impl::AlignedLoadArray(s, sc.m_jumps, sc.m.statesCount * sc.m.lettersCount);
@@ -174,4 +173,622 @@ void LoadedScanner::Load(yistream* s)
 	Swap(sc);
 }
 
+namespace {
+	// FSMs are stored as sequences of variable-length integers (7 bits per byte, LSB first).
+	void SaveVarint(yostream* s, ui64 val)
+	{
+		while (val >= 0x80) {
+			s->put(static_cast<char>((val & 0x7F) | 0x80));
+			val >>= 7;
+		}
+		s->put(static_cast<char>(val));
+	}
+
+	ui64 LoadVarint(yistream* s)
+	{
+		ui64 val = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			int ch;
+			try {
+				ch = s->get();
+			} catch (std::ios_base::failure&) {
+				ch = std::char_traits<char>::eof();
+			}
+			if (ch == std::char_traits<char>::eof())
+				throw Error("EOF reached while loading Pire::Fsm");
+			val |= static_cast<ui64>(ch & 0x7F) << shift;
+			if (!(ch & 0x80))
+				return val;
+		}
+		throw Error("Serialized Pire::Fsm is corrupted");
+	}
+
+	size_t LoadIndex(yistream* s, size_t bound)
+	{
+		ui64 val = LoadVarint(s);
+		if (val >= bound)
+			throw Error("Serialized Pire::Fsm is corrupted");
+		return static_cast<size_t>(val);
+	}
+
+	// Sets of states are sorted, so we store differences between adjacent items
+	void SaveStates(yostream* s, const yset<size_t>& states)
+	{
+		SaveVarint(s, states.size());
+		size_t prev = 0;
+		for (yset<size_t>::const_iterator i = states.begin(), ie = states.end(); i != ie; ++i) {
+			SaveVarint(s, *i - prev);
+			prev = *i;
+		}
+	}
+
+	void LoadStates(yistream* s, yset<size_t>& states, size_t bound)
+	{
+		states.clear();
+		size_t count = LoadIndex(s, bound + 1);
+		ui64 cur = 0;
+		for (size_t i = 0; i != count; ++i) {
+			cur += LoadVarint(s);
+			if (cur >= bound)
+				throw Error("Serialized Pire::Fsm is corrupted");
+			states.insert(states.end(), static_cast<size_t>(cur));
+		}
+	}
+
+	enum {
+		FsmDetermined  = 0x01,
+		FsmSparsed     = 0x02,
+		FsmAlternative = 0x04
+	};
+}
+
+void Fsm::Save(yostream* s) const
+{
+	SavePodType(s, Header(5, 0));
+	Impl::AlignSave(s, sizeof(Header));
+
+	SaveVarint(s, (determined ? FsmDetermined : 0) | (m_sparsed ? FsmSparsed : 0) | (isAlternative ? FsmAlternative : 0));
+	SaveVarint(s, Size());
+	SaveVarint(s, initial);
+	SaveStates(s, m_final);
+
+	for (TransitionTable::const_iterator row = m_transitions.begin(), rowEnd = m_transitions.end(); row != rowEnd; ++row) {
+		SaveVarint(s, row->size());
+		for (TransitionRow::const_iterator i = row->begin(), ie = row->end(); i != ie; ++i) {
+			SaveVarint(s, i->first);
+			SaveStates(s, i->second);
+		}
+	}
+
+	if (m_sparsed) {
+		// Letter classes go in the order of their indices
+		yvector<LettersTbl::ConstIterator> classes(letters.Size());
+		for (LettersTbl::ConstIterator i = letters.Begin(), ie = letters.End(); i != ie; ++i)
+			classes[i->second.first] = i;
+		SaveVarint(s, classes.size());
+		for (size_t i = 0; i != classes.size(); ++i) {
+			const yvector<Char>& klass = classes[i]->second.second;
+			SaveVarint(s, classes[i]->first);
+			SaveVarint(s, klass.size());
+			for (yvector<Char>::const_iterator j = klass.begin(), je = klass.end(); j != je; ++j)
+				SaveVarint(s, *j);
+		}
+	}
+
+	SaveVarint(s, outputs.size());
+	for (Outputs::const_iterator i = outputs.begin(), ie = outputs.end(); i != ie; ++i) {
+		SaveVarint(s, i->first);
+		SaveVarint(s, i->second.size());
+		for (Outputs::mapped_type::const_iterator j = i->second.begin(), je = i->second.end(); j != je; ++j) {
+			SaveVarint(s, j->first);
+			SaveVarint(s, j->second);
+		}
+	}
+
+	SaveVarint(s, tags.size());
+	for (Tags::const_iterator i = tags.begin(), ie = tags.end(); i != ie; ++i) {
+		SaveVarint(s, i->first);
+		SaveVarint(s, i->second);
+	}
+}
+
+void Fsm::Load(yistream* s)
+{
+	Impl::ValidateHeader(s, 5, 0);
+
+	Fsm fsm;
+	ui64 flags = LoadVarint(s);
+	fsm.determined = (flags & FsmDetermined) != 0;
+	fsm.m_sparsed = (flags & FsmSparsed) != 0;
+	fsm.isAlternative = (flags & FsmAlternative) != 0;
+
+	size_t size = static_cast<size_t>(LoadVarint(s));
+	if (!size)
+		throw Error("Serialized Pire::Fsm is corrupted");
+	fsm.Resize(size);
+	fsm.initial = LoadIndex(s, size);
+	LoadStates(s, fsm.m_final, size);
+
+	for (TransitionTable::iterator row = fsm.m_transitions.begin(), rowEnd = fsm.m_transitions.end(); row != rowEnd; ++row) {
+		size_t count = LoadIndex(s, MaxChar + 1);
+		for (size_t i = 0; i != count; ++i) {
+			Char letter = static_cast<Char>(LoadIndex(s, MaxChar));
+			LoadStates(s, (*row)[letter], size);
+			fsm.m_connections += (*row)[letter].size();
+		}
+	}
+
+	if (fsm.m_sparsed) {
+		// Rebuild the partition from a fake transition table, where each letter
+		// leads to the index of its class. The partition only uses the table while
+		// being built, so it does not matter that the table is gone afterwards.
+		size_t count = LoadIndex(s, MaxChar + 1);
+		TransitionTable classes(1);
+		yvector<Char> reps;
+		yvector<Char> others;
+		for (size_t i = 0; i != count; ++i) {
+			Char rep = static_cast<Char>(LoadIndex(s, MaxChar));
+			reps.push_back(rep);
+			size_t len = LoadIndex(s, MaxChar + 1);
+			for (size_t j = 0; j != len; ++j) {
+				Char letter = static_cast<Char>(LoadIndex(s, MaxChar));
+				if (!classes[0][letter].empty())
+					throw Error("Serialized Pire::Fsm is corrupted");
+				classes[0][letter].insert(i);
+				if (letter != rep)
+					others.push_back(letter);
+			}
+			if (classes[0][rep].find(i) == classes[0][rep].end())
+				throw Error("Serialized Pire::Fsm is corrupted");
+		}
+		fsm.letters = LettersTbl(LettersEquality(classes));
+		for (yvector<Char>::const_iterator i = reps.begin(), ie = reps.end(); i != ie; ++i)
+			fsm.letters.Append(*i);
+		for (yvector<Char>::const_iterator i = others.begin(), ie = others.end(); i != ie; ++i)
+			fsm.letters.Append(*i);
+	}
+
+	size_t count = static_cast<size_t>(LoadVarint(s));
+	for (size_t i = 0; i != count; ++i) {
+		Outputs::mapped_type& row = fsm.outputs[LoadIndex(s, size)];
+		size_t len = static_cast<size_t>(LoadVarint(s));
+		for (size_t j = 0; j != len; ++j) {
+			size_t to = LoadIndex(s, size);
+			row[to] = static_cast<unsigned long>(LoadVarint(s));
+		}
+	}
+
+	count = static_cast<size_t>(LoadVarint(s));
+	for (size_t i = 0; i != count; ++i) {
+		size_t state = LoadIndex(s, size);
+		fsm.tags[state] = static_cast<unsigned long>(LoadVarint(s));
+	}
+
+	*this = fsm;
+}
+
+namespace Impl {
+
+namespace {
+	// Tables for "slicing-by-8" computation, which processes 8 bytes at a time
+	struct Crc32cTable {
+		ui32 Data[8][256];
+
+		Crc32cTable()
+		{
+			for (ui32 i = 0; i != 256; ++i) {
+				ui32 c = i;
+				for (int j = 0; j != 8; ++j)
+					c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+				Data[0][i] = c;
+			}
+			for (ui32 i = 0; i != 256; ++i)
+				for (int k = 1; k != 8; ++k)
+					Data[k][i] = (Data[k - 1][i] >> 8) ^ Data[0][Data[k - 1][i] & 0xFF];
+		}
+	};
+}
+
+ui32 Crc32c(const void* data, size_t size, ui32 crc)
+{
+	static const Crc32cTable table;
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	crc = ~crc;
+	for (; p + 8 <= end; p += 8) {
+		ui32 lo = crc ^ LoadLE32(p);
+		ui32 hi = LoadLE32(p + 4);
+		crc = table.Data[7][lo & 0xFF] ^ table.Data[6][(lo >> 8) & 0xFF]
+			^ table.Data[5][(lo >> 16) & 0xFF] ^ table.Data[4][lo >> 24]
+			^ table.Data[3][hi & 0xFF] ^ table.Data[2][(hi >> 8) & 0xFF]
+			^ table.Data[1][(hi >> 16) & 0xFF] ^ table.Data[0][hi >> 24];
+	}
+	for (; p != end; ++p)
+		crc = table.Data[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+namespace {
+	struct ParallelJob {
+		void (*Fn)(void*, size_t);
+		void* Ctx;
+		size_t Count;
+		size_t Next;
+		bool Failed;
+		ystring Message;
+#ifdef PIRE_HAVE_PTHREAD_H
+		pthread_mutex_t Lock;
+#endif
+
+		bool Take(size_t& i)
+		{
+#ifdef PIRE_HAVE_PTHREAD_H
+			pthread_mutex_lock(&Lock);
+#endif
+			bool ok = !Failed && Next != Count;
+			if (ok)
+				i = Next++;
+#ifdef PIRE_HAVE_PTHREAD_H
+			pthread_mutex_unlock(&Lock);
+#endif
+			return ok;
+		}
+
+		void Fail(const char* msg)
+		{
+#ifdef PIRE_HAVE_PTHREAD_H
+			pthread_mutex_lock(&Lock);
+#endif
+			if (!Failed) {
+				Failed = true;
+				Message = msg;
+			}
+#ifdef PIRE_HAVE_PTHREAD_H
+			pthread_mutex_unlock(&Lock);
+#endif
+		}
+
+		void Run()
+		{
+			size_t i;
+			while (Take(i)) {
+				try {
+					Fn(Ctx, i);
+				} catch (std::exception& e) {
+					Fail(e.what());
+				}
+			}
+		}
+
+		static void* Worker(void* job)
+		{
+			static_cast<ParallelJob*>(job)->Run();
+			return 0;
+		}
+	};
+}
+
+void ParallelFor(size_t count, size_t threads, void (*fn)(void* ctx, size_t i), void* ctx)
+{
+	ParallelJob job;
+	job.Fn = fn;
+	job.Ctx = ctx;
+	job.Count = count;
+	job.Next = 0;
+	job.Failed = false;
+
+#ifdef PIRE_HAVE_PTHREAD_H
+	pthread_mutex_init(&job.Lock, 0);
+	yvector<pthread_t> workers;
+	for (size_t i = 1; i < ymin(threads, count); ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, &ParallelJob::Worker, &job))
+			break; // The calling thread will do the rest
+		workers.push_back(thread);
+	}
+	job.Run();
+	for (yvector<pthread_t>::iterator i = workers.begin(), ie = workers.end(); i != ie; ++i)
+		pthread_join(*i, 0);
+	pthread_mutex_destroy(&job.Lock);
+#else
+	(void) threads;
+	job.Run();
+#endif
+
+	if (job.Failed)
+		throw Error(job.Message);
+}
+
+void SaveChunks(yostream* s, const yvector<Chunk>& chunks)
+{
+	for (yvector<Chunk>::const_iterator i = chunks.begin(), ie = chunks.end(); i != ie; ++i)
+		SavePodArray(s, static_cast<const char*>(i->Data), i->Size);
+}
+
+void* CopyChunks(void* buf, const yvector<Chunk>& chunks)
+{
+	char* p = static_cast<char*>(buf);
+	for (yvector<Chunk>::const_iterator i = chunks.begin(), ie = chunks.end(); i != ie; ++i) {
+		memcpy(p, i->Data, i->Size);
+		p += i->Size;
+	}
+	return p;
+}
+
+#ifndef _WIN32
+
+void WriteChunks(int fd, const yvector<Chunk>& chunks)
+{
+	yvector<struct iovec> iov;
+	iov.reserve(chunks.size());
+	for (yvector<Chunk>::const_iterator i = chunks.begin(), ie = chunks.end(); i != ie; ++i) {
+		if (!i->Size)
+			continue;
+		struct iovec v;
+		v.iov_base = const_cast<void*>(i->Data);
+		v.iov_len = i->Size;
+		iov.push_back(v);
+	}
+
+	size_t done = 0;
+	while (done != iov.size()) {
+		ssize_t written = writev(fd, &iov[done], static_cast<int>(ymin<size_t>(iov.size() - done, IOV_MAX)));
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			throw Error(ystring("Cannot write serialized scanner: ") + strerror(errno));
+		// Skip what has been written, possibly stopping in the middle of a chunk
+		for (size_t left = written; left; ) {
+			size_t n = ymin(left, iov[done].iov_len);
+			iov[done].iov_base = static_cast<char*>(iov[done].iov_base) + n;
+			iov[done].iov_len -= n;
+			left -= n;
+			if (!iov[done].iov_len)
+				++done;
+		}
+		while (done != iov.size() && !iov[done].iov_len)
+			++done;
+	}
+}
+
+#else
+
+void WriteChunks(int fd, const yvector<Chunk>& chunks)
+{
+	for (yvector<Chunk>::const_iterator i = chunks.begin(), ie = chunks.end(); i != ie; ++i) {
+		const char* p = static_cast<const char*>(i->Data);
+		for (size_t left = i->Size; left; ) {
+			int written = _write(fd, p, static_cast<unsigned>(ymin<size_t>(left, INT_MAX)));
+			if (written <= 0)
+				throw Error(ystring("Cannot write serialized scanner: ") + strerror(errno));
+			p += written;
+			left -= written;
+		}
+	}
+}
+
+#endif
+
+}
+
+struct BackgroundVerifier::State {
+	struct Range {
+		const void* Data;
+		size_t Size;
+		ui32 Checksum;
+	};
+
+	ydeque<Range> Queue;
+	bool Ok;
+#ifdef PIRE_HAVE_PTHREAD_H
+	bool Running;
+	bool Started;
+	pthread_t Thread;
+	mutable pthread_mutex_t Lock;
+	pthread_cond_t Finished;
+
+	static void* Worker(void* state)
+	{
+		static_cast<State*>(state)->Run();
+		return 0;
+	}
+
+	void Run()
+	{
+		pthread_mutex_lock(&Lock);
+		while (!Queue.empty()) {
+			Range r = Queue.front();
+			Queue.pop_front();
+			pthread_mutex_unlock(&Lock);
+			bool ok = Impl::Crc32c(r.Data, r.Size) == r.Checksum;
+			pthread_mutex_lock(&Lock);
+			Ok = Ok && ok;
+		}
+		Running = false;
+		pthread_cond_broadcast(&Finished);
+		pthread_mutex_unlock(&Lock);
+	}
+#endif
+};
+
+BackgroundVerifier::BackgroundVerifier()
+	: m_state(new State)
+{
+	m_state->Ok = true;
+#ifdef PIRE_HAVE_PTHREAD_H
+	m_state->Running = false;
+	m_state->Started = false;
+	pthread_mutex_init(&m_state->Lock, 0);
+	pthread_cond_init(&m_state->Finished, 0);
+#endif
+}
+
+BackgroundVerifier::~BackgroundVerifier()
+{
+	Wait();
+#ifdef PIRE_HAVE_PTHREAD_H
+	if (m_state->Started)
+		pthread_join(m_state->Thread, 0);
+	pthread_cond_destroy(&m_state->Finished);
+	pthread_mutex_destroy(&m_state->Lock);
+#endif
+	delete m_state;
+}
+
+void BackgroundVerifier::Add(const void* data, size_t size, ui32 checksum)
+{
+#ifdef PIRE_HAVE_PTHREAD_H
+	State::Range r = { data, size, checksum };
+	pthread_mutex_lock(&m_state->Lock);
+	m_state->Queue.push_back(r);
+	if (!m_state->Running) {
+		// The previous worker (if any) has already finished or is just about to
+		if (m_state->Started)
+			pthread_join(m_state->Thread, 0);
+		m_state->Started = m_state->Running = !pthread_create(&m_state->Thread, 0, &State::Worker, m_state);
+	}
+	bool running = m_state->Running;
+	pthread_mutex_unlock(&m_state->Lock);
+	if (!running)
+		// No threads for us; do the job ourselves
+		m_state->Run();
+#else
+	m_state->Ok = m_state->Ok && Impl::Crc32c(data, size) == checksum;
+#endif
+}
+
+bool BackgroundVerifier::Done() const
+{
+#ifdef PIRE_HAVE_PTHREAD_H
+	pthread_mutex_lock(&m_state->Lock);
+	bool done = !m_state->Running;
+	pthread_mutex_unlock(&m_state->Lock);
+	return done;
+#else
+	return true;
+#endif
+}
+
+bool BackgroundVerifier::Wait()
+{
+#ifdef PIRE_HAVE_PTHREAD_H
+	pthread_mutex_lock(&m_state->Lock);
+	while (m_state->Running)
+		pthread_cond_wait(&m_state->Finished, &m_state->Lock);
+	bool ok = m_state->Ok;
+	pthread_mutex_unlock(&m_state->Lock);
+	return ok;
+#else
+	return m_state->Ok;
+#endif
+}
+
+void ArchiveWriter::Add(const ystring& name, const char* data, size_t size)
+{
+	if (size < sizeof(Header))
+		throw Error("Attempted to add an invalid scanner to the archive");
+	if (!m_entries.insert(ymake_pair(name, ystring(data, size))).second)
+		throw Error("Duplicate scanner name '" + name + "' in the archive");
+}
+
+void ArchiveWriter::Save(yostream* s) const
+{
+	yvector<ArchiveEntry> entries;
+	entries.reserve(m_entries.size());
+	size_t offset = sizeof(Header) + sizeof(ArchiveToc) + m_entries.size() * sizeof(ArchiveEntry);
+	for (ymap<ystring, ystring>::const_iterator i = m_entries.begin(), ie = m_entries.end(); i != ie; ++i) {
+		ArchiveEntry e;
+		e.NameOffset = offset;
+		e.NameLength = i->first.size();
+		offset += i->first.size();
+		entries.push_back(e);
+	}
+	size_t idx = 0;
+	for (ymap<ystring, ystring>::const_iterator i = m_entries.begin(), ie = m_entries.end(); i != ie; ++i, ++idx) {
+		ArchiveEntry& e = entries[idx];
+		offset = Impl::AlignUp(offset, ArchiveAlign);
+		e.Offset = offset;
+		e.Size = i->second.size();
+		e.Type = reinterpret_cast<const Header*>(i->second.data())->Type;
+		e.Checksum = Impl::Crc32c(i->second.data(), i->second.size());
+		offset += i->second.size();
+	}
+	ArchiveToc toc;
+	toc.Count = entries.size();
+	toc.Size = Impl::AlignUp(offset, sizeof(size_t));
+
+	SavePodType(s, Header(6, sizeof(ArchiveEntry)));
+	SavePodType(s, toc);
+	if (!entries.empty())
+		SavePodArray(s, &entries[0], entries.size());
+	for (ymap<ystring, ystring>::const_iterator i = m_entries.begin(), ie = m_entries.end(); i != ie; ++i)
+		SavePodArray(s, i->first.data(), i->first.size());
+
+	static const char fill[ArchiveAlign] = {0};
+	offset = entries.empty() ? sizeof(Header) + sizeof(ArchiveToc) : entries.back().NameOffset + entries.back().NameLength;
+	idx = 0;
+	for (ymap<ystring, ystring>::const_iterator i = m_entries.begin(), ie = m_entries.end(); i != ie; ++i, ++idx) {
+		SavePodArray(s, fill, entries[idx].Offset - offset);
+		SavePodArray(s, i->second.data(), i->second.size());
+		offset = entries[idx].Offset + entries[idx].Size;
+	}
+	SavePodArray(s, fill, toc.Size - offset);
+}
+
+const void* Archive::Mmap(const void* ptr, size_t size)
+{
+	Impl::CheckAlign(ptr);
+	const size_t* p = reinterpret_cast<const size_t*>(ptr);
+	Impl::ValidateHeader(p, size, 6, sizeof(ArchiveEntry));
+	const ArchiveToc* toc;
+	Impl::MapPtr(toc, 1, p, size);
+	size_t total = size + sizeof(Header) + sizeof(ArchiveToc);
+	if (toc->Size > total || toc->Size < sizeof(Header) + sizeof(ArchiveToc) || toc->Count > (toc->Size - sizeof(Header) - sizeof(ArchiveToc)) / sizeof(ArchiveEntry))
+		throw Error("EOF reached while mapping Pire::Archive");
+
+	const char* begin = static_cast<const char*>(ptr);
+	const ArchiveEntry* entries = reinterpret_cast<const ArchiveEntry*>(p);
+	for (size_t i = 0; i != toc->Count; ++i) {
+		const ArchiveEntry& e = entries[i];
+		if (static_cast<ui64>(e.NameOffset) + e.NameLength > toc->Size || e.Offset > toc->Size || e.Size > toc->Size - e.Offset || !Impl::IsAligned(e.Offset, sizeof(size_t)))
+			throw Error("Pire::Archive is corrupted");
+		if (i && ystring(begin + entries[i-1].NameOffset, entries[i-1].NameLength) >= ystring(begin + e.NameOffset, e.NameLength))
+			throw Error("Pire::Archive is corrupted");
+	}
+
+	m_begin = begin;
+	m_count = toc->Count;
+	m_entries = entries;
+	return begin + toc->Size;
+}
+
+size_t Archive::Find(const ystring& name) const
+{
+	size_t lo = 0, hi = m_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = Name(mid).compare(name);
+		if (!cmp)
+			return mid;
+		else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return m_count;
+}
+
+bool Archive::Verify(size_t i) const
+{
+	return Impl::Crc32c(Data(i), Size(i)) == m_entries[i].Checksum;
+}
+
+bool Archive::Verify() const
+{
+	for (size_t i = 0; i != m_count; ++i)
+		if (!Verify(i))
+			return false;
+	return true;
+}
+
 }
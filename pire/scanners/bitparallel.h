@@ -0,0 +1,429 @@
+/*
+ * bitparallel.h -- the definition of the BitParallelScanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_BITPARALLEL_H
+#define PIRE_SCANNERS_BITPARALLEL_H
+
+#include <string.h>
+#include <algorithm>
+#include "common.h"
+#include "../stub/stl.h"
+#include "../stub/saveload.h"
+#include "../fsm.h"
+
+#ifdef PIRE_DEBUG
+#include <iostream>
+#endif
+
+namespace Pire {
+
+namespace Impl {
+
+/**
+ * A scanner simulating a nondeterministic automaton with bitwise operations,
+ * so it needs no determinization (and thus cannot blow up), yet takes
+ * a bounded number of word operations per character.
+ *
+ * Automaton states are split into Glushkov-like positions: pairs of a state
+ * and a set of letter classes it is entered by (plus the initial state itself).
+ * All transitions into a position are made by the same set of letters, so
+ *   next = Follow(current) & Mask[letter],
+ * where Follow() is the union of positions reachable from any of the current
+ * ones, looked up by 8-bit chunks of the current set.
+ *
+ * Can hold up to Words * 64 positions; the constructor throws otherwise.
+ */
+template<unsigned Words>
+class BitParallelScanner {
+public:
+	typedef ui64        Word;
+	typedef size_t      Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 0
+	};
+
+	static const size_t Capacity = Words * 64;
+
+	struct State {
+		Word Bits[Words];
+
+#ifdef PIRE_DEBUG
+		friend yostream& operator << (yostream& stream, const State& state)
+		{
+			for (size_t i = 0; i != Capacity; ++i)
+				if (state.Bits[i / 64] & (static_cast<Word>(1) << (i % 64)))
+					stream << i << " ";
+			return stream;
+		}
+#endif
+	};
+
+	BitParallelScanner() { Alias(Null()); }
+
+	explicit BitParallelScanner(Fsm& fsm);
+
+	BitParallelScanner(const BitParallelScanner& s): m(s.m)
+	{
+		if (!s.m_buffer) {
+			// Empty or mmap()-ed scanner, just copy pointers
+			Alias(s);
+		} else if (char* buf = Impl::ShareBuffer(s.m_buffer)) {
+			// In-memory scanner, share its tables
+			Alias(s);
+			m_buffer = buf;
+		} else {
+			m_buffer = Impl::NewSharedBuffer(BufSize());
+			memcpy(m_buffer, s.m_buffer, BufSize());
+			Markup(m_buffer);
+		}
+	}
+
+	void Swap(BitParallelScanner& s)
+	{
+		DoSwap(m_buffer, s.m_buffer);
+		DoSwap(m.positions, s.m.positions);
+		DoSwap(m.lettersCount, s.m.lettersCount);
+		DoSwap(m.chunks, s.m.chunks);
+		DoSwap(m_initial, s.m_initial);
+		DoSwap(m_finals, s.m_finals);
+		DoSwap(m_letters, s.m_letters);
+		DoSwap(m_masks, s.m_masks);
+		DoSwap(m_follow, s.m_follow);
+	}
+
+	BitParallelScanner& operator = (const BitParallelScanner& s) { BitParallelScanner(s).Swap(*this); return *this; }
+
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	BitParallelScanner(BitParallelScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	BitParallelScanner& operator = (BitParallelScanner&& s) { Swap(s); return *this; }
+#endif
+
+	~BitParallelScanner()
+	{
+		Impl::ReleaseSharedBuffer(m_buffer);
+	}
+
+	bool Empty() const { return m_follow == Null().m_follow; }
+
+	/// Returns the number of positions
+	size_t Size() const { return m.positions; }
+	size_t LettersCount() const { return m.lettersCount; }
+	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+
+	void Initialize(State& state) const
+	{
+		memcpy(state.Bits, m_initial, sizeof(state.Bits));
+	}
+
+	Char Translate(Char ch) const
+	{
+		return m_letters[static_cast<size_t>(ch)];
+	}
+
+	Action NextTranslated(State& state, Char letter) const
+	{
+		Word next[Words] = {0};
+		const Word* chunk = m_follow;
+		for (size_t w = 0; w != Words; ++w) {
+			Word bits = state.Bits[w];
+			for (; bits; bits >>= 8, chunk += 256 * Words) {
+				const Word* follow = chunk + (bits & 0xFF) * Words;
+				for (size_t i = 0; i != Words; ++i)
+					next[i] |= follow[i];
+			}
+			chunk = m_follow + (w + 1) * 8 * 256 * Words;
+		}
+		const Word* mask = m_masks + letter * Words;
+		for (size_t i = 0; i != Words; ++i)
+			state.Bits[i] = next[i] & mask[i];
+		return 0;
+	}
+
+	Action Next(State& state, Char c) const
+	{
+		return NextTranslated(state, Translate(c));
+	}
+
+	void TakeAction(State&, Action) const {}
+
+	bool Final(const State& state) const
+	{
+		Word any = 0;
+		for (size_t i = 0; i != Words; ++i)
+			any |= state.Bits[i] & m_finals[i];
+		return any != 0;
+	}
+
+	bool Dead(const State& state) const
+	{
+		Word any = 0;
+		for (size_t i = 0; i != Words; ++i)
+			any |= state.Bits[i];
+		return !any;
+	}
+
+	bool CanStop(const State& state) const { return Final(state); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		static const size_t accept[1] = { 0 };
+		return Final(state) ? ymake_pair(accept, accept + 1) : ymake_pair(accept, accept);
+	}
+
+	const State& StateIndex(const State& state) const { return state; }
+
+	/*
+	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
+	 * to unconsumed part of the buffer.
+	 */
+	const void* Mmap(const void* ptr, size_t size)
+	{
+		Impl::CheckAlign(ptr);
+		BitParallelScanner s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Impl::ValidateHeader(p, size, 8, sizeof(s.m));
+		const Locals* locals;
+		Impl::MapPtr(locals, 1, p, size);
+		memcpy(&s.m, locals, sizeof(s.m));
+		if (s.m.positions > Capacity || s.m.chunks != (s.m.positions + 7) / 8)
+			throw Error("Serialized Pire::BitParallelScanner is incompatible with your scanner type");
+
+		bool empty = *((const bool*) p);
+		Impl::AdvancePtr(p, size, sizeof(empty));
+		Impl::AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(Null());
+		else {
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::BitParallelScanner");
+			s.Markup(const_cast<size_t*>(p));
+			for (size_t ch = 0; ch != MaxChar; ++ch)
+				if (s.m_letters[ch] >= s.m.lettersCount)
+					throw Error("Serialized Pire::BitParallelScanner is corrupted");
+			Impl::AdvancePtr(p, size, s.BufSize());
+			Swap(s);
+		}
+		return Impl::AlignPtr(p, size);
+	}
+
+	void Save(yostream* s) const
+	{
+		SavePodType(s, Header(8, sizeof(m)));
+		Impl::AlignSave(s, sizeof(Header));
+		SavePodType(s, m);
+		Impl::AlignSave(s, sizeof(m));
+		SavePodType(s, Empty());
+		Impl::AlignSave(s, sizeof(Empty()));
+		if (!Empty())
+			Impl::AlignedSaveArray(s, reinterpret_cast<const char*>(m_initial), BufSize());
+	}
+
+	void Load(yistream* s)
+	{
+		BitParallelScanner sc;
+		Impl::ValidateHeader(s, 8, sizeof(sc.m));
+		LoadPodType(s, sc.m);
+		Impl::AlignLoad(s, sizeof(sc.m));
+		if (sc.m.positions > Capacity || sc.m.chunks != (sc.m.positions + 7) / 8)
+			throw Error("Serialized Pire::BitParallelScanner is incompatible with your scanner type");
+		bool empty;
+		LoadPodType(s, empty);
+		Impl::AlignLoad(s, sizeof(empty));
+		if (empty) {
+			sc.Alias(Null());
+		} else {
+			sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
+			sc.Markup(sc.m_buffer);
+			Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
+			for (size_t ch = 0; ch != MaxChar; ++ch)
+				if (sc.m_letters[ch] >= sc.m.lettersCount)
+					throw Error("Serialized Pire::BitParallelScanner is corrupted");
+		}
+		Swap(sc);
+	}
+
+	// Returns the size of the memory buffer used (or required) by scanner.
+	size_t BufSize() const
+	{
+		return (2 + m.lettersCount + m.chunks * 256) * Words * sizeof(Word)
+			+ MaxChar * sizeof(Letter);
+	}
+
+private:
+	struct Locals {
+		size_t positions;
+		size_t lettersCount;
+		size_t chunks;
+	} m;
+
+	char* m_buffer;
+
+	const Word* m_initial;
+	const Word* m_finals;
+	const Letter* m_letters;
+	const Word* m_masks;    ///< Positions entered by each letter class
+	const Word* m_follow;   ///< Positions following each value of each 8-bit chunk of a position set
+
+	// Only used to force Null() call during static initialization, when Null()::n can be
+	// initialized safely by compilers that don't support thread safe static local vars
+	// initialization
+	static const BitParallelScanner* m_null;
+
+	inline static const BitParallelScanner& Null()
+	{
+		static const BitParallelScanner n = Fsm::MakeFalse().Compile<BitParallelScanner>();
+		return n;
+	}
+
+	void Markup(void* buf)
+	{
+		m_initial = reinterpret_cast<const Word*>(buf);
+		m_finals  = m_initial + Words;
+		m_letters = reinterpret_cast<const Letter*>(m_finals + Words);
+		m_masks   = reinterpret_cast<const Word*>(m_letters + MaxChar);
+		m_follow  = m_masks + m.lettersCount * Words;
+	}
+
+	// Makes a shallow ("weak") copy of the given scanner.
+	// The copied scanner does not maintain lifetime of the original's entrails.
+	void Alias(const BitParallelScanner& s)
+	{
+		memcpy(&m, &s.m, sizeof(m));
+		m_buffer = 0;
+		m_initial = s.m_initial;
+		m_finals = s.m_finals;
+		m_letters = s.m_letters;
+		m_masks = s.m_masks;
+		m_follow = s.m_follow;
+	}
+
+	static void SetBit(Word* set, size_t pos) { set[pos / 64] |= static_cast<Word>(1) << (pos % 64); }
+};
+
+template<unsigned Words>
+BitParallelScanner<Words>::BitParallelScanner(Fsm& fsm)
+{
+	fsm.RemoveEpsilons();
+	fsm.Sparse();
+	yset<size_t> dead = fsm.DeadStates();
+
+	// Number the positions reachable from the initial state, breadth first;
+	// position 0 is the initial state, which is not entered by any letter.
+	typedef ypair< size_t, yvector<size_t> > Position;
+	ymap<Position, size_t> index;
+	yvector<Position> positions;
+	yvector< yvector<size_t> > follow;
+	positions.push_back(Position(fsm.Initial(), yvector<size_t>()));
+	index[positions.back()] = 0;
+	for (size_t pos = 0; pos != positions.size(); ++pos) {
+		// Letter classes leading to each destination
+		ymap< size_t, yvector<size_t> > labels;
+		for (Fsm::LettersTbl::ConstIterator lit = fsm.Letters().Begin(), lie = fsm.Letters().End(); lit != lie; ++lit) {
+			const Fsm::StatesSet& tos = fsm.Destinations(positions[pos].first, lit->first);
+			for (Fsm::StatesSet::const_iterator to = tos.begin(), toEnd = tos.end(); to != toEnd; ++to)
+				if (dead.find(*to) == dead.end())
+					labels[*to].push_back(lit->second.first);
+		}
+
+		yvector<size_t> next;
+		for (ymap< size_t, yvector<size_t> >::iterator it = labels.begin(), ie = labels.end(); it != ie; ++it) {
+			std::sort(it->second.begin(), it->second.end());
+			Position p(it->first, it->second);
+			typename ymap<Position, size_t>::iterator i = index.find(p);
+			if (i == index.end()) {
+				if (positions.size() == Capacity)
+					throw Error("Regexp is too large for Pire::BitParallelScanner");
+				i = index.insert(ymake_pair(p, positions.size())).first;
+				positions.push_back(p);
+			}
+			next.push_back(i->second);
+		}
+		follow.push_back(next);
+	}
+
+	m.positions = positions.size();
+	m.lettersCount = fsm.Letters().Size();
+	m.chunks = (m.positions + 7) / 8;
+	m_buffer = Impl::NewSharedBuffer(BufSize());
+	memset(m_buffer, 0, BufSize());
+	Markup(m_buffer);
+
+	Word* initial = const_cast<Word*>(m_initial);
+	Word* finals = const_cast<Word*>(m_finals);
+	Letter* letters = const_cast<Letter*>(m_letters);
+	Word* masks = const_cast<Word*>(m_masks);
+	Word* table = const_cast<Word*>(m_follow);
+
+	for (Fsm::LettersTbl::ConstIterator lit = fsm.Letters().Begin(), lie = fsm.Letters().End(); lit != lie; ++lit)
+		for (yvector<Char>::const_iterator it = lit->second.second.begin(), ie = lit->second.second.end(); it != ie; ++it)
+			letters[*it] = lit->second.first;
+
+	SetBit(initial, 0);
+	for (size_t pos = 0; pos != positions.size(); ++pos) {
+		if (fsm.IsFinal(positions[pos].first))
+			SetBit(finals, pos);
+		for (yvector<size_t>::const_iterator it = positions[pos].second.begin(), ie = positions[pos].second.end(); it != ie; ++it)
+			SetBit(masks + *it * Words, pos);
+	}
+
+	// Each chunk value is its lowest bit's follow set joined with the rest of the value's
+	for (size_t chunk = 0; chunk != m.chunks; ++chunk) {
+		Word* rows = table + chunk * 256 * Words;
+		for (size_t value = 1; value != 256; ++value) {
+			size_t bit = 0;
+			while (!(value & (1 << bit)))
+				++bit;
+			Word* row = rows + value * Words;
+			memcpy(row, rows + (value & (value - 1)) * Words, Words * sizeof(Word));
+			size_t pos = chunk * 8 + bit;
+			if (pos < positions.size())
+				for (yvector<size_t>::const_iterator i = follow[pos].begin(), ie = follow[pos].end(); i != ie; ++i)
+					SetBit(row, *i);
+		}
+	}
+}
+
+template<unsigned Words>
+const BitParallelScanner<Words>* BitParallelScanner<Words>::m_null = &BitParallelScanner<Words>::Null();
+
+}
+
+typedef Impl::BitParallelScanner<1> BitParallelScanner64;
+typedef Impl::BitParallelScanner<2> BitParallelScanner128;
+typedef Impl::BitParallelScanner<4> BitParallelScanner256;
+typedef BitParallelScanner256 BitParallelScanner;
+
+}
+
+#endif
@@ -28,6 +28,8 @@
 #include "../stub/defaults.h"
 #include "../defs.h"
 #include "../platform.h"
+#include "../stub/stl.h"
+#include "../stub/memstreams.h"
 
 namespace Pire {
 
@@ -41,11 +43,13 @@ namespace Pire {
 
 		static const ui32 MAGIC = 0x45524950;   // "PIRE" on litte-endian
 		static const ui32 RE_VERSION = 7;       // Should be incremented each time when the format of serialized scanner changes
+		static const ui32 RE_VERSION_WITH_CHECKSUMS = 8;  // Scanner with section checksums (other types are still saved as RE_VERSION)
 		static const ui32 RE_VERSION_WITH_MACTIONS = 6;  // LoadedScanner with m_actions, which is ignored
+		static const ui32 RE_VERSION_WITH_MASKS = 9;  // Scanner with checksums and the table of accepted masks
 
-		explicit Header(ui32 type, size_t hdrsize)
+		explicit Header(ui32 type, size_t hdrsize, ui32 version = RE_VERSION)
 			: Magic(MAGIC)
-			, Version(RE_VERSION)
+			, Version(version)
 			, PtrSize(sizeof(void*))
 			, MaxWordSize(sizeof(Impl::MaxSizeWord))
 			, Type(type)
@@ -56,7 +60,7 @@ namespace Pire {
 		{
 			if (Magic != MAGIC || PtrSize != sizeof(void*) || MaxWordSize != sizeof(Impl::MaxSizeWord))
 				throw Error("Serialized regexp incompatible with your system");
-			if (Version != RE_VERSION && Version != RE_VERSION_WITH_MACTIONS)
+			if (Version != RE_VERSION && Version != RE_VERSION_WITH_CHECKSUMS && Version != RE_VERSION_WITH_MACTIONS && Version != RE_VERSION_WITH_MASKS)
 				throw Error("You are trying to used an incompatible version of a serialized regexp");
 			if ((type != 0 && type != Type) || (hdrsize != 0 && HdrSize != hdrsize))
 				throw Error("Serialized regexp incompatible with your system");
@@ -103,7 +107,272 @@ namespace Pire {
 			hdr.Validate(type, hdrsize);
 			return hdr;
 		}
+
+		/// CRC32C (Castagnoli) of given data
+		ui32 Crc32c(const void* data, size_t size, ui32 crc = 0);
+
+		// Fixed-width little-endian integers, used by the portable format
+		// (see Scanner::SavePortable()) regardless of the host byte order.
+		inline ui32 LoadLE16(const void* ptr)
+		{
+			const ui8* p = static_cast<const ui8*>(ptr);
+			return p[0] | (p[1] << 8);
+		}
+
+		inline ui32 LoadLE32(const void* ptr)
+		{
+			const ui8* p = static_cast<const ui8*>(ptr);
+			return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<ui32>(p[3]) << 24);
+		}
+
+		inline ui64 LoadLE64(const void* ptr)
+		{
+			const ui8* p = static_cast<const ui8*>(ptr);
+			return LoadLE32(p) | (static_cast<ui64>(LoadLE32(p + 4)) << 32);
+		}
+
+		inline void StoreLE16(void* ptr, ui32 val)
+		{
+			ui8* p = static_cast<ui8*>(ptr);
+			p[0] = val & 0xFF;
+			p[1] = (val >> 8) & 0xFF;
+		}
+
+		inline void StoreLE32(void* ptr, ui32 val)
+		{
+			ui8* p = static_cast<ui8*>(ptr);
+			for (int i = 0; i != 4; ++i, val >>= 8)
+				p[i] = val & 0xFF;
+		}
+
+		inline void StoreLE64(void* ptr, ui64 val)
+		{
+			StoreLE32(ptr, static_cast<ui32>(val));
+			StoreLE32(static_cast<ui8*>(ptr) + 4, static_cast<ui32>(val >> 32));
+		}
+
+		// Variable-length integers (7 bits per byte, least significant first),
+		// used by the compressed format (see Scanner::SaveCompressed()).
+		inline void AppendVarint(yvector<char>& buf, ui64 val)
+		{
+			for (; val >= 0x80; val >>= 7)
+				buf.push_back(static_cast<char>((val & 0x7F) | 0x80));
+			buf.push_back(static_cast<char>(val));
+		}
+
+		inline ui64 ReadVarint(const char*& p, const char* end)
+		{
+			ui64 val = 0;
+			for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+				ui8 byte = static_cast<ui8>(*p++);
+				val |= static_cast<ui64>(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					return val;
+			}
+			throw Error("Compressed Pire::Scanner is corrupted");
+		}
+
+		/// A piece of a serialized object, which can be written anywhere without copying it first
+		struct Chunk {
+			const void* Data;
+			size_t Size;
+		};
+
+		/// Appends a chunk followed by zero padding, just as AlignedSaveArray() would write it
+		inline void AddAlignedChunk(yvector<Chunk>& chunks, const void* data, size_t size)
+		{
+			static const char zeroes[sizeof(MaxSizeWord)] = {0};
+			Chunk chunk = { data, size };
+			chunks.push_back(chunk);
+			size_t tail = AlignUp(size, sizeof(size_t)) - size;
+			if (tail) {
+				Chunk padding = { zeroes, tail };
+				chunks.push_back(padding);
+			}
+		}
+
+		void SaveChunks(yostream* s, const yvector<Chunk>& chunks);
+		void* CopyChunks(void* buf, const yvector<Chunk>& chunks);
+		/// Writes all chunks into the file descriptor using as few writev() calls as possible
+		void WriteChunks(int fd, const yvector<Chunk>& chunks);
+
+		/**
+		 * Calls fn(ctx, i) for each i in [0, count), spreading calls among
+		 * up to @p threads threads (including the calling one).
+		 * If any of calls throws, rethrows its error after all threads have finished.
+		 */
+		void ParallelFor(size_t count, size_t threads, void (*fn)(void* ctx, size_t i), void* ctx);
+
+		/*
+		 * Scanners never modify their tables once built, so copies of a scanner
+		 * share the tables and count references to them. Without atomic builtins
+		 * the counters could not be touched from different threads, so copies
+		 * get tables of their own, just as they always did.
+		 */
+#ifdef PIRE_HAVE_ATOMIC_BUILTINS
+		static const bool ShareTables = true;
+		inline void AddRef(size_t& refs) { __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED); }
+		inline bool Release(size_t& refs) { return !__atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL); }
+#else
+		static const bool ShareTables = false;
+		inline void AddRef(size_t& refs) { ++refs; }
+		inline bool Release(size_t& refs) { return !--refs; }
+#endif
+
+		// Buffers with a reference counter in front of them
+		static const size_t SharedBufferHeader = sizeof(MaxSizeWord);
+
+		inline size_t& SharedBufferRefs(char* buf) { return *reinterpret_cast<size_t*>(buf - SharedBufferHeader); }
+
+		inline char* NewSharedBuffer(size_t size)
+		{
+			char* p = new char[size + SharedBufferHeader] + SharedBufferHeader;
+			SharedBufferRefs(p) = 1;
+			return p;
+		}
+
+		/// Returns another reference to the buffer, or null if the caller has to copy it instead
+		inline char* ShareBuffer(char* buf)
+		{
+			if (!ShareTables)
+				return 0;
+			AddRef(SharedBufferRefs(buf));
+			return buf;
+		}
+
+		inline void ReleaseSharedBuffer(char* buf)
+		{
+			if (buf && Release(SharedBufferRefs(buf)))
+				delete[] (buf - SharedBufferHeader);
+		}
 	}
+
+	/// How much Scanner::Mmap() should trust the memory it is given
+	enum MmapMode {
+		MmapTrust,             ///< Do not read checksums, but make sure no jump leads outside the transition table
+		MmapVerify,            ///< Verify checksums of all sections before returning
+		MmapVerifyInBackground ///< Verify checksums in a BackgroundVerifier (and make sure no jump leads outside, as MmapTrust does)
+	};
+
+	/**
+	 * Verifies checksums of mmap()-ed scanners in a separate thread,
+	 * so that verification of large scanners does not delay startup.
+	 * If threads are not available, verifies everything right in Add().
+	 *
+	 * Memory being verified must stay mapped until Wait() returns
+	 * (or the verifier is destroyed, which waits as well).
+	 */
+	class BackgroundVerifier {
+	public:
+		BackgroundVerifier();
+		~BackgroundVerifier();
+
+		/// Schedules verification of the given memory range against its CRC32C
+		void Add(const void* data, size_t size, ui32 checksum);
+
+		/// Returns true if all scheduled ranges have been verified by now
+		bool Done() const;
+
+		/// Waits for all scheduled ranges to be verified.
+		/// Returns false if any of them does not match its checksum.
+		bool Wait();
+
+	private:
+		struct State;
+		State* m_state;
+
+		BackgroundVerifier(const BackgroundVerifier&);
+		BackgroundVerifier& operator = (const BackgroundVerifier&);
+	};
+
+	/*
+	 * An archive is a container for several named serialized scanners.
+	 *
+	 * Layout:
+	 *   Header (with type 6);
+	 *   ArchiveToc;
+	 *   ArchiveEntry[count], sorted by name;
+	 *   names of entries (not null-terminated);
+	 *   serialized scanners, each aligned to ArchiveAlign bytes
+	 *   relative to the beginning of the archive.
+	 *
+	 * Scanners are mmap()-ed right from the archive, without any copying,
+	 * so one mmap() of the whole archive file is enough to use all of them.
+	 */
+	struct ArchiveToc {
+		ui64 Count;
+		ui64 Size;     ///< Size of the whole archive
+	};
+
+	struct ArchiveEntry {
+		ui64 Offset;   ///< Offset of the scanner from the beginning of the archive
+		ui64 Size;
+		ui32 NameOffset;
+		ui32 NameLength;
+		ui32 Type;     ///< Type of the scanner, as in its header
+		ui32 Checksum; ///< CRC32C of the serialized scanner
+	};
+
+	static const size_t ArchiveAlign = 64;
+
+	class ArchiveWriter {
+	public:
+		template<class Scanner>
+		void Add(const ystring& name, const Scanner& sc)
+		{
+			BufferOutput buf;
+			sc.Save(&buf);
+			Add(name, buf.Buffer().Data(), buf.Buffer().Size());
+		}
+
+		/// Adds an already serialized scanner
+		void Add(const ystring& name, const char* data, size_t size);
+
+		size_t Count() const { return m_entries.size(); }
+
+		void Save(yostream* s) const;
+
+	private:
+		ymap<ystring, ystring> m_entries;
+	};
+
+	class Archive {
+	public:
+		Archive(): m_begin(0), m_count(0), m_entries(0) {}
+
+		/// Maps the archive from memory; returns a pointer right past its end
+		const void* Mmap(const void* ptr, size_t size);
+
+		size_t Count() const { return m_count; }
+		ystring Name(size_t i) const { return ystring(m_begin + m_entries[i].NameOffset, m_entries[i].NameLength); }
+		ui32 Type(size_t i) const { return m_entries[i].Type; }
+		const void* Data(size_t i) const { return m_begin + m_entries[i].Offset; }
+		size_t Size(size_t i) const { return m_entries[i].Size; }
+
+		/// Returns an index of the entry with given name, or Count() if there is no such entry
+		size_t Find(const ystring& name) const;
+
+		/// Checks whether the entry (or all entries) matches its checksum
+		bool Verify(size_t i) const;
+		bool Verify() const;
+
+		template<class Scanner>
+		void Mmap(size_t i, Scanner& sc) const { sc.Mmap(Data(i), Size(i)); }
+
+		template<class Scanner>
+		void Mmap(const ystring& name, Scanner& sc) const
+		{
+			size_t i = Find(name);
+			if (i == Count())
+				throw Error("No scanner named '" + name + "' in the archive");
+			Mmap(i, sc);
+		}
+
+	private:
+		const char* m_begin;
+		size_t m_count;
+		const ArchiveEntry* m_entries;
+	};
 }
 
 #endif
@@ -0,0 +1,157 @@
+/*
+ * compiled.h -- the definition of the CompiledScanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_COMPILED_H
+#define PIRE_SCANNERS_COMPILED_H
+
+#include <string.h>
+#include "common.h"
+#include "../stub/stl.h"
+#include "../run.h"
+
+namespace Pire {
+
+/**
+ * A scanner whose transitions are C++ code rather than tables.
+ *
+ * It is never built at runtime: GenerateCode() (see codegen.h)
+ * turns a Scanner into a C++ expression yielding a CompiledScanner,
+ * and pire_inline emits such an expression for regexps with the 'c' option.
+ * The generated Run() is a goto-based state machine with a switch
+ * per state, so the compiler sees the whole automaton and is free
+ * to lay out the branches; nothing has to be loaded or mapped at startup.
+ *
+ * States are numbered from zero, the initial one being zero as well.
+ */
+class CompiledScanner {
+public:
+	typedef ui16        Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+	typedef size_t      State;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 2
+	};
+
+	/// Performs a single transition (including BeginMark and EndMark)
+	typedef State (*StepFunc)(State state, Char ch);
+	/// Runs through the whole range, returning the resulting state
+	typedef State (*RunFunc)(State state, const char* begin, const char* end);
+
+	CompiledScanner()
+		: m_step(&EmptyStep)
+		, m_run(&EmptyRun)
+		, m_flags(EmptyFlags())
+		, m_acceptPos(EmptyAcceptPos())
+		, m_accept(EmptyAcceptPos())
+		, m_statesCount(1)
+		, m_regexpsCount(0)
+	{}
+
+	/**
+	 * Wraps the generated code. @p flags holds FinalFlag and DeadFlag
+	 * for every state; regexps accepted in state @p s are
+	 * accept[acceptPos[s]] .. accept[acceptPos[s + 1]].
+	 */
+	CompiledScanner(StepFunc step, RunFunc run, const ui8* flags, const size_t* acceptPos, const size_t* accept,
+		size_t statesCount, size_t regexpsCount)
+		: m_step(step)
+		, m_run(run)
+		, m_flags(flags)
+		, m_acceptPos(acceptPos)
+		, m_accept(accept)
+		, m_statesCount(statesCount)
+		, m_regexpsCount(regexpsCount)
+	{}
+
+	size_t Size() const { return m_statesCount; }
+	bool Empty() const { return m_step == &EmptyStep; }
+
+	size_t RegexpsCount() const { return m_regexpsCount; }
+
+	void Initialize(State& state) const { state = 0; }
+
+	Action Next(State& state, Char c) const
+	{
+		state = m_step(state, c);
+		return 0;
+	}
+
+	bool TakeAction(State&, Action) const { return false; }
+
+	bool Final(const State& state) const { return (m_flags[state] & FinalFlag) != 0; }
+	bool Dead(const State& state) const { return (m_flags[state] & DeadFlag) != 0; }
+	bool CanStop(const State& state) const { return Final(state); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		return ymake_pair(m_accept + m_acceptPos[state], m_accept + m_acceptPos[state + 1]);
+	}
+
+	size_t StateIndex(State s) const { return s; }
+
+	/// Runs the generated state machine through the range
+	void RunCode(State& state, const char* begin, const char* end) const { state = m_run(state, begin, end); }
+
+	void Swap(CompiledScanner& s)
+	{
+		DoSwap(m_step, s.m_step);
+		DoSwap(m_run, s.m_run);
+		DoSwap(m_flags, s.m_flags);
+		DoSwap(m_acceptPos, s.m_acceptPos);
+		DoSwap(m_accept, s.m_accept);
+		DoSwap(m_statesCount, s.m_statesCount);
+		DoSwap(m_regexpsCount, s.m_regexpsCount);
+	}
+
+private:
+	StepFunc m_step;
+	RunFunc m_run;
+	const ui8* m_flags;
+	const size_t* m_acceptPos;
+	const size_t* m_accept;
+	size_t m_statesCount;
+	size_t m_regexpsCount;
+
+	static State EmptyStep(State state, Char) { return state; }
+	static State EmptyRun(State state, const char*, const char*) { return state; }
+	static const ui8* EmptyFlags() { static const ui8 flags[1] = { 0 }; return flags; }
+	static const size_t* EmptyAcceptPos() { static const size_t pos[2] = { 0, 0 }; return pos; }
+};
+
+#ifndef PIRE_DEBUG
+
+/// The generated code is a better Run() than anything built upon Next()
+template<>
+inline void Run<CompiledScanner>(const CompiledScanner& sc, CompiledScanner::State& st, const char* begin, const char* end)
+{
+	sc.RunCode(st, begin, end);
+}
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * jit.cpp -- translating Scanners into native code
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "jit.h"
+#include <string.h>
+
+// The generated code follows the System V AMD64 calling convention
+#if defined(__x86_64__) && !defined(_WIN32)
+#define PIRE_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace Pire {
+
+struct JitScanner::Code {
+	typedef size_t (*RunFunc)(size_t state, const char* begin, const char* end);
+	typedef size_t (*LongestPrefixFunc)(size_t state, const char* begin, const char* end, const char** pos);
+
+	size_t Refs;
+	void* Memory;
+	size_t Size;
+	RunFunc Run;
+	LongestPrefixFunc LongestPrefix;
+};
+
+namespace {
+
+	/// What the translator needs to know about a state
+	struct StateInfo {
+		bool Reachable;
+		bool Final;
+		bool Dead;
+		size_t Next[256];
+	};
+
+#ifdef PIRE_JIT_X86_64
+
+	const size_t Unbound = static_cast<size_t>(-1);
+
+	/// Collects machine code, resolving references to labels once all of them are bound
+	class Assembler {
+	public:
+		size_t NewLabel() { m_labels.push_back(Unbound); return m_labels.size() - 1; }
+		void Bind(size_t label) { YASSERT(m_labels[label] == Unbound); m_labels[label] = m_code.size(); }
+		size_t Position(size_t label) const { return m_labels[label]; }
+
+		/// Appends bytes given as a string of hex pairs separated with spaces
+		void Emit(const char* hex)
+		{
+			for (const char* p = hex; *p; ) {
+				if (*p == ' ') {
+					++p;
+					continue;
+				}
+				m_code.push_back(static_cast<ui8>(Digit(p[0]) * 16 + Digit(p[1])));
+				p += 2;
+			}
+		}
+
+		void Imm32(ui32 value)
+		{
+			for (size_t i = 0; i != 4; ++i)
+				m_code.push_back(static_cast<ui8>(value >> (i * 8)));
+		}
+
+		/// A displacement of the label from the end of the instruction (which ends right here)
+		void Rel32(size_t label) { AddFixup(label, m_code.size() + 4); }
+
+		/// A displacement of the label from another label
+		void Offset32(size_t label, size_t base) { Fixup f = { m_code.size(), label, base, true }; m_fixups.push_back(f); Imm32(0); }
+
+		void Jmp(size_t label) { Emit("E9"); Rel32(label); }
+
+		/// Conditional jump; @p cc is the second byte of the opcode (84 for je, etc.)
+		void Jcc(const char* cc, size_t label) { Emit("0F"); Emit(cc); Rel32(label); }
+
+		/// Returns the resolved code
+		const yvector<ui8>& Finish()
+		{
+			for (yvector<Fixup>::const_iterator i = m_fixups.begin(), ie = m_fixups.end(); i != ie; ++i) {
+				YASSERT(m_labels[i->Label] != Unbound);
+				ui32 value = static_cast<ui32>(m_labels[i->Label] - (i->BaseIsLabel ? m_labels[i->Base] : i->Base));
+				for (size_t j = 0; j != 4; ++j)
+					m_code[i->Pos + j] = static_cast<ui8>(value >> (j * 8));
+			}
+			m_fixups.clear();
+			return m_code;
+		}
+
+	private:
+		struct Fixup {
+			size_t Pos;
+			size_t Label;
+			size_t Base;
+			bool BaseIsLabel;
+		};
+
+		yvector<ui8> m_code;
+		yvector<size_t> m_labels;
+		yvector<Fixup> m_fixups;
+
+		static unsigned Digit(char c) { return (c >= 'A') ? (c - 'A' + 10) : (c - '0'); }
+
+		void AddFixup(size_t label, size_t base) { Fixup f = { m_code.size(), label, base, false }; m_fixups.push_back(f); Imm32(0); }
+	};
+
+	/// A state which can be left by this many characters at most is scanned with SSE2
+	const size_t MaxVectorExits = 3;
+	/// A state with more ranges of characters than this dispatches via a jump table
+	const size_t MaxBranches = 12;
+
+	class Translator {
+	public:
+		Translator(const yvector<StateInfo>& states): m_states(states) {}
+
+		/*
+		 * Emits a function taking the index of a state and the range
+		 * (and, if @p longest, a pointer where LongestPrefix() records
+		 * its result), returning the index of the resulting state.
+		 *
+		 * Registers: rdi holds the state at the entry and is a scratch one
+		 * afterwards; rsi and rdx are the current and the end positions;
+		 * rcx is the result pointer; eax holds the current character.
+		 */
+		size_t EmitFunction(bool longest)
+		{
+			size_t entry = m_asm.NewLabel();
+			size_t table = m_asm.NewLabel();
+			size_t unknown = m_asm.NewLabel();
+			yvector<size_t> blocks;
+			for (size_t i = 0; i != m_states.size(); ++i)
+				blocks.push_back(m_asm.NewLabel());
+
+			m_asm.Bind(entry);
+			m_asm.Emit("49 89 F9");             // mov r9, rdi
+			m_asm.Emit("48 8D 05");             // lea rax, [rip + table]
+			m_asm.Rel32(table);
+			m_asm.Emit("48 63 3C B8");          // movsxd rdi, dword [rax + rdi*4]
+			m_asm.Emit("48 01 F8");             // add rax, rdi
+			m_asm.Emit("FF E0");                // jmp rax
+
+			// States unreachable from the initial one cannot be obtained from the scanner;
+			// just in case, they are left as they are
+			m_asm.Bind(unknown);
+			m_asm.Emit("4C 89 C8 C3");          // mov rax, r9; ret
+
+			for (size_t i = 0; i != m_states.size(); ++i)
+				if (m_states[i].Reachable)
+					EmitState(i, blocks, longest);
+
+			m_asm.Bind(table);
+			for (size_t i = 0; i != m_states.size(); ++i)
+				m_asm.Offset32(m_states[i].Reachable ? blocks[i] : unknown, table);
+			return entry;
+		}
+
+		const yvector<ui8>& Finish()
+		{
+			// Vectors of the same character to compare input with
+			for (ymap<size_t, size_t>::const_iterator i = m_vectors.begin(), ie = m_vectors.end(); i != ie; ++i) {
+				m_asm.Bind(i->second);
+				for (size_t j = 0; j != 16; ++j)
+					m_asm.Emit(HexByte(i->first).c_str());
+			}
+			return m_asm.Finish();
+		}
+
+		size_t Position(size_t label) const { return m_asm.Position(label); }
+
+	private:
+		const yvector<StateInfo>& m_states;
+		Assembler m_asm;
+		ymap<size_t, size_t> m_vectors;
+
+		static ystring HexByte(size_t byte)
+		{
+			static const char digits[] = "0123456789ABCDEF";
+			ystring s;
+			s += digits[byte >> 4];
+			s += digits[byte & 0xF];
+			return s;
+		}
+
+		size_t Vector(size_t ch)
+		{
+			ymap<size_t, size_t>::iterator it = m_vectors.find(ch);
+			if (it == m_vectors.end())
+				it = m_vectors.insert(ymake_pair(ch, m_asm.NewLabel())).first;
+			return it->second;
+		}
+
+		void Return(size_t state)
+		{
+			m_asm.Emit("B8");                   // mov eax, state
+			m_asm.Imm32(static_cast<ui32>(state));
+			m_asm.Emit("C3");                   // ret
+		}
+
+		void EmitState(size_t idx, const yvector<size_t>& blocks, bool longest)
+		{
+			const StateInfo& state = m_states[idx];
+			m_asm.Bind(blocks[idx]);
+
+			if (longest && state.Dead) {
+				if (state.Final)
+					m_asm.Emit("48 89 31");     // mov [rcx], rsi
+				Return(idx);
+				return;
+			}
+
+			yvector<size_t> exits;
+			for (size_t ch = 0; ch != 256; ++ch)
+				if (state.Next[ch] != idx)
+					exits.push_back(ch);
+
+			if (exits.empty()) {
+				// Nothing can take us out of here
+				if (longest && state.Final)
+					m_asm.Emit("48 89 11");     // mov [rcx], rdx
+				Return(idx);
+				return;
+			}
+
+			if (exits.size() <= MaxVectorExits)
+				EmitSkip(exits);
+
+			size_t exit = m_asm.NewLabel();
+			if (longest && state.Final)
+				m_asm.Emit("48 89 31");         // mov [rcx], rsi
+			m_asm.Emit("48 39 D6");             // cmp rsi, rdx
+			m_asm.Jcc("83", exit);              // jae exit
+			m_asm.Emit("0F B6 06");             // movzx eax, byte [rsi]
+			m_asm.Emit("48 FF C6");             // inc rsi
+			EmitDispatch(state, blocks);
+			m_asm.Bind(exit);
+			Return(idx);
+		}
+
+		/// Skips characters which do not leave the state, sixteen at a time
+		void EmitSkip(const yvector<size_t>& exits)
+		{
+			size_t loop = m_asm.NewLabel();
+			size_t found = m_asm.NewLabel();
+			size_t tail = m_asm.NewLabel();
+
+			m_asm.Bind(loop);
+			m_asm.Emit("4C 8D 46 10");          // lea r8, [rsi + 16]
+			m_asm.Emit("49 39 D0");             // cmp r8, rdx
+			m_asm.Jcc("87", tail);              // ja tail
+			m_asm.Emit("F3 0F 6F 06");          // movdqu xmm0, [rsi]
+			for (size_t i = 0; i != exits.size(); ++i) {
+				if (i == 0) {
+					m_asm.Emit("F3 0F 6F 0D");  // movdqu xmm1, [rip + vector]
+					m_asm.Rel32(Vector(exits[i]));
+					m_asm.Emit("66 0F 74 C8");  // pcmpeqb xmm1, xmm0
+				} else {
+					m_asm.Emit("F3 0F 6F 15");  // movdqu xmm2, [rip + vector]
+					m_asm.Rel32(Vector(exits[i]));
+					m_asm.Emit("66 0F 74 D0");  // pcmpeqb xmm2, xmm0
+					m_asm.Emit("66 0F EB CA");  // por xmm1, xmm2
+				}
+			}
+			m_asm.Emit("66 0F D7 F9");          // pmovmskb edi, xmm1
+			m_asm.Emit("85 FF");                // test edi, edi
+			m_asm.Jcc("85", found);             // jnz found
+			m_asm.Emit("48 83 C6 10");          // add rsi, 16
+			m_asm.Jmp(loop);
+
+			m_asm.Bind(found);
+			m_asm.Emit("0F BC FF");             // bsf edi, edi
+			m_asm.Emit("48 01 FE");             // add rsi, rdi
+			m_asm.Bind(tail);
+		}
+
+		/// Jumps to the next state for the character in eax
+		void EmitDispatch(const StateInfo& state, const yvector<size_t>& blocks)
+		{
+			// The most common destination is left to the final jump
+			ymap<size_t, size_t> counts;
+			size_t dflt = state.Next[0];
+			for (size_t ch = 0; ch != 256; ++ch)
+				if (++counts[state.Next[ch]] > counts[dflt])
+					dflt = state.Next[ch];
+
+			yvector< ypair<size_t, size_t> > ranges;
+			for (size_t ch = 0; ch != 256; ) {
+				size_t end = ch + 1;
+				while (end != 256 && state.Next[end] == state.Next[ch])
+					++end;
+				if (state.Next[ch] != dflt)
+					ranges.push_back(ymake_pair(ch, end - 1));
+				ch = end;
+			}
+
+			if (ranges.size() <= MaxBranches) {
+				for (yvector< ypair<size_t, size_t> >::const_iterator i = ranges.begin(), ie = ranges.end(); i != ie; ++i) {
+					if (i->first == i->second) {
+						m_asm.Emit("3D");               // cmp eax, ch
+						m_asm.Imm32(static_cast<ui32>(i->first));
+						m_asm.Jcc("84", blocks[state.Next[i->first]]); // je
+					} else {
+						m_asm.Emit("8D B8");            // lea edi, [rax - first]
+						m_asm.Imm32(static_cast<ui32>(-static_cast<int>(i->first)));
+						m_asm.Emit("81 FF");            // cmp edi, last - first
+						m_asm.Imm32(static_cast<ui32>(i->second - i->first));
+						m_asm.Jcc("86", blocks[state.Next[i->first]]); // jbe
+					}
+				}
+				m_asm.Jmp(blocks[dflt]);
+			} else {
+				size_t table = m_asm.NewLabel();
+				m_asm.Emit("4C 8D 05");             // lea r8, [rip + table]
+				m_asm.Rel32(table);
+				m_asm.Emit("49 63 04 80");          // movsxd rax, dword [r8 + rax*4]
+				m_asm.Emit("4C 01 C0");             // add rax, r8
+				m_asm.Emit("FF E0");                // jmp rax
+				m_asm.Bind(table);
+				for (size_t ch = 0; ch != 256; ++ch)
+					m_asm.Offset32(blocks[state.Next[ch]], table);
+			}
+		}
+	};
+
+#endif
+}
+
+JitScanner::JitScanner(const Scanner& scanner, bool native)
+	: m_scanner(scanner)
+	, m_code(0)
+{
+	yvector<bool> reachable = IndexStates();
+	if (native)
+		Translate(reachable);
+}
+
+JitScanner::JitScanner(Fsm& fsm)
+	: m_scanner(fsm)
+	, m_code(0)
+{
+	Translate(IndexStates());
+}
+
+JitScanner::JitScanner(const JitScanner& s)
+	: m_scanner(s.m_scanner)
+	, m_code(0)
+{
+	State mine, theirs;
+	m_scanner.Initialize(mine);
+	s.m_scanner.Initialize(theirs);
+	if (s.m_code && !Impl::ShareTables) {
+		// Each copy needs code of its own
+		Translate(IndexStates());
+		return;
+	}
+
+	if (mine == theirs)
+		m_states = s.m_states;
+	else
+		// The tables have been copied rather than shared
+		IndexStates();
+	m_code = s.m_code;
+	if (m_code)
+		Impl::AddRef(m_code->Refs);
+}
+
+JitScanner::~JitScanner()
+{
+	if (m_code && Impl::Release(m_code->Refs)) {
+#ifdef PIRE_JIT_X86_64
+		munmap(m_code->Memory, m_code->Size);
+#endif
+		delete m_code;
+	}
+}
+
+yvector<bool> JitScanner::IndexStates()
+{
+	m_states.clear();
+	if (m_scanner.Empty())
+		return yvector<bool>();
+	m_states.resize(m_scanner.Size());
+	yvector<bool> seen(m_scanner.Size(), false);
+	yvector<State> queue;
+	State initial;
+	m_scanner.Initialize(initial);
+	queue.push_back(initial);
+	seen[m_scanner.StateIndex(initial)] = true;
+	for (size_t i = 0; i != queue.size(); ++i) {
+		m_states[m_scanner.StateIndex(queue[i])] = queue[i];
+		for (Char ch = 0; ch != MaxCharUnaligned; ++ch) {
+			if (ch == SpecialChar::Epsilon)
+				continue;
+			State next = queue[i];
+			Step(m_scanner, next, ch);
+			if (!seen[m_scanner.StateIndex(next)]) {
+				seen[m_scanner.StateIndex(next)] = true;
+				queue.push_back(next);
+			}
+		}
+	}
+	return seen;
+}
+
+void JitScanner::Translate(const yvector<bool>& reachable)
+{
+#ifdef PIRE_JIT_X86_64
+	if (m_scanner.Empty())
+		return;
+
+	yvector<StateInfo> states(m_scanner.Size());
+	for (size_t i = 0; i != states.size(); ++i) {
+		StateInfo& info = states[i];
+		info.Reachable = reachable[i];
+		if (!info.Reachable)
+			continue;
+		info.Final = m_scanner.Final(m_states[i]);
+		info.Dead = m_scanner.Dead(m_states[i]);
+		for (size_t ch = 0; ch != 256; ++ch) {
+			State next = m_states[i];
+			Step(m_scanner, next, static_cast<Char>(ch));
+			info.Next[ch] = m_scanner.StateIndex(next);
+		}
+	}
+
+	Translator translator(states);
+	size_t run = translator.EmitFunction(false);
+	size_t longest = translator.EmitFunction(true);
+	const yvector<ui8>& code = translator.Finish();
+
+	// Fall back to the tables if the system does not let us run the code
+	void* mem = mmap(0, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return;
+	memcpy(mem, &code[0], code.size());
+	if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC)) {
+		munmap(mem, code.size());
+		return;
+	}
+
+	m_code = new Code;
+	m_code->Refs = 1;
+	m_code->Memory = mem;
+	m_code->Size = code.size();
+	m_code->Run = reinterpret_cast<Code::RunFunc>(reinterpret_cast<size_t>(static_cast<char*>(mem) + translator.Position(run)));
+	m_code->LongestPrefix = reinterpret_cast<Code::LongestPrefixFunc>(reinterpret_cast<size_t>(static_cast<char*>(mem) + translator.Position(longest)));
+#else
+	(void) reachable;
+#endif
+}
+
+void JitScanner::RunCode(State& state, const char* begin, const char* end) const
+{
+	if (m_code)
+		state = m_states[m_code->Run(m_scanner.StateIndex(state), begin, end)];
+	else
+		Run(m_scanner, state, begin, end);
+}
+
+const char* JitScanner::LongestPrefixCode(const char* begin, const char* end) const
+{
+	if (!m_code)
+		return LongestPrefix(m_scanner, begin, end);
+	State st;
+	m_scanner.Initialize(st);
+	const char* pos = (m_scanner.Final(st) ? begin : 0);
+	m_code->LongestPrefix(m_scanner.StateIndex(st), begin, end, &pos);
+	return pos;
+}
+
+}
@@ -0,0 +1,135 @@
+/*
+ * jit.h -- the definition of the JitScanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_JIT_H
+#define PIRE_SCANNERS_JIT_H
+
+#include "common.h"
+#include "multi.h"
+#include "../stub/stl.h"
+#include "../fsm.h"
+#include "../run.h"
+
+namespace Pire {
+
+/**
+ * A Scanner with its Run() and LongestPrefix() translated
+ * into native code at runtime.
+ *
+ * Every state becomes a block of code which fetches a character
+ * and branches to the next state's block; states which can only be left
+ * by one to three characters look for them sixteen bytes at a time
+ * using SSE2, and LongestPrefix() checks for final and dead states
+ * with branches known in advance.
+ *
+ * The native code is only generated on x86-64 Unix systems;
+ * anywhere else (or if executable memory cannot be obtained)
+ * the scanner silently falls back to the tables of the underlying Scanner,
+ * which is also used for single steps, BeginMark and EndMark.
+ * States are the same as the underlying Scanner's ones.
+ */
+class JitScanner {
+public:
+	typedef Scanner::Transition Transition;
+	typedef Scanner::Letter     Letter;
+	typedef Scanner::Action     Action;
+	typedef Scanner::Tag        Tag;
+	typedef Scanner::State      State;
+
+	JitScanner(): m_code(0) {}
+
+	/// Translates the scanner unless @p native is false
+	/// (which is only useful to compare against the fallback)
+	explicit JitScanner(const Scanner& scanner, bool native = true);
+
+	explicit JitScanner(Fsm& fsm);
+
+	JitScanner(const JitScanner& s);
+	JitScanner& operator = (const JitScanner& s) { JitScanner(s).Swap(*this); return *this; }
+	~JitScanner();
+
+	void Swap(JitScanner& s)
+	{
+		m_scanner.Swap(s.m_scanner);
+		m_states.swap(s.m_states);
+		DoSwap(m_code, s.m_code);
+	}
+
+	/// Whether native code is being used
+	bool Native() const { return m_code != 0; }
+
+	/// The table-driven scanner behind this one
+	const Scanner& Tables() const { return m_scanner; }
+
+	size_t Size() const { return m_scanner.Size(); }
+	bool Empty() const { return m_scanner.Empty(); }
+	size_t RegexpsCount() const { return m_scanner.RegexpsCount(); }
+
+	void Initialize(State& state) const { m_scanner.Initialize(state); }
+	Action Next(State& state, Char c) const { return m_scanner.Next(state, c); }
+	void TakeAction(State& state, Action action) const { m_scanner.TakeAction(state, action); }
+
+	bool Final(const State& state) const { return m_scanner.Final(state); }
+	bool Dead(const State& state) const { return m_scanner.Dead(state); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const { return m_scanner.AcceptedRegexps(state); }
+
+	size_t StateIndex(State s) const { return m_scanner.StateIndex(s); }
+
+	/// Runs through the range, using native code if available
+	void RunCode(State& state, const char* begin, const char* end) const;
+
+	/// Same as Pire::LongestPrefix(), using native code if available
+	const char* LongestPrefixCode(const char* begin, const char* end) const;
+
+private:
+	struct Code;
+
+	Scanner m_scanner;
+	yvector<State> m_states; ///< States by their indices
+	Code* m_code;
+
+	/// Fills m_states, returning which of them are reachable
+	yvector<bool> IndexStates();
+	void Translate(const yvector<bool>& reachable);
+};
+
+#ifndef PIRE_DEBUG
+
+template<>
+inline void Run<JitScanner>(const JitScanner& sc, JitScanner::State& st, const char* begin, const char* end)
+{
+	sc.RunCode(st, begin, end);
+}
+
+template<>
+inline const char* LongestPrefix<JitScanner>(const JitScanner& sc, const char* begin, const char* end)
+{
+	return sc.LongestPrefixCode(begin, end);
+}
+
+#endif
+
+}
+
+#endif
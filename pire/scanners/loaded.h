@@ -77,13 +77,16 @@ protected:
 
 	LoadedScanner(const LoadedScanner& s): m(s.m)
 	{
-		if (s.m_buffer) {
-			m_buffer = new char [BufSize()];
+		if (!s.m_buffer) {
+			Alias(s);
+		} else if (char* buf = Impl::ShareBuffer(s.m_buffer)) {
+			Alias(s);
+			m_buffer = buf;
+		} else {
+			m_buffer = Impl::NewSharedBuffer(BufSize());
 			memcpy(m_buffer, s.m_buffer, BufSize());
 			Markup(m_buffer);
 			m.initial = (InternalState)m_jumps + (s.m.initial - (InternalState)s.m_jumps);
-		} else {
-			Alias(s);
 		}
 	}
 
@@ -101,6 +104,16 @@ protected:
 
 	LoadedScanner& operator = (const LoadedScanner& s) { LoadedScanner(s).Swap(*this); return *this; }
 
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	LoadedScanner(LoadedScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	LoadedScanner& operator = (LoadedScanner&& s) { Swap(s); return *this; }
+#endif
+
 public:
 	size_t Size() const { return m.statesCount; }
 
@@ -144,7 +157,7 @@ public:
 		m.statesCount = states;
 		m.lettersCount = letters.Size();
 		m.regexpsCount = regexpsCount;
-		m_buffer = new char[BufSize()];
+		m_buffer = Impl::NewSharedBuffer(BufSize());
 		memset(m_buffer, 0, BufSize());
 		Markup(m_buffer);
 
@@ -270,7 +283,7 @@ private:
 
 inline LoadedScanner::~LoadedScanner()
 {
-	delete [] m_buffer;
+	Impl::ReleaseSharedBuffer(m_buffer);
 }
 
 }
@@ -88,7 +88,8 @@ protected:
 	enum {
 		 FinalFlag = 1,
 		 DeadFlag  = 2,
-		 Flags = FinalFlag | DeadFlag
+		 Flags = FinalFlag | DeadFlag,
+		 AbsorbingFlag = 4 ///< Not taken from the Fsm, but computed by BuildShortcuts()
 	};
 
 	static const size_t End = static_cast<size_t>(-1);
@@ -118,7 +119,7 @@ public:
 
 	Scanner() { Alias(Null()); }
 	
-	explicit Scanner(Fsm& fsm)
+	explicit Scanner(Fsm& fsm): m_masksBuffer(0)
 	{
 		fsm.Canonize();
 		Init(fsm.Size(), fsm.Letters(), fsm.Finals().size(), fsm.Initial(), 1);
@@ -141,6 +142,11 @@ public:
 	/// reach any final state from current one)
 	bool Dead(const State& state) const { return (Header(state).Common.Flags & DeadFlag) != 0; }
 
+	/// Checks whether no character can take the scanner out of specified state
+	/// (BeginMark and EndMark still can), so a scan can stop as soon as it gets there.
+	/// Surrounded regexps become such once matched, as do dead states.
+	bool Absorbing(const State& state) const { return (Header(state).Common.Flags & AbsorbingFlag) != 0; }
+
 	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
 	{
 		size_t idx = (state - reinterpret_cast<size_t>(m_transitions)) /
@@ -152,6 +158,22 @@ public:
 		return ymake_pair(b, e);
 	}
 
+	/**
+	 * Returns regexps accepted in the state as a bitmask of MaskWords() words:
+	 * regexp `i' is accepted iff bit (i % 64) of word (i / 64) is set.
+	 * Equal masks are stored once, so they can also be compared by pointers.
+	 */
+	const ui64* AcceptedMask(const State& state) const
+	{
+		return m_masks + m_maskIndex[StateIndex(state)];
+	}
+
+	/// The length of each mask returned by AcceptedMask(), in 64-bit words
+	size_t MaskWords() const { return m_masksLocals->words; }
+
+	/// The number of distinct masks in the scanner
+	size_t DistinctMasks() const { return m_masksLocals->count; }
+
 	/// Returns an initial state for this scanner
 	void Initialize(State& state) const { state = m.initial; }
 
@@ -188,19 +210,24 @@ public:
 
 	void TakeAction(State&, Action) const {}
 
-	Scanner(const Scanner& s): m(s.m), m_buffer(0)
+	Scanner(const Scanner& s): m(s.m), m_buffer(0), m_masksBuffer(0)
 	{
 		if (!s.m_buffer) {
 			// Empty or mmap()-ed scanner
 			Alias(s);
+			ShareMasks(s);
+		} else if (char* buf = Impl::ShareBuffer(s.m_buffer)) {
+			// In-memory scanner, share its tables
+			Alias(s);
+			m_buffer = buf;
+			ShareMasks(s);
 		} else {
-			// In-memory scanner
 			DeepCopy(s);
 		}
 	}
 
 	template<class AnotherRelocation>
-	Scanner(const Scanner<AnotherRelocation, Shortcutting>& s) : m_buffer(0)
+	Scanner(const Scanner<AnotherRelocation, Shortcutting>& s) : m_buffer(0), m_masksBuffer(0)
 	{
 		if (s.Empty())
 			Alias(Null());
@@ -223,55 +250,49 @@ public:
 		DoSwap(m_finalEnd, s.m_finalEnd);
 		DoSwap(m_finalIndex, s.m_finalIndex);
 		DoSwap(m_transitions, s.m_transitions);
+		DoSwap(m_masksBuffer, s.m_masksBuffer);
+		DoSwap(m_masksLocals, s.m_masksLocals);
+		DoSwap(m_maskIndex, s.m_maskIndex);
+		DoSwap(m_masks, s.m_masks);
 	}
 
 	Scanner& operator = (const Scanner& s) { Scanner(s).Swap(*this); return *this; }
 
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	Scanner(Scanner&& s): m_buffer(0), m_masksBuffer(0)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	Scanner& operator = (Scanner&& s) { Swap(s); return *this; }
+#endif
+
 	~Scanner()
 	{
-		delete[] m_buffer;
+		Impl::ReleaseSharedBuffer(m_buffer);
+		Impl::ReleaseSharedBuffer(m_masksBuffer);
 	}
 
 	/*
 	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
 	 * to unconsumed part of the buffer.
+	 *
+	 * Depending on @p mode, either makes sure that all jumps stay within
+	 * the transition table, or verifies checksums of the serialized scanner
+	 * right away, or does both: checks jumps right away and checksums
+	 * in the given @p verifier. Scanners saved by older versions
+	 * have no checksums and can only be mapped with MmapTrust.
 	 */
-	typename Relocation::RetvalForMmap Mmap(const void* ptr, size_t size)
-	{
-		Impl::CheckAlign(ptr, sizeof(size_t));
-		Scanner s;
-
-		const size_t* p = reinterpret_cast<const size_t*>(ptr);
-		Impl::ValidateHeader(p, size, 1, sizeof(m));
-		if (size < sizeof(s.m))
-			throw Error("EOF reached while mapping Pire::Scanner");
-
-		memcpy(&s.m, p, sizeof(s.m));
-		if (s.m.relocationSignature != Relocation::Signature)
-			throw Error("Type mismatch while mmapping Pire::Scanner");
-		Impl::AdvancePtr(p, size, sizeof(s.m));
-		Impl::AlignPtr(p, size);
-		
-		if (Shortcutting::Signature != s.m.shortcuttingSignature)
-			throw Error("This scanner has different shortcutting type");
-		
-		bool empty = *((const bool*) p);
-		Impl::AdvancePtr(p, size, sizeof(empty));
-		Impl::AlignPtr(p, size);
-		
-		if (empty)
-			s.Alias(Null());
-		else {
-			if (size < s.BufSize())
-				throw Error("EOF reached while mapping NPire::Scanner");
-			s.Markup(const_cast<size_t*>(p));
-			Impl::AdvancePtr(p, size, s.BufSize());
-			s.m.initial += reinterpret_cast<size_t>(s.m_transitions);
-		}
+	typename Relocation::RetvalForMmap Mmap(const void* ptr, size_t size, MmapMode mode = MmapTrust, BackgroundVerifier* verifier = 0);
 
-		Swap(s);
-		return Impl::AlignPtr(p, size);
-	}
+	/**
+	 * Reads the tables in the order scans are most likely to access them:
+	 * character classes first, then transition rows breadth-first from the initial state.
+	 * Used to fault in pages of mmap()-ed scanners (see MappedScanner);
+	 * stops early once *stop becomes true.
+	 */
+	void WarmUp(const volatile bool* stop = 0) const;
 
 	size_t StateIndex(State s) const
 	{
@@ -288,6 +309,48 @@ public:
 	 */
 	static Scanner Glue(const Scanner& a, const Scanner& b, size_t maxSize = 0);
 
+	/**
+	 * Returns a copy of the scanner which no longer reports regexps with
+	 * indices in [from, to); regexps past that range are renumbered to fill the gap.
+	 * The transition table is left as is, which makes the operation much cheaper
+	 * than regluing the remaining regexps (at the cost of some unreachable-final states).
+	 */
+	Scanner DropRegexps(size_t from, size_t to) const
+	{
+		YASSERT(from <= to && to <= RegexpsCount());
+		if (from == to)
+			return *this;
+		if (from == 0 && to == RegexpsCount())
+			return Scanner();
+
+		Scanner s;
+		s.DeepCopy(*this);
+		s.m.regexpsCount -= static_cast<ui32>(to - from);
+
+		// Final lists can only shrink, so they are compacted in place
+		size_t* out = s.m_final;
+		for (size_t st = 0; st != s.Size(); ++st) {
+			const size_t* in = s.m_final + s.m_finalIndex[st];
+			s.m_finalIndex[st] = out - s.m_final;
+			size_t* b = out;
+			for (; *in != End; ++in) {
+				if (*in < from)
+					*out++ = *in;
+				else if (*in >= to)
+					*out++ = *in - (to - from);
+			}
+			*out++ = End;
+			size_t& flags = s.Header(s.IndexToState(st)).Common.Flags;
+			flags = (b != out - 1) ? (flags | FinalFlag) : (flags & ~(size_t) FinalFlag);
+		}
+		// Zero the tail, as Init() does, so neither stale ids get saved
+		// nor Markup() mistakes them for lists
+		std::fill(out, s.m_final + s.m.finalTableSize, 0);
+		s.m_finalEnd = out;
+		s.BuildMasks();
+		return s;
+	}
+
 	// Returns the size of the memory buffer used (or required) by scanner.
 	size_t BufSize() const
 	{
@@ -299,9 +362,50 @@ public:
 		sizeof(size_t));
 	}
 
+	// Returns the size of the memory buffer used by the mask table.
+	size_t MasksBufSize() const { return MasksBufSize(m_masksLocals->words, m_masksLocals->count); }
+
 	void Save(yostream*) const;
 	void Load(yistream*);
 
+	/// Returns the number of bytes Save() writes.
+	size_t SerializedSize() const;
+
+	/**
+	 * Writes exactly what Save() would write (i.e. a memory image suitable
+	 * for Mmap()) into the buffer, which must be at least SerializedSize() bytes long.
+	 * Returns a pointer past the written data.
+	 */
+	void* SaveTo(void* buf) const;
+
+	/// Writes exactly what Save() would write into the file descriptor, without any intermediate copies.
+	void SaveToFd(int fd) const;
+
+	/**
+	 * Saves the scanner in a portable format, which depends neither on pointer
+	 * and machine word sizes nor on byte order (see ScannerSaver for its layout).
+	 * If @p withNative is set, the native representation is appended as well,
+	 * so hosts similar to this one can mmap() the scanner without any conversion.
+	 */
+	void SavePortable(yostream* s, bool withNative = true) const;
+
+	/// Mmaps the native part of a portable representation if it suits this host,
+	/// otherwise converts the representation into a buffer of its own.
+	/// Returns a pointer to unconsumed part of the buffer.
+	const void* MmapPortable(const void* ptr, size_t size);
+
+	void LoadPortable(yistream* s);
+
+	/**
+	 * Saves the scanner with its transition table compressed (repeating rows
+	 * are replaced with references, other rows are delta-encoded).
+	 * Such scanners cannot be mmap()-ed and must be loaded with LoadCompressed().
+	 */
+	void SaveCompressed(yostream* s) const;
+
+	/// Loads a compressed scanner, decoding its transition table in up to @p threads threads.
+	void LoadCompressed(yistream* s, size_t threads = 1);
+
 	ScannerRowHeader& Header(State s) { return *(ScannerRowHeader*) s; }
 	const ScannerRowHeader& Header(State s) const { return *(const ScannerRowHeader*) s; }
 
@@ -326,6 +430,18 @@ private:
 
 	Transition* m_transitions;
 
+	struct MasksLocals {
+		size_t words; ///< Length of each mask, in 64-bit words
+		size_t count; ///< Number of distinct masks
+	};
+
+	// The mask table lives in a buffer of its own, since its size
+	// is only known once the final table is filled
+	char* m_masksBuffer;
+	MasksLocals* m_masksLocals;
+	ui32* m_maskIndex; ///< Offsets of masks in m_masks, by state indices
+	ui64* m_masks;
+
 	// Only used to force Null() call during static initialization, when Null()::n can be
 	// initialized safely by compilers that don't support thread safe static local vars
 	// initialization
@@ -354,7 +470,7 @@ private:
 		m.regexpsCount = regexpsCount;
 		m.finalTableSize = finalStatesCount + states;
 
-		m_buffer = new char[BufSize() + sizeof(size_t)];
+		m_buffer = Impl::NewSharedBuffer(BufSize() + sizeof(size_t));
 		memset(m_buffer, 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer, sizeof(size_t)));
 		m_finalEnd = m_final;
@@ -380,6 +496,11 @@ private:
 		m_final	      = reinterpret_cast<size_t*>(m_letters + MaxChar);
 		m_finalIndex  = reinterpret_cast<size_t*>(m_final + m.finalTableSize);
 		m_transitions = reinterpret_cast<Transition*>(m_finalIndex + m.statesCount);
+
+		// The final table can be larger than needed; its used part ends with the last End
+		m_finalEnd = m_final + m.finalTableSize;
+		while (m_finalEnd != m_final && m_finalEnd[-1] != End)
+			--m_finalEnd;
 	}
 
 	// Makes a shallow ("weak") copy of the given scanner.
@@ -390,8 +511,27 @@ private:
 		m_buffer = 0;
 		m_letters = s.m_letters;
 		m_final = s.m_final;
+		m_finalEnd = s.m_finalEnd;
 		m_finalIndex = s.m_finalIndex;
 		m_transitions = s.m_transitions;
+		m_masksBuffer = 0;
+		m_masksLocals = s.m_masksLocals;
+		m_maskIndex = s.m_maskIndex;
+		m_masks = s.m_masks;
+	}
+
+	// Takes another reference to (or a copy of) the mask table owned by the given scanner, if any.
+	// Scanners mmap()-ed from older formats own the table even though they own no other buffers.
+	void ShareMasks(const Scanner<Relocation, Shortcutting>& s)
+	{
+		if (!s.m_masksBuffer)
+			return;
+		m_masksBuffer = Impl::ShareBuffer(s.m_masksBuffer);
+		if (!m_masksBuffer) {
+			m_masksBuffer = Impl::NewSharedBuffer(s.MasksBufSize());
+			memcpy(m_masksBuffer, s.m_masksBuffer, s.MasksBufSize());
+		}
+		MarkupMasks(m_masksBuffer);
 	}
 	
 	template<class AnotherRelocation>
@@ -405,7 +545,8 @@ private:
 		memcpy(&m, &s.m, sizeof(s.m));
 		m.relocationSignature = Relocation::Signature;
 		m.shortcuttingSignature = Shortcutting::Signature;
-		m_buffer = new char[BufSize() + sizeof(size_t)];
+		m_buffer = Impl::NewSharedBuffer(BufSize() + sizeof(size_t));
+		memset(m_buffer, 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer, sizeof(size_t)));
 
 		// Values in letter-to-leterclass table take into account row header size
@@ -436,6 +577,59 @@ private:
 				YASSERT(Relocation::Go(newstate, tr) < (size_t)(m_transitions + RowSize()*Size()));
 			}
 		}
+
+		m_masksBuffer = Impl::NewSharedBuffer(s.MasksBufSize());
+		memcpy(m_masksBuffer, s.m_masksLocals, s.MasksBufSize());
+		MarkupMasks(m_masksBuffer);
+	}
+
+	static size_t MaskWordsFor(size_t regexpsCount) { return ymax<size_t>((regexpsCount + 63) / 64, 1); }
+
+	size_t MasksBufSize(size_t words, size_t count) const
+	{
+		return sizeof(MasksLocals)
+			+ AlignUp(m.statesCount * sizeof(ui32), sizeof(size_t))
+			+ words * count * sizeof(ui64);
+	}
+
+	void MarkupMasks(void* ptr)
+	{
+		m_masksLocals = reinterpret_cast<MasksLocals*>(ptr);
+		m_maskIndex = reinterpret_cast<ui32*>(m_masksLocals + 1);
+		m_masks = reinterpret_cast<ui64*>(reinterpret_cast<char*>(m_maskIndex) + AlignUp(m.statesCount * sizeof(ui32), sizeof(size_t)));
+	}
+
+	// Fills the mask table from the final table
+	void BuildMasks()
+	{
+		size_t words = MaskWordsFor(m.regexpsCount);
+		ymap<yvector<ui64>, size_t> offsets;
+		yvector<ui32> index(m.statesCount);
+		yvector<ui64> masks;
+		yvector<ui64> mask(words);
+		for (size_t st = 0; st != m.statesCount; ++st) {
+			std::fill(mask.begin(), mask.end(), 0);
+			for (const size_t* re = m_final + m_finalIndex[st]; *re != End; ++re) {
+				YASSERT(*re < m.regexpsCount);
+				mask[*re / 64] |= static_cast<ui64>(1) << (*re % 64);
+			}
+			ymap<yvector<ui64>, size_t>::iterator it = offsets.find(mask);
+			if (it == offsets.end()) {
+				it = offsets.insert(ymake_pair(mask, masks.size())).first;
+				masks.insert(masks.end(), mask.begin(), mask.end());
+			}
+			index[st] = static_cast<ui32>(it->second);
+		}
+
+		size_t size = MasksBufSize(words, offsets.size());
+		Impl::ReleaseSharedBuffer(m_masksBuffer);
+		m_masksBuffer = Impl::NewSharedBuffer(size);
+		memset(m_masksBuffer, 0, size);
+		MarkupMasks(m_masksBuffer);
+		m_masksLocals->words = words;
+		m_masksLocals->count = offsets.size();
+		std::copy(index.begin(), index.end(), m_maskIndex);
+		std::copy(masks.begin(), masks.end(), m_masks);
 	}
 
 
@@ -503,6 +697,11 @@ private:
 				// Not enough space in ExitMasks, so reset all masks (which leads to bypassing the optimization)
 				Shortcutting::SetNoShortcut(header);
 			}
+			// No masks were needed, so every character loops
+			if (let == LettersCount() + HEADER_SIZE && ind == 0)
+				header.Common.Flags |= AbsorbingFlag;
+			else
+				header.Common.Flags &= ~(size_t) AbsorbingFlag;
 			// Fill the rest of the shortcut masks with the last used mask
 			Shortcutting::FinishMasks(header, ind);
 		}
@@ -519,6 +718,7 @@ private:
 			*m_finalEnd++ = static_cast<size_t>(-1);
 		}
 		BuildShortcuts();
+		BuildMasks();
 	}
 
 	size_t AcceptedRegexpsCount(size_t idx) const
@@ -549,30 +749,795 @@ private:
 
 // Helper class for Save/Load partial specialization
 struct ScannerSaver {
+	/*
+	 * Save() follows the scanner buffer with CRC32C checksums of its sections,
+	 * so corrupted files can be detected without a full pass over the table,
+	 * and then with the mask table (see Scanner::AcceptedMask()).
+	 */
+	enum {
+		SectionLocals,
+		SectionLetters,
+		SectionFinal,
+		SectionFinalIndex,
+		SectionTransitions,
+		SectionMasks,
+		SectionsCount
+	};
+
+	// Scanners saved before the mask table was introduced have no checksum for it
+	static size_t SavedSections(const Pire::Header& hdr)
+	{
+		return hdr.Version >= Pire::Header::RE_VERSION_WITH_MASKS ? SectionsCount : SectionMasks;
+	}
+
+	// Everything Save() writes, as a list of chunks pointing either
+	// into the scanner itself or into this structure
+	template<class Shortcutting>
+	struct SavedScanner {
+		Pire::Header Hdr;
+		typename Scanner<Relocatable, Shortcutting>::Locals Mc;
+		bool Empty;
+		ui32 Checksums[SectionsCount];
+		yvector<Impl::Chunk> Chunks;
+
+		SavedScanner(): Hdr(1, sizeof(Mc), Pire::Header::RE_VERSION_WITH_MASKS) {}
+	private:
+		SavedScanner(const SavedScanner&);
+		SavedScanner& operator = (const SavedScanner&);
+	};
+
+	template<class Shortcutting>
+	static void Serialize(const Scanner<Relocatable, Shortcutting>& scanner, SavedScanner<Shortcutting>& saved)
+	{
+		// Copy locals field by field, so padding bytes are zeroes and the output is reproducible
+		memset(&saved.Mc, 0, sizeof(saved.Mc));
+		saved.Mc.statesCount = scanner.m.statesCount;
+		saved.Mc.lettersCount = scanner.m.lettersCount;
+		saved.Mc.regexpsCount = scanner.m.regexpsCount;
+		saved.Mc.initial = scanner.m.initial - reinterpret_cast<size_t>(scanner.m_transitions);
+		saved.Mc.finalTableSize = scanner.m.finalTableSize;
+		saved.Mc.relocationSignature = scanner.m.relocationSignature;
+		saved.Mc.shortcuttingSignature = scanner.m.shortcuttingSignature;
+		saved.Empty = scanner.Empty();
+		Impl::AddAlignedChunk(saved.Chunks, &saved.Hdr, sizeof(saved.Hdr));
+		Impl::AddAlignedChunk(saved.Chunks, &saved.Mc, sizeof(saved.Mc));
+		Impl::AddAlignedChunk(saved.Chunks, &saved.Empty, sizeof(saved.Empty));
+		// Mmap()-ed scanners do not own a buffer, so save whatever Markup() points to
+		if (!saved.Empty) {
+			Impl::AddAlignedChunk(saved.Chunks, scanner.m_letters, scanner.BufSize());
+			Checksums(scanner, &saved.Mc, saved.Checksums);
+			Impl::AddAlignedChunk(saved.Chunks, saved.Checksums, sizeof(saved.Checksums));
+			Impl::AddAlignedChunk(saved.Chunks, scanner.m_masksLocals, scanner.MasksBufSize());
+		}
+	}
+
 	template<class Shortcutting>
 	static void SaveScanner(const Scanner<Relocatable, Shortcutting>& scanner, yostream* s)
+	{
+		SavedScanner<Shortcutting> saved;
+		Serialize(scanner, saved);
+		Impl::SaveChunks(s, saved.Chunks);
+	}
+
+	template<class Shortcutting>
+	static size_t SerializedSize(const Scanner<Relocatable, Shortcutting>& scanner)
+	{
+		size_t size = AlignUp(sizeof(Pire::Header), sizeof(size_t))
+			+ AlignUp(sizeof(scanner.m), sizeof(size_t))
+			+ AlignUp(sizeof(bool), sizeof(size_t));
+		if (!scanner.Empty())
+			size += scanner.BufSize() + AlignUp(sizeof(ui32) * SectionsCount, sizeof(size_t)) + scanner.MasksBufSize();
+		return size;
+	}
+
+	template<class Shortcutting>
+	static void* SaveTo(const Scanner<Relocatable, Shortcutting>& scanner, void* buf)
+	{
+		SavedScanner<Shortcutting> saved;
+		Serialize(scanner, saved);
+		return Impl::CopyChunks(buf, saved.Chunks);
+	}
+
+	template<class Shortcutting>
+	static void SaveToFd(const Scanner<Relocatable, Shortcutting>& scanner, int fd)
+	{
+		SavedScanner<Shortcutting> saved;
+		Serialize(scanner, saved);
+		Impl::WriteChunks(fd, saved.Chunks);
+	}
+
+	template<class Shortcutting>
+	static void LoadScanner(Scanner<Relocatable, Shortcutting>& scanner, yistream* s)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+
+		Scanner<Relocatable, Shortcutting> sc;
+		Pire::Header hdr = Impl::ValidateHeader(s, 1, sizeof(sc.m));
+		LoadPodType(s, sc.m);
+		Impl::AlignLoad(s, sizeof(sc.m));
+		if (Shortcutting::Signature != sc.m.shortcuttingSignature)
+			throw Error("This scanner has different shortcutting type");
+		bool empty;
+		LoadPodType(s, empty);
+		Impl::AlignLoad(s, sizeof(empty));
+		
+		if (empty) {
+			sc.Alias(ScannerType::Null());
+		} else {
+			sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
+			Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
+			sc.Markup(sc.m_buffer);
+			size_t sections = SavedSections(hdr);
+			if (hdr.Version >= Pire::Header::RE_VERSION_WITH_CHECKSUMS) {
+				ui32 expected[SectionsCount];
+				ui32 actual[SectionsCount];
+				Impl::AlignedLoadArray(s, expected, sections);
+				if (sections == SectionsCount)
+					LoadMasks(sc, s);
+				Checksums(sc, &sc.m, actual, sections);
+				if (!std::equal(expected, expected + sections, actual))
+					throw Error("Serialized Pire::Scanner is corrupted");
+			}
+			if (sections != SectionsCount) {
+				// The final table the masks are built from has not been checked by anyone yet
+				CheckBounds(sc);
+				sc.BuildMasks();
+			}
+			sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
+		}
+		scanner.Swap(sc);
+	}
+
+	template<class Shortcutting>
+	static void CheckMasksLocals(const Scanner<Relocatable, Shortcutting>& scanner, size_t words, size_t count)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+		if (words != ScannerType::MaskWordsFor(scanner.m.regexpsCount) || !count || count > scanner.m.statesCount)
+			throw Error("Serialized Pire::Scanner is corrupted");
+	}
+
+	template<class Shortcutting>
+	static void LoadMasks(Scanner<Relocatable, Shortcutting>& scanner, yistream* s)
+	{
+		typename Scanner<Relocatable, Shortcutting>::MasksLocals locals;
+		LoadPodType(s, locals);
+		CheckMasksLocals(scanner, locals.words, locals.count);
+		size_t size = scanner.MasksBufSize(locals.words, locals.count);
+		scanner.m_masksBuffer = Impl::NewSharedBuffer(size);
+		memcpy(scanner.m_masksBuffer, &locals, sizeof(locals));
+		Impl::AlignedLoadArray(s, scanner.m_masksBuffer + sizeof(locals), size - sizeof(locals));
+		scanner.MarkupMasks(scanner.m_masksBuffer);
+	}
+
+	template<class Shortcutting>
+	static void MmapMasks(Scanner<Relocatable, Shortcutting>& scanner, const size_t*& p, size_t& size)
+	{
+		typedef typename Scanner<Relocatable, Shortcutting>::MasksLocals MasksLocals;
+		if (size < sizeof(MasksLocals))
+			throw Error("EOF reached while mapping Pire::Scanner");
+		const MasksLocals* locals = reinterpret_cast<const MasksLocals*>(p);
+		CheckMasksLocals(scanner, locals->words, locals->count);
+		size_t masksSize = scanner.MasksBufSize(locals->words, locals->count);
+		if (size < masksSize)
+			throw Error("EOF reached while mapping Pire::Scanner");
+		scanner.MarkupMasks(const_cast<size_t*>(p));
+		Impl::AdvancePtr(p, size, masksSize);
+	}
+
+	template<class Shortcutting>
+	static void Sections(const Scanner<Relocatable, Shortcutting>& scanner, const void* locals, const void** ptrs, size_t* sizes)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+		ptrs[SectionLocals] = locals;
+		sizes[SectionLocals] = sizeof(scanner.m);
+		ptrs[SectionLetters] = scanner.m_letters;
+		sizes[SectionLetters] = MaxChar * sizeof(typename ScannerType::Letter);
+		ptrs[SectionFinal] = scanner.m_final;
+		sizes[SectionFinal] = scanner.m.finalTableSize * sizeof(size_t);
+		ptrs[SectionFinalIndex] = scanner.m_finalIndex;
+		sizes[SectionFinalIndex] = scanner.m.statesCount * sizeof(size_t);
+		ptrs[SectionTransitions] = scanner.m_transitions;
+		sizes[SectionTransitions] = scanner.RowSize() * scanner.m.statesCount * sizeof(typename ScannerType::Transition);
+		ptrs[SectionMasks] = scanner.m_masksLocals;
+		sizes[SectionMasks] = scanner.MasksBufSize();
+	}
+
+	template<class Shortcutting>
+	static void Checksums(const Scanner<Relocatable, Shortcutting>& scanner, const void* locals, ui32* checksums, size_t sections = SectionsCount)
+	{
+		const void* ptrs[SectionsCount];
+		size_t sizes[SectionsCount];
+		Sections(scanner, locals, ptrs, sizes);
+		for (size_t i = 0; i != sections; ++i)
+			checksums[i] = Impl::Crc32c(ptrs[i], sizes[i]);
+	}
+
+	template<class Shortcutting>
+	static bool IsRow(const Scanner<Relocatable, Shortcutting>& scanner, size_t state)
+	{
+		size_t offset = state - reinterpret_cast<size_t>(scanner.m_transitions);
+		size_t rowBytes = scanner.RowSize() * sizeof(typename Scanner<Relocatable, Shortcutting>::Transition);
+		return offset < rowBytes * scanner.Size() && offset % rowBytes == 0;
+	}
+
+	// Makes sure the scanner cannot jump or look outside its tables,
+	// whatever input it is given. Takes a single pass over all tables.
+	template<class Shortcutting>
+	static void CheckBounds(const Scanner<Relocatable, Shortcutting>& scanner)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+
+		for (size_t ch = 0; ch != MaxCharUnaligned; ++ch) {
+			// Epsilon is never fed to scanners, so its letter is meaningless
+			size_t letter = scanner.m_letters[ch];
+			if (ch != Epsilon && (letter < ScannerType::HEADER_SIZE || letter >= ScannerType::HEADER_SIZE + scanner.m.lettersCount))
+				throw Error("Serialized Pire::Scanner is corrupted");
+		}
+		size_t finals = scanner.m_finalEnd - scanner.m_final;
+		for (size_t i = 0; i != finals; ++i)
+			if (scanner.m_final[i] != ScannerType::End && scanner.m_final[i] >= scanner.m.regexpsCount)
+				throw Error("Serialized Pire::Scanner is corrupted");
+		for (size_t st = 0; st != scanner.Size(); ++st) {
+			if (scanner.m_finalIndex[st] >= finals)
+				throw Error("Serialized Pire::Scanner is corrupted");
+			size_t state = scanner.IndexToState(st);
+			const typename ScannerType::Transition* row = reinterpret_cast<const typename ScannerType::Transition*>(state);
+			for (size_t let = 0; let != scanner.m.lettersCount; ++let)
+				if (!IsRow(scanner, Relocatable::Go(state, row[let + ScannerType::HEADER_SIZE])))
+					throw Error("Serialized Pire::Scanner is corrupted");
+		}
+	}
+
+	// Makes sure AcceptedMask() cannot look outside the mask table
+	template<class Shortcutting>
+	static void CheckMasks(const Scanner<Relocatable, Shortcutting>& scanner)
+	{
+		size_t words = scanner.m_masksLocals->words;
+		size_t tableSize = words * scanner.m_masksLocals->count;
+		for (size_t st = 0; st != scanner.Size(); ++st)
+			if (scanner.m_maskIndex[st] >= tableSize || scanner.m_maskIndex[st] % words)
+				throw Error("Serialized Pire::Scanner is corrupted");
+	}
+
+	template<class Relocation, class Shortcutting>
+	static void WarmUp(const Scanner<Relocation, Shortcutting>& scanner, const volatile bool* stop)
+	{
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+
+		if (scanner.Empty())
+			return;
+		volatile size_t sink = 0;
+		const char* tables = reinterpret_cast<const char*>(scanner.m_letters);
+		const char* tablesEnd = reinterpret_cast<const char*>(scanner.m_transitions);
+		for (const char* p = tables; p < tablesEnd; p += sizeof(size_t))
+			sink += *reinterpret_cast<const size_t*>(p);
+
+		yvector<bool> seen(scanner.Size(), false);
+		ydeque<size_t> queue;
+		size_t initial = scanner.StateIndex(scanner.m.initial);
+		seen[initial] = true;
+		queue.push_back(initial);
+		while (!queue.empty() && !(stop && *stop)) {
+			size_t state = scanner.IndexToState(queue.front());
+			queue.pop_front();
+			const typename ScannerType::Transition* row = reinterpret_cast<const typename ScannerType::Transition*>(state);
+			for (size_t let = 0; let != scanner.m.lettersCount; ++let) {
+				size_t next = scanner.StateIndex(Relocation::Go(state, row[let + ScannerType::HEADER_SIZE]));
+				if (next < seen.size() && !seen[next]) {
+					seen[next] = true;
+					queue.push_back(next);
+				}
+			}
+		}
+	}
+
+	template<class Shortcutting>
+	static const void* MmapScanner(Scanner<Relocatable, Shortcutting>& scanner, const void* ptr, size_t size, MmapMode mode, BackgroundVerifier* verifier)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+
+		Impl::CheckAlign(ptr, sizeof(size_t));
+		if (mode == MmapVerifyInBackground && !verifier)
+			throw Error("No BackgroundVerifier given to Pire::Scanner::Mmap()");
+		ScannerType s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Pire::Header hdr = Impl::ValidateHeader(p, size, 1, sizeof(s.m));
+		if (size < sizeof(s.m))
+			throw Error("EOF reached while mapping Pire::Scanner");
+
+		const void* locals = p;
+		memcpy(&s.m, p, sizeof(s.m));
+		if (s.m.relocationSignature != Relocatable::Signature)
+			throw Error("Type mismatch while mmapping Pire::Scanner");
+		Impl::AdvancePtr(p, size, sizeof(s.m));
+		Impl::AlignPtr(p, size);
+
+		if (Shortcutting::Signature != s.m.shortcuttingSignature)
+			throw Error("This scanner has different shortcutting type");
+
+		bool empty = *((const bool*) p);
+		Impl::AdvancePtr(p, size, sizeof(empty));
+		Impl::AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(ScannerType::Null());
+		else {
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::Scanner");
+			s.Markup(const_cast<size_t*>(p));
+			Impl::AdvancePtr(p, size, s.BufSize());
+
+			ui32 checksums[SectionsCount];
+			size_t sections = SavedSections(hdr);
+			if (hdr.Version >= Pire::Header::RE_VERSION_WITH_CHECKSUMS) {
+				size_t checksumsSize = AlignUp(sizeof(*checksums) * sections, sizeof(size_t));
+				if (size < checksumsSize)
+					throw Error("EOF reached while mapping Pire::Scanner");
+				memcpy(checksums, p, sizeof(*checksums) * sections);
+				Impl::AdvancePtr(p, size, checksumsSize);
+			} else if (mode != MmapTrust)
+				throw Error("Serialized Pire::Scanner has no checksums");
+			if (sections == SectionsCount)
+				MmapMasks(s, p, size);
+
+			s.m.initial += reinterpret_cast<size_t>(s.m_transitions);
+			if (!IsRow(s, s.m.initial))
+				throw Error("Serialized Pire::Scanner is corrupted");
+			// Checksums verified in background come too late to protect Go(),
+			// so bounds are checked before anything is handed to the verifier
+			if (mode != MmapVerify) {
+				CheckBounds(s);
+				if (sections == SectionsCount)
+					CheckMasks(s);
+			}
+
+			if (mode != MmapTrust) {
+				const void* ptrs[SectionsCount];
+				size_t sizes[SectionsCount];
+				Sections(s, locals, ptrs, sizes);
+				for (size_t i = 0; i != sections; ++i) {
+					if (mode == MmapVerifyInBackground)
+						verifier->Add(ptrs[i], sizes[i], checksums[i]);
+					else if (Impl::Crc32c(ptrs[i], sizes[i]) != checksums[i])
+						throw Error("Serialized Pire::Scanner is corrupted");
+				}
+			}
+			// Older formats have no mask table, so the scanner gets one of its own
+			if (sections != SectionsCount)
+				s.BuildMasks();
+		}
+
+		scanner.Swap(s);
+		return Impl::AlignPtr(p, size);
+	}
+
+	/*
+	 * Portable format: a PortableHeaderSize-byte header, followed by
+	 *   ui16 letters[MaxCharUnaligned]        -- letter class of each character (0xFFFF if none);
+	 *   ui32 flags[statesCount]               -- FinalFlag, DeadFlag;
+	 *   ui32 finalIndex[statesCount]          -- start of each state's list in `final';
+	 *   ui32 final[finalCount]                -- lists of accepted regexps, terminated with 0xFFFFFFFF;
+	 *   ui32 jumps[statesCount][lettersCount] -- indices of destination states;
+	 * and, optionally, by the native representation (as written by Save()),
+	 * aligned to ArchiveAlign bytes. All integers are little-endian.
+	 */
+	static const size_t PortableHeaderSize = 64;
+	static const ui32 PortableVersion = 1;
+	static const ui32 PortableNone = static_cast<ui32>(-1);
+
+	struct PortableLayout {
+		ui32 statesCount;
+		ui32 lettersCount;
+		ui32 regexpsCount;
+		ui32 initial;
+		ui32 finalCount;
+		ui64 nativeOffset;
+		ui64 nativeSize;
+		ui64 totalSize;
+
+		const char* letters;
+		const char* flags;
+		const char* finalIndex;
+		const char* final;
+		const char* jumps;
+
+		size_t CanonicalSize() const
+		{
+			return PortableHeaderSize + MaxCharUnaligned * 2
+				+ (static_cast<size_t>(statesCount) * (2 + lettersCount) + finalCount) * 4;
+		}
+	};
+
+	static const char* PortableMagic() { return "PIRP"; }
+
+	template<class Relocation, class Shortcutting>
+	static void SavePortable(const Scanner<Relocation, Shortcutting>& scanner, yostream* s, bool withNative)
+	{
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+
+		PortableLayout l;
+		memset(&l, 0, sizeof(l));
+		if (!scanner.Empty()) {
+			l.statesCount = scanner.Size();
+			l.lettersCount = scanner.LettersCount();
+			l.regexpsCount = scanner.RegexpsCount();
+			l.initial = scanner.StateIndex(scanner.m.initial);
+			l.finalCount = scanner.m_finalEnd - scanner.m_final;
+		}
+
+		BufferOutput native;
+		if (withNative && !scanner.Empty())
+			scanner.Save(&native);
+		l.totalSize = l.CanonicalSize();
+		if (native.Buffer().Size()) {
+			l.nativeOffset = AlignUp(l.totalSize, ArchiveAlign);
+			l.nativeSize = native.Buffer().Size();
+			l.totalSize = l.nativeOffset + l.nativeSize;
+		}
+		l.totalSize = AlignUp(l.totalSize, sizeof(size_t));
+
+		char hdr[PortableHeaderSize] = {0};
+		memcpy(hdr, PortableMagic(), 4);
+		Impl::StoreLE32(hdr + 4, PortableVersion);
+		Impl::StoreLE32(hdr + 8, 1);
+		Impl::StoreLE32(hdr + 12, l.statesCount);
+		Impl::StoreLE32(hdr + 16, l.lettersCount);
+		Impl::StoreLE32(hdr + 20, l.regexpsCount);
+		Impl::StoreLE32(hdr + 24, l.initial);
+		Impl::StoreLE32(hdr + 28, l.finalCount);
+		Impl::StoreLE64(hdr + 32, l.nativeOffset);
+		Impl::StoreLE64(hdr + 40, l.nativeSize);
+		Impl::StoreLE64(hdr + 48, l.totalSize);
+		SavePodArray(s, hdr, sizeof(hdr));
+
+		yvector<char> buf(MaxCharUnaligned * 2);
+		for (size_t ch = 0; ch != MaxCharUnaligned; ++ch) {
+			size_t letter = scanner.Empty() ? 0 : scanner.m_letters[ch];
+			Impl::StoreLE16(&buf[ch * 2], (letter >= ScannerType::HEADER_SIZE) ? letter - ScannerType::HEADER_SIZE : 0xFFFF);
+		}
+		SavePodArray(s, &buf[0], buf.size());
+
+		if (!scanner.Empty()) {
+			buf.resize(ymax<size_t>(l.statesCount, ymax<size_t>(l.lettersCount, l.finalCount)) * 4);
+			for (size_t st = 0; st != l.statesCount; ++st)
+				Impl::StoreLE32(&buf[st * 4], scanner.Header(scanner.IndexToState(st)).Common.Flags & ScannerType::Flags);
+			SavePodArray(s, &buf[0], l.statesCount * 4);
+			for (size_t st = 0; st != l.statesCount; ++st)
+				Impl::StoreLE32(&buf[st * 4], scanner.m_finalIndex[st]);
+			SavePodArray(s, &buf[0], l.statesCount * 4);
+			for (size_t i = 0; i != l.finalCount; ++i)
+				Impl::StoreLE32(&buf[i * 4], (scanner.m_final[i] == ScannerType::End) ? PortableNone : scanner.m_final[i]);
+			SavePodArray(s, &buf[0], l.finalCount * 4);
+
+			for (size_t st = 0; st != l.statesCount; ++st) {
+				size_t state = scanner.IndexToState(st);
+				const typename ScannerType::Transition* row = reinterpret_cast<const typename ScannerType::Transition*>(state);
+				for (size_t let = 0; let != l.lettersCount; ++let)
+					Impl::StoreLE32(&buf[let * 4], scanner.StateIndex(Relocation::Go(state, row[let + ScannerType::HEADER_SIZE])));
+				SavePodArray(s, &buf[0], l.lettersCount * 4);
+			}
+		}
+
+		size_t written = l.CanonicalSize();
+		if (l.nativeSize) {
+			yvector<char> fill(l.nativeOffset - written);
+			if (!fill.empty())
+				SavePodArray(s, &fill[0], fill.size());
+			SavePodArray(s, native.Buffer().Data(), l.nativeSize);
+			written = l.nativeOffset + l.nativeSize;
+		}
+		if (written != l.totalSize) {
+			yvector<char> fill(l.totalSize - written);
+			SavePodArray(s, &fill[0], fill.size());
+		}
+	}
+
+	static PortableLayout ParsePortableHeader(const char* p, size_t size)
+	{
+		if (size < PortableHeaderSize)
+			throw Error("EOF reached while mapping Pire::Scanner");
+		if (memcmp(p, PortableMagic(), 4))
+			throw Error("Not a portable Pire::Scanner");
+		if (Impl::LoadLE32(p + 4) != PortableVersion || Impl::LoadLE32(p + 8) != 1)
+			throw Error("You are trying to used an incompatible version of a serialized regexp");
+
+		PortableLayout l;
+		l.statesCount = Impl::LoadLE32(p + 12);
+		l.lettersCount = Impl::LoadLE32(p + 16);
+		l.regexpsCount = Impl::LoadLE32(p + 20);
+		l.initial = Impl::LoadLE32(p + 24);
+		l.finalCount = Impl::LoadLE32(p + 28);
+		l.nativeOffset = Impl::LoadLE64(p + 32);
+		l.nativeSize = Impl::LoadLE64(p + 40);
+		l.totalSize = Impl::LoadLE64(p + 48);
+		if (l.statesCount && (l.initial >= l.statesCount || !l.finalCount || l.lettersCount >= MaxCharUnaligned))
+			throw Error("Serialized Pire::Scanner is corrupted");
+		if (l.totalSize < l.CanonicalSize() || (l.nativeSize && (l.nativeOffset < l.CanonicalSize() || l.nativeOffset + l.nativeSize > l.totalSize)))
+			throw Error("Serialized Pire::Scanner is corrupted");
+		return l;
+	}
+
+	static void MarkupPortable(PortableLayout& l, const char* p)
+	{
+		l.letters = p + PortableHeaderSize;
+		l.flags = l.letters + MaxCharUnaligned * 2;
+		l.finalIndex = l.flags + l.statesCount * 4;
+		l.final = l.finalIndex + l.statesCount * 4;
+		l.jumps = l.final + l.finalCount * 4;
+	}
+
+	template<class Shortcutting>
+	static bool MmapNative(Scanner<Relocatable, Shortcutting>& scanner, const char* p, const PortableLayout& l)
+	{
+		if (!l.nativeSize || !Impl::IsAligned(p + l.nativeOffset, sizeof(size_t)))
+			return false;
+		const Pire::Header* hdr = reinterpret_cast<const Pire::Header*>(p + l.nativeOffset);
+		if (hdr->Magic != Pire::Header::MAGIC || hdr->PtrSize != sizeof(void*) || hdr->MaxWordSize != sizeof(Impl::MaxSizeWord))
+			return false;
+		try {
+			scanner.Mmap(p + l.nativeOffset, l.nativeSize);
+			return true;
+		} catch (Error&) {
+			// Cannot use the native part for whatever reason; fall back to conversion
+			return false;
+		}
+	}
+
+	template<class Shortcutting>
+	static bool MmapNative(Scanner<Nonrelocatable, Shortcutting>&, const char*, const PortableLayout&)
+	{
+		return false;
+	}
+
+	template<class Relocation, class Shortcutting>
+	static void ConvertPortable(Scanner<Relocation, Shortcutting>& scanner, const PortableLayout& l)
+	{
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+
+		ScannerType s;
+		if (l.statesCount) {
+			s.m.relocationSignature = Relocation::Signature;
+			s.m.shortcuttingSignature = Shortcutting::Signature;
+			s.m.statesCount = l.statesCount;
+			s.m.lettersCount = l.lettersCount;
+			s.m.regexpsCount = l.regexpsCount;
+			s.m.finalTableSize = l.finalCount;
+			s.m_buffer = Impl::NewSharedBuffer(s.BufSize() + sizeof(size_t));
+			memset(s.m_buffer, 0, s.BufSize() + sizeof(size_t));
+			s.Markup(AlignUp(s.m_buffer, sizeof(size_t)));
+
+			for (size_t ch = 0; ch != MaxCharUnaligned; ++ch) {
+				ui32 letter = Impl::LoadLE16(l.letters + ch * 2);
+				if (letter == 0xFFFF)
+					continue;
+				if (letter >= l.lettersCount)
+					throw Error("Serialized Pire::Scanner is corrupted");
+				s.m_letters[ch] = letter + ScannerType::HEADER_SIZE;
+			}
+
+			for (size_t i = 0; i != l.finalCount; ++i) {
+				ui32 re = Impl::LoadLE32(l.final + i * 4);
+				if (re != PortableNone && re >= l.regexpsCount)
+					throw Error("Serialized Pire::Scanner is corrupted");
+				s.m_final[i] = (re == PortableNone) ? ScannerType::End : re;
+			}
+			if (s.m_final[l.finalCount - 1] != ScannerType::End)
+				throw Error("Serialized Pire::Scanner is corrupted");
+			s.m_finalEnd = s.m_final + l.finalCount;
+
+			for (size_t st = 0; st != l.statesCount; ++st) {
+				size_t idx = Impl::LoadLE32(l.finalIndex + st * 4);
+				if (idx >= l.finalCount)
+					throw Error("Serialized Pire::Scanner is corrupted");
+				s.m_finalIndex[st] = idx;
+
+				size_t state = s.IndexToState(st);
+				s.Header(state) = typename ScannerType::ScannerRowHeader();
+				s.Header(state).Common.Flags = Impl::LoadLE32(l.flags + st * 4);
+				typename ScannerType::Transition* row = reinterpret_cast<typename ScannerType::Transition*>(state);
+				const char* jumps = l.jumps + st * l.lettersCount * 4;
+				for (size_t let = 0; let != l.lettersCount; ++let) {
+					ui32 dest = Impl::LoadLE32(jumps + let * 4);
+					if (dest >= l.statesCount)
+						throw Error("Serialized Pire::Scanner is corrupted");
+					row[let + ScannerType::HEADER_SIZE] = Relocation::Diff(state, s.IndexToState(dest));
+				}
+			}
+			s.m.initial = s.IndexToState(l.initial);
+			s.BuildShortcuts();
+			s.BuildMasks();
+		}
+		scanner.Swap(s);
+	}
+
+	template<class Relocation, class Shortcutting>
+	static const void* MmapPortable(Scanner<Relocation, Shortcutting>& scanner, const void* ptr, size_t size)
+	{
+		const char* p = static_cast<const char*>(ptr);
+		PortableLayout l = ParsePortableHeader(p, size);
+		if (l.totalSize > size)
+			throw Error("EOF reached while mapping Pire::Scanner");
+		if (!MmapNative(scanner, p, l)) {
+			MarkupPortable(l, p);
+			ConvertPortable(scanner, l);
+		}
+		return p + l.totalSize;
+	}
+
+	template<class Relocation, class Shortcutting>
+	static void LoadPortable(Scanner<Relocation, Shortcutting>& scanner, yistream* s)
+	{
+		char hdr[PortableHeaderSize];
+		LoadPodArray(s, hdr, sizeof(hdr));
+		PortableLayout l = ParsePortableHeader(hdr, sizeof(hdr));
+		yvector<char> buf(l.totalSize);
+		memcpy(&buf[0], hdr, sizeof(hdr));
+		LoadPodArray(s, &buf[sizeof(hdr)], buf.size() - sizeof(hdr));
+		MarkupPortable(l, &buf[0]);
+		ConvertPortable(scanner, l);
+	}
+
+	/*
+	 * Compressed format: the same header, locals and emptiness flag as Save() writes
+	 * (with type 7 in the header), followed by
+	 *   letters, final and final index tables, exactly as Save() writes them;
+	 *   ui64 blockRows, blocksCount;
+	 *   ui64 blockEnd[blocksCount]         -- offsets of block ends, relative to the first block;
+	 *   blocks, each of blockRows transition rows (the last one can be shorter).
+	 * Jumps are stored as destination state indices, so equal rows of different states
+	 * are equal in the stream as well. Each row starts with a varint N:
+	 *   N > 0:  the row is a copy of the one N rows above it;
+	 *   N == 0: followed by varint K and K pairs of varints (cell position delta, value),
+	 *           listing cells which differ from the previous row (or from zeroes for
+	 *           the first row of a block).
+	 * Blocks do not refer to each other, so they can be decoded in parallel.
+	 */
+	static const size_t CompressedBlockRows = 1024;
+
+	template<class Shortcutting>
+	static bool IsJumpCell(const Scanner<Relocatable, Shortcutting>& scanner, size_t cell)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+		return cell >= ScannerType::HEADER_SIZE && cell < ScannerType::HEADER_SIZE + scanner.m.lettersCount;
+	}
+
+	template<class Shortcutting>
+	static void SaveCompressed(const Scanner<Relocatable, Shortcutting>& scanner, yostream* s)
 	{
 		typedef Scanner<Relocatable, Shortcutting> ScannerType;
 
 		typename ScannerType::Locals mc = scanner.m;
 		mc.initial -= reinterpret_cast<size_t>(scanner.m_transitions);
-		SavePodType(s, Pire::Header(1, sizeof(mc)));
+		SavePodType(s, Pire::Header(7, sizeof(mc)));
 		Impl::AlignSave(s, sizeof(Pire::Header));
 		SavePodType(s, mc);
 		Impl::AlignSave(s, sizeof(mc));
 		SavePodType(s, scanner.Empty());
 		Impl::AlignSave(s, sizeof(scanner.Empty()));
-		if (!scanner.Empty())
-			Impl::AlignedSaveArray(s, scanner.m_buffer, scanner.BufSize());
+		if (scanner.Empty())
+			return;
+
+		const char* tables = reinterpret_cast<const char*>(scanner.m_letters);
+		Impl::AlignedSaveArray(s, tables, reinterpret_cast<const char*>(scanner.m_transitions) - tables);
+
+		size_t rowSize = scanner.RowSize();
+		size_t blocksCount = (scanner.Size() + CompressedBlockRows - 1) / CompressedBlockRows;
+		yvector<char> data;
+		yvector<ui64> blockEnds;
+		yvector< yvector<ui32> > rows;
+		ymap<ui64, size_t> seen;
+		for (size_t block = 0; block != blocksCount; ++block) {
+			size_t first = block * CompressedBlockRows;
+			size_t last = ymin(first + CompressedBlockRows, scanner.Size());
+			rows.assign(1, yvector<ui32>(rowSize, 0)); // a zero row precedes every block
+			seen.clear();
+			for (size_t st = first; st != last; ++st) {
+				size_t state = scanner.IndexToState(st);
+				const typename ScannerType::Transition* row = reinterpret_cast<const typename ScannerType::Transition*>(state);
+				yvector<ui32> cur(row, row + rowSize);
+				ui64 hash = 14695981039346656037ULL;
+				for (size_t cell = 0; cell != rowSize; ++cell) {
+					if (IsJumpCell(scanner, cell))
+						cur[cell] = static_cast<ui32>(scanner.StateIndex(Relocatable::Go(state, row[cell])));
+					hash = (hash ^ cur[cell]) * 1099511628211ULL;
+				}
+
+				ymap<ui64, size_t>::iterator prev = seen.find(hash);
+				if (prev != seen.end() && rows[prev->second] == cur) {
+					Impl::AppendVarint(data, rows.size() - prev->second);
+				} else {
+					const yvector<ui32>& base = rows.back();
+					size_t diffs = 0;
+					for (size_t cell = 0; cell != rowSize; ++cell)
+						if (cur[cell] != base[cell])
+							++diffs;
+					Impl::AppendVarint(data, 0);
+					Impl::AppendVarint(data, diffs);
+					for (size_t cell = 0, pos = 0; cell != rowSize; ++cell) {
+						if (cur[cell] != base[cell]) {
+							Impl::AppendVarint(data, cell - pos);
+							Impl::AppendVarint(data, cur[cell]);
+							pos = cell + 1;
+						}
+					}
+				}
+				seen[hash] = rows.size();
+				rows.push_back(cur);
+			}
+			blockEnds.push_back(data.size());
+		}
+
+		SavePodType(s, static_cast<ui64>(CompressedBlockRows));
+		SavePodType(s, static_cast<ui64>(blocksCount));
+		SavePodArray(s, &blockEnds[0], blockEnds.size());
+		Impl::AlignedSaveArray(s, &data[0], data.size());
 	}
 
 	template<class Shortcutting>
-	static void LoadScanner(Scanner<Relocatable, Shortcutting>& scanner, yistream* s)
+	struct CompressedDecoder {
+		Scanner<Relocatable, Shortcutting>* Sc;
+		const char* Data;
+		const ui64* BlockEnds;
+		size_t BlockRows;
+
+		static void Decode(void* ctx, size_t block)
+		{
+			DecodeBlock(*static_cast<const CompressedDecoder*>(ctx), block);
+		}
+	};
+
+	template<class Shortcutting>
+	static void DecodeBlock(const CompressedDecoder<Shortcutting>& dec, size_t block)
+	{
+		typedef Scanner<Relocatable, Shortcutting> ScannerType;
+		typedef typename ScannerType::Transition Transition;
+
+		const ScannerType& sc = *dec.Sc;
+		const char* p = dec.Data + (block ? dec.BlockEnds[block - 1] : 0);
+		const char* end = dec.Data + dec.BlockEnds[block];
+		size_t first = block * dec.BlockRows;
+		size_t last = ymin(first + dec.BlockRows, sc.Size());
+		size_t rowSize = sc.RowSize();
+		yvector<ui32> cur(rowSize, 0);
+		for (size_t st = first; st != last; ++st) {
+			size_t state = sc.IndexToState(st);
+			Transition* row = reinterpret_cast<Transition*>(state);
+			ui64 ref = Impl::ReadVarint(p, end);
+			if (ref) {
+				if (ref > st - first)
+					throw Error("Compressed Pire::Scanner is corrupted");
+				size_t refState = sc.IndexToState(st - ref);
+				const Transition* refRow = reinterpret_cast<const Transition*>(refState);
+				for (size_t cell = 0; cell != rowSize; ++cell)
+					cur[cell] = IsJumpCell(sc, cell)
+						? static_cast<ui32>(sc.StateIndex(Relocatable::Go(refState, refRow[cell])))
+						: refRow[cell];
+			} else {
+				ui64 diffs = Impl::ReadVarint(p, end);
+				for (size_t pos = 0; diffs; --diffs) {
+					ui64 cell = pos + Impl::ReadVarint(p, end);
+					ui64 val = Impl::ReadVarint(p, end);
+					if (cell >= rowSize || val > static_cast<ui32>(-1) || (IsJumpCell(sc, cell) && val >= sc.Size()))
+						throw Error("Compressed Pire::Scanner is corrupted");
+					cur[cell] = static_cast<ui32>(val);
+					pos = cell + 1;
+				}
+			}
+			for (size_t cell = 0; cell != rowSize; ++cell)
+				row[cell] = IsJumpCell(sc, cell) ? Relocatable::Diff(state, sc.IndexToState(cur[cell])) : cur[cell];
+		}
+		if (p != end)
+			throw Error("Compressed Pire::Scanner is corrupted");
+	}
+
+	template<class Shortcutting>
+	static void LoadCompressed(Scanner<Relocatable, Shortcutting>& scanner, yistream* s, size_t threads)
 	{
 		typedef Scanner<Relocatable, Shortcutting> ScannerType;
 
 		Scanner<Relocatable, Shortcutting> sc;
-		Impl::ValidateHeader(s, 1, sizeof(sc.m));
+		Impl::ValidateHeader(s, 7, sizeof(sc.m));
 		LoadPodType(s, sc.m);
 		Impl::AlignLoad(s, sizeof(sc.m));
 		if (Shortcutting::Signature != sc.m.shortcuttingSignature)
@@ -580,14 +1545,40 @@ struct ScannerSaver {
 		bool empty;
 		LoadPodType(s, empty);
 		Impl::AlignLoad(s, sizeof(empty));
-		
+
 		if (empty) {
 			sc.Alias(ScannerType::Null());
 		} else {
-			sc.m_buffer = new char[sc.BufSize()];
-			Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
+			sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
+			memset(sc.m_buffer, 0, sc.BufSize());
 			sc.Markup(sc.m_buffer);
+			Impl::AlignedLoadArray(s, sc.m_buffer, reinterpret_cast<char*>(sc.m_transitions) - sc.m_buffer);
+			sc.Markup(sc.m_buffer); // now that the final table is loaded
+
+			ui64 blockRows, blocksCount;
+			LoadPodType(s, blockRows);
+			LoadPodType(s, blocksCount);
+			if (!sc.Size() || !blockRows || blocksCount != (sc.Size() + blockRows - 1) / blockRows)
+				throw Error("Compressed Pire::Scanner is corrupted");
+			yvector<ui64> blockEnds(blocksCount);
+			LoadPodArray(s, &blockEnds[0], blockEnds.size());
+			for (size_t i = 1; i < blockEnds.size(); ++i)
+				if (blockEnds[i] < blockEnds[i - 1])
+					throw Error("Compressed Pire::Scanner is corrupted");
+			yvector<char> data(blockEnds.back());
+			Impl::AlignedLoadArray(s, &data[0], data.size());
+
+			CompressedDecoder<Shortcutting> decoder;
+			decoder.Sc = &sc;
+			decoder.Data = &data[0];
+			decoder.BlockEnds = &blockEnds[0];
+			decoder.BlockRows = blockRows;
+			Impl::ParallelFor(blocksCount, threads, &CompressedDecoder<Shortcutting>::Decode, &decoder);
+
 			sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
+			// The mask table is not saved in this format; the final table it is built from has not been checked yet
+			CheckBounds(sc);
+			sc.BuildMasks();
 		}
 		scanner.Swap(sc);
 	}
@@ -608,6 +1599,38 @@ struct ScannerSaver {
 		rs.Load(s);
 		Scanner<Nonrelocatable, Shortcutting>(rs).Swap(scanner);
 	}
+
+	template<class Shortcutting>
+	static size_t SerializedSize(const Scanner<Nonrelocatable, Shortcutting>& scanner)
+	{
+		return Scanner<Relocatable, Shortcutting>(scanner).SerializedSize();
+	}
+
+	template<class Shortcutting>
+	static void* SaveTo(const Scanner<Nonrelocatable, Shortcutting>& scanner, void* buf)
+	{
+		return Scanner<Relocatable, Shortcutting>(scanner).SaveTo(buf);
+	}
+
+	template<class Shortcutting>
+	static void SaveToFd(const Scanner<Nonrelocatable, Shortcutting>& scanner, int fd)
+	{
+		Scanner<Relocatable, Shortcutting>(scanner).SaveToFd(fd);
+	}
+
+	template<class Shortcutting>
+	static void SaveCompressed(const Scanner<Nonrelocatable, Shortcutting>& scanner, yostream* s)
+	{
+		Scanner<Relocatable, Shortcutting>(scanner).SaveCompressed(s);
+	}
+
+	template<class Shortcutting>
+	static void LoadCompressed(Scanner<Nonrelocatable, Shortcutting>& scanner, yistream* s, size_t threads)
+	{
+		Scanner<Relocatable, Shortcutting> rs;
+		rs.LoadCompressed(s, threads);
+		Scanner<Nonrelocatable, Shortcutting>(rs).Swap(scanner);
+	}
 };
 
 
@@ -623,6 +1646,66 @@ void Scanner<Relocation, Shortcutting>::Load(yistream* s)
 	ScannerSaver::LoadScanner(*this, s);
 }
 
+template<class Relocation, class Shortcutting>
+size_t Scanner<Relocation, Shortcutting>::SerializedSize() const
+{
+	return ScannerSaver::SerializedSize(*this);
+}
+
+template<class Relocation, class Shortcutting>
+void* Scanner<Relocation, Shortcutting>::SaveTo(void* buf) const
+{
+	return ScannerSaver::SaveTo(*this, buf);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::SaveToFd(int fd) const
+{
+	ScannerSaver::SaveToFd(*this, fd);
+}
+
+template<class Relocation, class Shortcutting>
+typename Relocation::RetvalForMmap Scanner<Relocation, Shortcutting>::Mmap(const void* ptr, size_t size, MmapMode mode, BackgroundVerifier* verifier)
+{
+	return ScannerSaver::MmapScanner(*this, ptr, size, mode, verifier);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::WarmUp(const volatile bool* stop) const
+{
+	ScannerSaver::WarmUp(*this, stop);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::SavePortable(yostream* s, bool withNative) const
+{
+	ScannerSaver::SavePortable(*this, s, withNative);
+}
+
+template<class Relocation, class Shortcutting>
+const void* Scanner<Relocation, Shortcutting>::MmapPortable(const void* ptr, size_t size)
+{
+	return ScannerSaver::MmapPortable(*this, ptr, size);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::LoadPortable(yistream* s)
+{
+	ScannerSaver::LoadPortable(*this, s);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::SaveCompressed(yostream* s) const
+{
+	ScannerSaver::SaveCompressed(*this, s);
+}
+
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::LoadCompressed(yistream* s, size_t threads)
+{
+	ScannerSaver::LoadCompressed(*this, s, threads);
+}
+
 template<class Relocation, class Shortcutting>
 const Scanner<Relocation, Shortcutting>* Scanner<Relocation, Shortcutting>::m_null = &Null();
 
@@ -848,18 +1931,18 @@ struct NoShortcuts {
 
 	template <class Relocation>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoExit(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State)
+	bool NoExit(const Scanner<Relocation, NoShortcuts>& scanner, typename Scanner<Relocation, NoShortcuts>::State state)
 	{
-		// Cannot exit prematurely
-		return false;
+		// Only absorbing states can be left prematurely; the flag sits in the row being read anyway
+		return scanner.Absorbing(state);
 	}
 
 	template <class Relocation>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
-	bool NoShortcut(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State)
+	bool NoShortcut(const Scanner<Relocation, NoShortcuts>& scanner, typename Scanner<Relocation, NoShortcuts>::State state)
 	{
-		// There's no shortcut regardless of the state
-		return true;
+		// There's no shortcut, except for absorbing states, which need no scanning at all
+		return !scanner.Absorbing(state);
 	}
 
 	template <class Relocation>
@@ -1039,6 +2122,7 @@ public:
 	const Scanner& Success()
 	{
 		Sc().BuildShortcuts();
+		Sc().BuildMasks();
 		return Sc();
 	}
 	
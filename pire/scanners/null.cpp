@@ -3,11 +3,15 @@
 #include "simple.h"
 #include "slow.h"
 #include "loaded.h"
+#include "sheng.h"
+#include "stride2.h"
 
 namespace Pire {
 
 const SimpleScanner* SimpleScanner::m_null = &SimpleScanner::Null();
 const SlowScanner*   SlowScanner  ::m_null = &SlowScanner::Null();
 const LoadedScanner* LoadedScanner::m_null = &LoadedScanner::Null();
+const ShengScanner*  ShengScanner ::m_null = &ShengScanner::Null();
+const Stride2Scanner* Stride2Scanner::m_null = &Stride2Scanner::Null();
 
 }
@@ -0,0 +1,335 @@
+/*
+ * sheng.h -- the definition of the ShengScanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_SHENG_H
+#define PIRE_SCANNERS_SHENG_H
+
+#include <string.h>
+#include "common.h"
+#include "../stub/stl.h"
+#include "../stub/saveload.h"
+#include "../fsm.h"
+#include "../run.h"
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace Pire {
+
+/**
+ * A scanner for tiny automata (up to 16 states after minimization).
+ *
+ * For each character it keeps a 16-byte vector mapping every state
+ * to the next one, so a step is a single byte shuffle of that vector
+ * by the current state. With SSSE3 available, Run() keeps the state
+ * in a vector register all the time and the only memory access per byte
+ * is the (state-independent) load of the character's vector.
+ *
+ * The constructor throws if the automaton has too many states.
+ */
+class ShengScanner {
+public:
+	typedef ui8         Transition;
+	typedef ui16        Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+	typedef size_t      State;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 2
+	};
+
+	static const size_t MaxStates = 16;
+
+	ShengScanner() { Alias(Null()); }
+
+	explicit ShengScanner(Fsm& fsm);
+
+	ShengScanner(const ShengScanner& s): m(s.m)
+	{
+		if (!s.m_buffer) {
+			// Empty or mmap()-ed scanner, just copy pointers
+			Alias(s);
+		} else if (char* buf = Impl::ShareBuffer(s.m_buffer)) {
+			// In-memory scanner, share its tables
+			Alias(s);
+			m_buffer = buf;
+		} else {
+			m_buffer = Impl::NewSharedBuffer(BufSize());
+			memcpy(m_buffer, s.m_buffer, BufSize());
+			Markup(m_buffer);
+		}
+	}
+
+	void Swap(ShengScanner& s)
+	{
+		DoSwap(m_buffer, s.m_buffer);
+		DoSwap(m.statesCount, s.m.statesCount);
+		DoSwap(m.initial, s.m.initial);
+		DoSwap(m.finals, s.m.finals);
+		DoSwap(m.dead, s.m.dead);
+		DoSwap(m_next, s.m_next);
+	}
+
+	ShengScanner& operator = (const ShengScanner& s) { ShengScanner(s).Swap(*this); return *this; }
+
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	ShengScanner(ShengScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	ShengScanner& operator = (ShengScanner&& s) { Swap(s); return *this; }
+#endif
+
+	~ShengScanner()
+	{
+		Impl::ReleaseSharedBuffer(m_buffer);
+	}
+
+	size_t Size() const { return m.statesCount; }
+	bool Empty() const { return m_next == Null().m_next; }
+
+	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t LettersCount() const { return MaxChar; }
+
+	void Initialize(State& state) const { state = m.initial; }
+
+	Action Next(State& state, Char c) const
+	{
+		state = m_next[c * MaxStates + state];
+		return 0;
+	}
+
+	bool TakeAction(State&, Action) const { return false; }
+
+	bool Final(const State& state) const { return (m.finals >> state) & 1; }
+	bool Dead(const State& state) const { return (m.dead >> state) & 1; }
+	bool CanStop(const State& state) const { return Final(state); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		static const size_t accept[1] = { 0 };
+		return Final(state) ? ymake_pair(accept, accept + 1) : ymake_pair(accept, accept);
+	}
+
+	size_t StateIndex(State s) const { return s; }
+
+	/// Returns the vector of next states for the character
+	const Transition* Row(Char c) const { return m_next + c * MaxStates; }
+
+	/*
+	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
+	 * to unconsumed part of the buffer.
+	 */
+	const void* Mmap(const void* ptr, size_t size)
+	{
+		Impl::CheckAlign(ptr);
+		ShengScanner s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Impl::ValidateHeader(p, size, 9, sizeof(s.m));
+		const Locals* locals;
+		Impl::MapPtr(locals, 1, p, size);
+		memcpy(&s.m, locals, sizeof(s.m));
+		if (s.m.statesCount > MaxStates || s.m.initial >= MaxStates)
+			throw Error("Serialized Pire::ShengScanner is corrupted");
+
+		bool empty = *((const bool*) p);
+		Impl::AdvancePtr(p, size, sizeof(empty));
+		Impl::AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(Null());
+		else {
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::ShengScanner");
+			s.Markup(const_cast<size_t*>(p));
+			s.Validate();
+			Impl::AdvancePtr(p, size, s.BufSize());
+			Swap(s);
+		}
+		return Impl::AlignPtr(p, size);
+	}
+
+	void Save(yostream* s) const
+	{
+		SavePodType(s, Header(9, sizeof(m)));
+		Impl::AlignSave(s, sizeof(Header));
+		SavePodType(s, m);
+		Impl::AlignSave(s, sizeof(m));
+		SavePodType(s, Empty());
+		Impl::AlignSave(s, sizeof(Empty()));
+		if (!Empty())
+			Impl::AlignedSaveArray(s, m_next, BufSize());
+	}
+
+	void Load(yistream* s)
+	{
+		ShengScanner sc;
+		Impl::ValidateHeader(s, 9, sizeof(sc.m));
+		LoadPodType(s, sc.m);
+		Impl::AlignLoad(s, sizeof(sc.m));
+		if (sc.m.statesCount > MaxStates || sc.m.initial >= MaxStates)
+			throw Error("Serialized Pire::ShengScanner is corrupted");
+		bool empty;
+		LoadPodType(s, empty);
+		Impl::AlignLoad(s, sizeof(empty));
+		if (empty) {
+			sc.Alias(Null());
+		} else {
+			sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
+			sc.Markup(sc.m_buffer);
+			Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
+			sc.Validate();
+		}
+		Swap(sc);
+	}
+
+	// Returns the size of the memory buffer used (or required) by scanner.
+	size_t BufSize() const { return MaxChar * MaxStates * sizeof(Transition); }
+
+private:
+	struct Locals {
+		size_t statesCount;
+		size_t initial;
+		size_t finals; ///< A bitmask of final states
+		size_t dead;   ///< A bitmask of dead states
+	} m;
+
+	char* m_buffer;
+	const Transition* m_next;
+
+	// Only used to force Null() call during static initialization, when Null()::n can be
+	// initialized safely by compilers that don't support thread safe static local vars
+	// initialization
+	static const ShengScanner* m_null;
+
+	inline static const ShengScanner& Null()
+	{
+		static const ShengScanner n = Fsm::MakeFalse().Compile<ShengScanner>();
+		return n;
+	}
+
+	void Markup(void* buf) { m_next = reinterpret_cast<const Transition*>(buf); }
+
+	// Makes a shallow ("weak") copy of the given scanner.
+	// The copied scanner does not maintain lifetime of the original's entrails.
+	void Alias(const ShengScanner& s)
+	{
+		memcpy(&m, &s.m, sizeof(m));
+		m_buffer = 0;
+		m_next = s.m_next;
+	}
+
+	// Shuffles only look at the lower bits, so a state out of range would go unnoticed
+	void Validate() const
+	{
+		for (size_t i = 0; i != BufSize(); ++i)
+			if (m_next[i] >= MaxStates)
+				throw Error("Serialized Pire::ShengScanner is corrupted");
+	}
+};
+
+inline ShengScanner::ShengScanner(Fsm& fsm)
+{
+	fsm.Canonize();
+	if (fsm.Size() > MaxStates)
+		throw Error("Regexp is too large for Pire::ShengScanner");
+
+	m.statesCount = fsm.Size();
+	m.initial = fsm.Initial();
+	m.finals = 0;
+	m.dead = 0;
+	m_buffer = Impl::NewSharedBuffer(BufSize());
+	Markup(m_buffer);
+	Transition* next = reinterpret_cast<Transition*>(m_buffer);
+
+	// Missing transitions leave the state as is, just like in the SimpleScanner
+	for (size_t c = 0; c != MaxChar; ++c)
+		for (size_t state = 0; state != MaxStates; ++state)
+			next[c * MaxStates + state] = static_cast<Transition>(state);
+
+	yset<size_t> dead = fsm.DeadStates();
+	for (size_t state = 0; state != fsm.Size(); ++state) {
+		if (fsm.IsFinal(state))
+			m.finals |= static_cast<size_t>(1) << state;
+		if (dead.find(state) != dead.end())
+			m.dead |= static_cast<size_t>(1) << state;
+		for (Fsm::LettersTbl::ConstIterator lit = fsm.Letters().Begin(), lie = fsm.Letters().End(); lit != lie; ++lit) {
+			const Fsm::StatesSet& tos = fsm.Destinations(state, lit->first);
+			if (tos.empty())
+				continue;
+			YASSERT(tos.size() == 1);
+			for (yvector<Char>::const_iterator c = lit->second.second.begin(), ce = lit->second.second.end(); c != ce; ++c)
+				next[*c * MaxStates + state] = static_cast<Transition>(*tos.begin());
+		}
+	}
+}
+
+#if !defined(PIRE_DEBUG) && defined(__SSSE3__)
+
+namespace Impl {
+
+	/// Keeps the state in a vector register (all its bytes holding the state index)
+	/// while running through the aligned part of the input
+	template<>
+	struct AlignedRunner<ShengScanner> {
+		template<class Pred>
+		static inline PIRE_HOT_FUNCTION
+		Action RunAligned(const ShengScanner& scanner, ShengScanner::State& state, const size_t* begin, const size_t* end, Pred stop)
+		{
+			ShengScanner::State st = state;
+			Action ret = Continue;
+			for (; begin != end && (ret = RunChunk(scanner, st, begin, 0, sizeof(void*), stop)) == Continue; ++begin)
+				;
+			state = st;
+			return ret;
+		}
+
+		static inline PIRE_HOT_FUNCTION
+		Action RunAligned(const ShengScanner& scanner, ShengScanner::State& state, const size_t* begin, const size_t* end, RunPred<ShengScanner>)
+		{
+			__m128i st = _mm_set1_epi8(static_cast<char>(state));
+			for (; begin != end; ++begin) {
+				size_t chunk = ToLittleEndian(*begin);
+				for (size_t i = sizeof(chunk); i != 0; --i) {
+					const __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanner.Row(chunk & 0xFF)));
+					st = _mm_shuffle_epi8(row, st);
+					chunk >>= 8;
+				}
+			}
+			state = static_cast<ui8>(_mm_cvtsi128_si32(st));
+			return Continue;
+		}
+	};
+}
+
+#endif
+
+}
+
+#endif
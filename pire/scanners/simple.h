@@ -81,9 +81,12 @@ public:
 			// Empty or mmap()-ed scanner, just copy pointers
 			m_buffer = 0;
 			m_transitions = s.m_transitions;
+		} else if ((m_buffer = Impl::ShareBuffer(s.m_buffer)) != 0) {
+			// In-memory scanner, share its tables
+			m_transitions = s.m_transitions;
 		} else {
-			// In-memory scanner, perform deep copy
-			m_buffer = new char[BufSize()];
+			// Tables cannot be shared, perform deep copy
+			m_buffer = Impl::NewSharedBuffer(BufSize());
 			memcpy(m_buffer, s.m_buffer, BufSize());
 			Markup(m_buffer);
 
@@ -110,9 +113,19 @@ public:
 
 	SimpleScanner& operator = (const SimpleScanner& s) { SimpleScanner(s).Swap(*this); return *this; }
 
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	SimpleScanner(SimpleScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	SimpleScanner& operator = (SimpleScanner&& s) { Swap(s); return *this; }
+#endif
+
 	~SimpleScanner()
 	{
-		delete[] m_buffer;
+		Impl::ReleaseSharedBuffer(m_buffer);
 	}
 
 	/*
@@ -223,7 +236,7 @@ inline SimpleScanner::SimpleScanner(Fsm& fsm)
 	fsm.Canonize();
 	
 	m.statesCount = fsm.Size();
-	m_buffer = new char[BufSize()];
+	m_buffer = Impl::NewSharedBuffer(BufSize());
 	memset(m_buffer, 0, BufSize());
 	Markup(m_buffer);
 	m.initial = reinterpret_cast<size_t>(m_transitions + fsm.Initial() * STATE_ROW_SIZE + 1);
@@ -0,0 +1,119 @@
+/*
+ * slow.cpp -- gluing SlowScanners together
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "slow.h"
+
+namespace Pire {
+
+SlowScanner SlowScanner::Glue(const SlowScanner& a, const SlowScanner& b)
+{
+	yvector<SlowScanner> scanners;
+	scanners.push_back(a);
+	scanners.push_back(b);
+	return Glue(scanners);
+}
+
+SlowScanner SlowScanner::Glue(const yvector<SlowScanner>& scanners)
+{
+	yvector<const SlowScanner*> parts;
+	for (yvector<SlowScanner>::const_iterator i = scanners.begin(), ie = scanners.end(); i != ie; ++i)
+		if (!i->Empty())
+			parts.push_back(&*i);
+	if (parts.empty())
+		return SlowScanner();
+	if (parts.size() == 1)
+		return *parts.front();
+
+	SlowScanner sc;
+	sc.m_tables = new Tables;
+
+	// A letter of the glued scanner is a combination of letters of the parts
+	ymap<yvector<size_t>, size_t> letterIdx;
+	yvector< yvector<size_t> > letters;
+	sc.alloc(sc.m_letters, MaxChar);
+	for (size_t ch = 0; ch != MaxChar; ++ch) {
+		yvector<size_t> combined;
+		for (size_t i = 0; i != parts.size(); ++i)
+			combined.push_back(parts[i]->m_letters[ch]);
+		ymap<yvector<size_t>, size_t>::iterator it = letterIdx.find(combined);
+		if (it == letterIdx.end()) {
+			it = letterIdx.insert(ymake_pair(combined, letters.size())).first;
+			letters.push_back(combined);
+		}
+		sc.m_letters[ch] = it->second;
+	}
+
+	// State 0 is the new initial state, which takes all the transitions of the parts'
+	// initial ones; states of the parts follow it.
+	sc.m.start = 0;
+	sc.m.statesCount = 1;
+	sc.m.regexpsCount = 0;
+	for (size_t i = 0; i != parts.size(); ++i) {
+		sc.m.statesCount += parts[i]->m.statesCount;
+		sc.m.regexpsCount += parts[i]->m.regexpsCount;
+	}
+	sc.m.lettersCount = letters.size();
+	sc.m_tables->Vec.resize(sc.m.statesCount * sc.m.lettersCount);
+	sc.alloc(sc.m_finals, sc.m.statesCount);
+
+	yvector< yvector<size_t> > accept(sc.m.statesCount);
+	size_t base = 1;
+	size_t regexpBase = 0;
+	for (size_t i = 0; i != parts.size(); ++i) {
+		const SlowScanner& part = *parts[i];
+		for (size_t state = 0; state != part.m.statesCount; ++state) {
+			bool initial = (state == part.m.start);
+			for (size_t letter = 0; letter != sc.m.lettersCount; ++letter) {
+				const size_t* pos = part.m_jumpPos + state * part.m.lettersCount + letters[letter][i];
+				for (const unsigned* to = part.m_jumps + pos[0], *toEnd = part.m_jumps + pos[1]; to != toEnd; ++to) {
+					sc.m_tables->Vec[(base + state) * sc.m.lettersCount + letter].push_back(base + *to);
+					if (initial)
+						sc.m_tables->Vec[letter].push_back(base + *to);
+				}
+			}
+
+			for (const size_t* re = part.m_accept + part.m_acceptPos[state], *reEnd = part.m_accept + part.m_acceptPos[state + 1]; re != reEnd; ++re) {
+				accept[base + state].push_back(regexpBase + *re);
+				if (initial)
+					accept[0].push_back(regexpBase + *re);
+			}
+			sc.m_finals[base + state] = part.m_finals[state];
+			if (initial && part.m_finals[state])
+				sc.m_finals[0] = true;
+		}
+		base += part.m.statesCount;
+		regexpBase += part.m.regexpsCount;
+	}
+
+	sc.FlattenJumps();
+	sc.alloc(sc.m_acceptPos, sc.m.statesCount + 1);
+	for (size_t state = 0; state != sc.m.statesCount; ++state)
+		sc.m_acceptPos[state + 1] = sc.m_acceptPos[state] + accept[state].size();
+	sc.alloc(sc.m_accept, sc.m_acceptPos[sc.m.statesCount]);
+	for (size_t state = 0; state != sc.m.statesCount; ++state)
+		if (!accept[state].empty())
+			memcpy(sc.m_accept + sc.m_acceptPos[state], &accept[state][0], sizeof(*sc.m_accept) * accept[state].size());
+	return sc;
+}
+
+}
@@ -24,6 +24,7 @@
 #ifndef PIRE_SCANNERS_SLOW_H
 #define PIRE_SCANNERS_SLOW_H
 
+#include <algorithm>
 #include "common.h"
 #include "../stub/stl.h"
 #include "../partition.h"
@@ -59,17 +60,42 @@ public:
 		DeadFlag  = 0
 	};
 
+	/**
+	 * A set of NFA states. Holds two preallocated buffers: the current set
+	 * occupies one of them and the next one is built in the other, so stepping
+	 * never allocates. States are deduplicated by stamping them with
+	 * the number of the step they were added at.
+	 */
 	struct State {
-		yvector<unsigned> states;
-		BitSet flags;
-
-		State() {}
-		State(size_t size): flags(size) { states.reserve(size); }
-		void Swap(State& s) { states.swap(s.states); flags.Swap(s.flags); }
+		State(): offset(0), count(0), epoch(0) {}
+
+		const unsigned* Begin() const { return buffer.empty() ? 0 : &buffer[offset]; }
+		const unsigned* End() const { return Begin() + count; }
+		size_t Size() const { return count; }
+
+		void Swap(State& s)
+		{
+			buffer.swap(s.buffer);
+			stamps.swap(s.stamps);
+			DoSwap(offset, s.offset);
+			DoSwap(count, s.count);
+			DoSwap(epoch, s.epoch);
+			accepted.swap(s.accepted);
+		}
 
 #ifdef PIRE_DEBUG
-		friend yostream& operator << (yostream& stream, const State& state) { return stream << Join(state.states.begin(), state.states.end(), ", "); }
+		friend yostream& operator << (yostream& stream, const State& state) { return stream << Join(state.Begin(), state.End(), ", "); }
 #endif
+
+	private:
+		yvector<unsigned> buffer;
+		yvector<ui32> stamps;
+		size_t offset;
+		size_t count;
+		ui32 epoch;
+		mutable yvector<size_t> accepted; ///< Filled by AcceptedRegexps() of glued scanners
+
+		friend class SlowScanner;
 	};
 
 	SlowScanner() { Alias(Null()); }
@@ -77,14 +103,14 @@ public:
 	bool Empty() const { return m_finals == Null().m_finals; }
 	
 	size_t Id() const {return (size_t) -1;}
-	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t RegexpsCount() const { return Empty() ? 0 : m.regexpsCount; }
 
 	void Initialize(State& state) const
 	{
-		state.states.clear();
-		state.states.reserve(m.statesCount);
-		state.states.push_back(m.start);
-		BitSet(m.statesCount).Swap(state.flags);
+		Prepare(state);
+		state.offset = 0;
+		state.count = 1;
+		state.buffer[0] = m.start;
 	}
 
 	Char Translate(Char ch) const
@@ -94,30 +120,10 @@ public:
 
 	Action NextTranslated(const State& current, State& next, Char l) const
 	{
-		next.flags.Clear();
-		next.states.clear();
-		for (yvector<unsigned>::const_iterator sit = current.states.begin(), sie = current.states.end(); sit != sie; ++sit) {
-			const unsigned* begin = 0;
-			const unsigned* end = 0;
-			if (!m_vecptr) {
-				const size_t* pos = m_jumpPos + *sit * m.lettersCount + l;
-				begin = m_jumps + pos[0];
-				end = m_jumps + pos[1];
-			} else {
-				const yvector<unsigned>& v = (*m_vecptr)[*sit * m.lettersCount + l];
-				if (!v.empty()) {
-					begin = &v[0];
-					end = &v[0] + v.size();
-				}
-			}
-
-			for (; begin != end; ++begin)
-				if (!next.flags.Test(*begin)) {
-					next.flags.Set(*begin);
-					next.states.push_back(*begin);
-				}
-		}
-
+		Prepare(next);
+		ui32 epoch = NextEpoch(next);
+		next.offset = 0;
+		next.count = Follow(current.Begin(), current.End(), &next.buffer[0], &next.stamps[0], epoch, l);
 		return 0;
 	}
 
@@ -130,10 +136,11 @@ public:
 
 	Action NextTranslated(State& s, Char l) const
 	{
-		State dest(m.statesCount);
-		Action a = NextTranslated(s, dest, l);
-		s.Swap(dest);
-		return a;
+		ui32 epoch = NextEpoch(s);
+		size_t offset = m.statesCount - s.offset;
+		s.count = Follow(s.Begin(), s.End(), &s.buffer[offset], &s.stamps[0], epoch, l);
+		s.offset = offset;
+		return 0;
 	}
 
 	Action Next(State& s, Char c) const
@@ -143,7 +150,7 @@ public:
 
 	bool Final(const State& s) const
 	{
-		for (yvector<unsigned>::const_iterator it = s.states.begin(), ie = s.states.end(); it != ie; ++it)
+		for (const unsigned* it = s.Begin(), *ie = s.End(); it != ie; ++it)
 			if (m_finals[*it])
 				return true;
 		return false;
@@ -155,9 +162,33 @@ public:
 	}
 
 	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& s) const {
-		return Final(s) ? Accept() : Deny();
+		if (m.regexpsCount == 1)
+			return Final(s) ? Accept() : Deny();
+
+		s.accepted.clear();
+		for (const unsigned* it = s.Begin(), *ie = s.End(); it != ie; ++it)
+			if (m_finals[*it])
+				s.accepted.insert(s.accepted.end(), m_accept + m_acceptPos[*it], m_accept + m_acceptPos[*it + 1]);
+		if (s.accepted.empty())
+			return Deny();
+		std::sort(s.accepted.begin(), s.accepted.end());
+		s.accepted.erase(std::unique(s.accepted.begin(), s.accepted.end()), s.accepted.end());
+		return ymake_pair(&s.accepted[0], &s.accepted[0] + s.accepted.size());
 	}
 
+	/**
+	 * Combines two scanners into a single automaton, so a string can be checked
+	 * against all their regexps in one pass (use AcceptedRegexps() to find out
+	 * which of them have matched). Regexps of @p b are numbered after those of @p a.
+	 *
+	 * Unlike Scanner::Glue(), never fails: the result is just as large
+	 * as both scanners together.
+	 */
+	static SlowScanner Glue(const SlowScanner& a, const SlowScanner& b);
+
+	/// Same as above, but glues any number of scanners at once
+	static SlowScanner Glue(const yvector<SlowScanner>& scanners);
+
 	bool CanStop(const State& s) const {
 		return Final(s);
 	}
@@ -180,11 +211,12 @@ public:
 		if (empty)
 			s.Alias(Null());
 		else {
-			s.m_vecptr = 0;
 			Impl::MapPtr(s.m_letters, MaxChar, p, size);
 			Impl::MapPtr(s.m_finals, s.m.statesCount, p, size);
 			Impl::MapPtr(s.m_jumpPos, s.m.statesCount * s.m.lettersCount + 1, p, size);
 			Impl::MapPtr(s.m_jumps, s.m_jumpPos[s.m.statesCount * s.m.lettersCount], p, size);
+			Impl::MapPtr(s.m_acceptPos, s.m.statesCount + 1, p, size);
+			Impl::MapPtr(s.m_accept, s.m_acceptPos[s.m.statesCount], p, size);
 			
 			Swap(s);
 		}
@@ -199,37 +231,40 @@ public:
 		DoSwap(m.statesCount, s.m.statesCount);
 		DoSwap(m.lettersCount, s.m.lettersCount);
 		DoSwap(m.start, s.m.start);
+		DoSwap(m.regexpsCount, s.m.regexpsCount);
+		DoSwap(m_acceptPos, s.m_acceptPos);
+		DoSwap(m_accept, s.m_accept);
 		DoSwap(m_letters, s.m_letters);
-		DoSwap(m_pool, s.m_pool);
-		DoSwap(m_vec, s.m_vec);
-		
-		DoSwap(m_vecptr, s.m_vecptr);
-		if (m_vecptr == &s.m_vec)
-			m_vecptr = &m_vec;
-		if (s.m_vecptr == &m_vec)
-			s.m_vecptr = &s.m_vec;
+		DoSwap(m_tables, s.m_tables);
 	}
 
 	SlowScanner(const SlowScanner& s)
 		: m(s.m)
-		, m_vec(s.m_vec)
 	{
-		if (s.m_vec.empty()) {
+		if (!s.m_tables) {
 			// Empty or mmap()-ed scanner, just copy pointers
-			m_finals = s.m_finals;
-			m_jumps = s.m_jumps;
-			m_jumpPos = s.m_jumpPos;
-			m_letters = s.m_letters;
-			m_vecptr = 0;
+			Alias(s);
+		} else if (Impl::ShareTables) {
+			// In-memory scanner, share its tables
+			Alias(s);
+			m_tables = s.m_tables;
+			Impl::AddRef(m_tables->Refs);
 		} else {
-			// In-memory scanner, perform deep copy
+			// Tables cannot be shared, perform deep copy
+			m_tables = new Tables;
 			alloc(m_letters, MaxChar);
 			memcpy(m_letters, s.m_letters, sizeof(*m_letters) * MaxChar);
-			m_jumps = 0;
-			m_jumpPos = 0;
 			alloc(m_finals, m.statesCount);
 			memcpy(m_finals, s.m_finals, sizeof(*m_finals) * m.statesCount);
-			m_vecptr = &m_vec;
+			size_t jumpPosSize = m.statesCount * m.lettersCount + 1;
+			alloc(m_jumpPos, jumpPosSize);
+			memcpy(m_jumpPos, s.m_jumpPos, sizeof(*m_jumpPos) * jumpPosSize);
+			alloc(m_jumps, m_jumpPos[jumpPosSize - 1]);
+			memcpy(m_jumps, s.m_jumps, sizeof(*m_jumps) * m_jumpPos[jumpPosSize - 1]);
+			alloc(m_acceptPos, m.statesCount + 1);
+			memcpy(m_acceptPos, s.m_acceptPos, sizeof(*m_acceptPos) * (m.statesCount + 1));
+			alloc(m_accept, m_acceptPos[m.statesCount]);
+			memcpy(m_accept, s.m_accept, sizeof(*m_accept) * m_acceptPos[m.statesCount]);
 		}
 	}
 	
@@ -240,12 +275,11 @@ public:
 
 		m.statesCount = fsm.Size();
 		m.lettersCount = fsm.Letters().Size();
+		m.regexpsCount = 1;
 
-		m_vec.resize(m.statesCount * m.lettersCount);
-		m_vecptr = &m_vec;
+		m_tables = new Tables;
+		m_tables->Vec.resize(m.statesCount * m.lettersCount);
 		alloc(m_letters, MaxChar);
-		m_jumps = 0;
-		m_jumpPos = 0;
 		alloc(m_finals, m.statesCount);
 
 		// Build letter translation table
@@ -261,10 +295,20 @@ public:
 
 	SlowScanner& operator = (const SlowScanner& s) { SlowScanner(s).Swap(*this); return *this; }
 
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	SlowScanner(SlowScanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	SlowScanner& operator = (SlowScanner&& s) { Swap(s); return *this; }
+#endif
+
 	~SlowScanner()
 	{
-		for (yvector<void*>::const_iterator i = m_pool.begin(), ie = m_pool.end(); i != ie; ++i)
-			free(*i);
+		if (m_tables && Impl::Release(m_tables->Refs))
+			delete m_tables;
 	}
 
 	void Save(yostream*) const;
@@ -278,15 +322,31 @@ private:
 		size_t statesCount;
 		size_t lettersCount;
 		size_t start;
+		size_t regexpsCount;
 	} m;
 
 	bool* m_finals;
 	unsigned* m_jumps;
 	size_t* m_jumpPos;
 	size_t* m_letters;
+	size_t* m_acceptPos;
+	size_t* m_accept;     ///< Regexps accepted by each state are m_accept[m_acceptPos[state] .. m_acceptPos[state + 1])
+
+	// Tables of in-memory scanners, shared between copies
+	struct Tables {
+		size_t Refs;
+		yvector<void*> Pool;
+		yvector< yvector<unsigned> > Vec; ///< Transitions collected while building, flattened by FinishBuild()
+
+		Tables(): Refs(1) {}
+		~Tables()
+		{
+			for (yvector<void*>::const_iterator i = Pool.begin(), ie = Pool.end(); i != ie; ++i)
+				free(*i);
+		}
+	};
 
-	yvector<void*> m_pool;
-	yvector< yvector<unsigned> > m_vec, *m_vecptr;
+	Tables* m_tables; ///< Null for empty and mmap()-ed scanners
 
 	// Only used to force Null() call during static initialization, when Null()::n can be
 	// initialized safely by compilers that don't support thread safe static local vars
@@ -303,29 +363,29 @@ private:
 	{
 		p = static_cast<T*>(malloc(size * sizeof(T)));
 		memset(p, 0, size * sizeof(T));
-		m_pool.push_back(p);
+		m_tables->Pool.push_back(p);
 	}
 	
 	void Alias(const SlowScanner& s)
 	{		
 		memcpy(&m, &s.m, sizeof(m));
-		m_vec.clear();
+		m_tables = 0;
 		m_finals = s.m_finals;
 		m_jumps = s.m_jumps;
 		m_jumpPos = s.m_jumpPos;
 		m_letters = s.m_letters;
-		m_vecptr = s.m_vecptr;
-		m_pool.clear();
+		m_acceptPos = s.m_acceptPos;
+		m_accept = s.m_accept;
 	}
 	
 	void SetJump(size_t oldState, Char c, size_t newState, unsigned long /*payload*/)
 	{
-		YASSERT(!m_vec.empty());
+		YASSERT(m_tables);
 		YASSERT(oldState < m.statesCount);
 		YASSERT(newState < m.statesCount);
 
 		size_t idx = oldState * m.lettersCount + m_letters[c];
-		m_vec[idx].push_back(newState);
+		m_tables->Vec[idx].push_back(newState);
 	}
 
 	unsigned long RemapAction(unsigned long action) { return action; }
@@ -333,7 +393,64 @@ private:
 	void SetInitial(size_t state) { m.start = state; }
 	void SetTag(size_t state, ui8 tag) { m_finals[state] = (tag != 0); }
 	
-	void FinishBuild() {}
+	void FinishBuild()
+	{
+		FlattenJumps();
+		alloc(m_acceptPos, m.statesCount + 1);
+		for (size_t state = 0; state != m.statesCount; ++state)
+			m_acceptPos[state + 1] = m_acceptPos[state] + (m_finals[state] ? 1 : 0);
+		// Everything accepts the only regexp 0
+		alloc(m_accept, m_acceptPos[m.statesCount]);
+	}
+
+	void FlattenJumps()
+	{
+		yvector< yvector<unsigned> >& vec = m_tables->Vec;
+		alloc(m_jumpPos, vec.size() + 1);
+		for (size_t i = 0; i != vec.size(); ++i)
+			m_jumpPos[i + 1] = m_jumpPos[i] + vec[i].size();
+		alloc(m_jumps, m_jumpPos[vec.size()]);
+		for (size_t i = 0; i != vec.size(); ++i)
+			if (!vec[i].empty())
+				memcpy(m_jumps + m_jumpPos[i], &vec[i][0], sizeof(*m_jumps) * vec[i].size());
+		yvector< yvector<unsigned> >().swap(vec);
+	}
+
+	/// Makes room for all states in @p state, if it is not there yet
+	void Prepare(State& state) const
+	{
+		if (state.stamps.size() != m.statesCount) {
+			state.buffer.resize(2 * m.statesCount);
+			state.stamps.assign(m.statesCount, 0);
+			state.epoch = 0;
+		}
+	}
+
+	static ui32 NextEpoch(State& state)
+	{
+		if (PIRE_UNLIKELY(!++state.epoch)) {
+			Fill(state.stamps.begin(), state.stamps.end(), 0);
+			state.epoch = 1;
+		}
+		return state.epoch;
+	}
+
+	/// Writes the states following [begin, end) by the letter @p l into @p out, returns their count
+	size_t Follow(const unsigned* begin, const unsigned* end, unsigned* out, ui32* stamps, ui32 epoch, Char l) const
+	{
+		unsigned* o = out;
+		for (const unsigned* sit = begin; sit != end; ++sit) {
+			if (sit + 1 != end)
+				PIRE_PREFETCH(m_jumpPos + sit[1] * m.lettersCount + l);
+			const size_t* pos = m_jumpPos + *sit * m.lettersCount + l;
+			for (const unsigned* it = m_jumps + pos[0], *ie = m_jumps + pos[1]; it != ie; ++it)
+				if (stamps[*it] != epoch) {
+					stamps[*it] = epoch;
+					*o++ = *it;
+				}
+		}
+		return o - out;
+	}
 
 	static ypair<const size_t*, const size_t*> Accept()
 	{
@@ -351,27 +468,6 @@ private:
 	friend void BuildScanner<SlowScanner>(const Fsm&, SlowScanner&);
 };
 
-#ifndef PIRE_DEBUG	
-/// A specialization of Run(), since its state is much heavier than other ones
-/// and we thus want to avoid copying states.
-template<>
-inline void Run<SlowScanner>(const SlowScanner& scanner, SlowScanner::State& state, const char* begin, const char* end)
-{
-	SlowScanner::State temp;
-	scanner.Initialize(temp);
-
-	SlowScanner::State* src = &state;
-	SlowScanner::State* dest = &temp;
-
-	for (; begin != end; ++begin) {
-		scanner.Next(*src, *dest, static_cast<unsigned char>(*begin));
-		DoSwap(src, dest);
-	}
-	if (src != &state)
-		state = *src;
-}
-#endif
-
 }
 
 
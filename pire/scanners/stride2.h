@@ -0,0 +1,415 @@
+/*
+ * stride2.h -- the definition of the Stride2Scanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_STRIDE2_H
+#define PIRE_SCANNERS_STRIDE2_H
+
+#include <string.h>
+#include "common.h"
+#include "../stub/stl.h"
+#include "../stub/saveload.h"
+#include "../align.h"
+#include "../fsm.h"
+#include "../run.h"
+
+namespace Pire {
+
+/**
+ * A scanner which consumes two characters per transition.
+ *
+ * Besides the usual table indexed by letter classes, it keeps a table
+ * indexed by pairs of letter classes, which is only worth it if there are
+ * few of them. Run() over aligned memory uses the latter and thus has
+ * half as many dependent table lookups per string; other functions
+ * (and scanners whose pair table would exceed the memory budget
+ * given to the constructor) step one character at a time.
+ */
+class Stride2Scanner {
+public:
+	typedef ui32        Transition;
+	typedef ui16        Letter;
+	typedef ui32        Action;
+	typedef ui8         Tag;
+	typedef size_t      State;
+
+	enum {
+		FinalFlag = 1,
+		DeadFlag  = 2
+	};
+
+	/// The default limit on the size of the pair table, in bytes
+	static const size_t DefaultBudget = 4 << 20;
+
+	Stride2Scanner() { Alias(Null()); }
+
+	explicit Stride2Scanner(Fsm& fsm, size_t budget = DefaultBudget);
+
+	Stride2Scanner(const Stride2Scanner& s): m(s.m)
+	{
+		if (!s.m_buffer) {
+			// Empty or mmap()-ed scanner, just copy pointers
+			Alias(s);
+		} else if (char* buf = Impl::ShareBuffer(s.m_buffer)) {
+			// In-memory scanner, share its tables
+			Alias(s);
+			m_buffer = buf;
+		} else {
+			m_buffer = Impl::NewSharedBuffer(BufSize());
+			memcpy(m_buffer, s.m_buffer, BufSize());
+			Markup(m_buffer);
+		}
+	}
+
+	void Swap(Stride2Scanner& s)
+	{
+		DoSwap(m_buffer, s.m_buffer);
+		DoSwap(m.statesCount, s.m.statesCount);
+		DoSwap(m.lettersCount, s.m.lettersCount);
+		DoSwap(m.initial, s.m.initial);
+		DoSwap(m.pairs, s.m.pairs);
+		DoSwap(m_letters, s.m_letters);
+		DoSwap(m_flags, s.m_flags);
+		DoSwap(m_next, s.m_next);
+		DoSwap(m_pairs, s.m_pairs);
+	}
+
+	Stride2Scanner& operator = (const Stride2Scanner& s) { Stride2Scanner(s).Swap(*this); return *this; }
+
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	Stride2Scanner(Stride2Scanner&& s)
+	{
+		Alias(Null());
+		Swap(s);
+	}
+
+	Stride2Scanner& operator = (Stride2Scanner&& s) { Swap(s); return *this; }
+#endif
+
+	~Stride2Scanner()
+	{
+		Impl::ReleaseSharedBuffer(m_buffer);
+	}
+
+	size_t Size() const { return m.statesCount; }
+	bool Empty() const { return m_next == Null().m_next; }
+
+	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t LettersCount() const { return m.lettersCount; }
+
+	/// Whether the scanner has got the pair table
+	bool HasPairs() const { return m.pairs != 0; }
+
+	void Initialize(State& state) const { state = m.initial; }
+
+	Char Translate(Char ch) const
+	{
+		return static_cast<Char>(m_letters[static_cast<size_t>(ch)]);
+	}
+
+	Action NextTranslated(State& state, Char letter) const
+	{
+		state = m_next[state * m.lettersCount + letter];
+		return 0;
+	}
+
+	Action Next(State& state, Char c) const
+	{
+		return NextTranslated(state, Translate(c));
+	}
+
+	/// Handles two characters at once (the scanner must have the pair table)
+	Action Next(State& state, Char c1, Char c2) const
+	{
+		YASSERT(HasPairs());
+		size_t lettersSq = m.lettersCount * m.lettersCount;
+		state = m_pairs[state * lettersSq + Translate(c1) * m.lettersCount + Translate(c2)] / lettersSq;
+		return 0;
+	}
+
+	bool TakeAction(State&, Action) const { return false; }
+
+	bool Final(const State& state) const { return (m_flags[state] & FinalFlag) != 0; }
+	bool Dead(const State& state) const { return (m_flags[state] & DeadFlag) != 0; }
+	bool CanStop(const State& state) const { return Final(state); }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
+	{
+		static const size_t accept[1] = { 0 };
+		return Final(state) ? ymake_pair(accept, accept + 1) : ymake_pair(accept, accept);
+	}
+
+	size_t StateIndex(State s) const { return s; }
+
+	/*
+	 * Constructs the scanner from mmap()-ed memory range, returning a pointer
+	 * to unconsumed part of the buffer.
+	 */
+	const void* Mmap(const void* ptr, size_t size)
+	{
+		Impl::CheckAlign(ptr);
+		Stride2Scanner s;
+
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Impl::ValidateHeader(p, size, 10, sizeof(s.m));
+		const Locals* locals;
+		Impl::MapPtr(locals, 1, p, size);
+		memcpy(&s.m, locals, sizeof(s.m));
+
+		bool empty = *((const bool*) p);
+		Impl::AdvancePtr(p, size, sizeof(empty));
+		Impl::AlignPtr(p, size);
+
+		if (empty)
+			s.Alias(Null());
+		else {
+			s.ValidateLocals();
+			if (size < s.BufSize())
+				throw Error("EOF reached while mapping Pire::Stride2Scanner");
+			s.Markup(const_cast<size_t*>(p));
+			s.Validate();
+			Impl::AdvancePtr(p, size, s.BufSize());
+			Swap(s);
+		}
+		return Impl::AlignPtr(p, size);
+	}
+
+	void Save(yostream* s) const
+	{
+		SavePodType(s, Header(10, sizeof(m)));
+		Impl::AlignSave(s, sizeof(Header));
+		SavePodType(s, m);
+		Impl::AlignSave(s, sizeof(m));
+		SavePodType(s, Empty());
+		Impl::AlignSave(s, sizeof(Empty()));
+		if (!Empty())
+			Impl::AlignedSaveArray(s, reinterpret_cast<const char*>(m_letters), BufSize());
+	}
+
+	void Load(yistream* s)
+	{
+		Stride2Scanner sc;
+		Impl::ValidateHeader(s, 10, sizeof(sc.m));
+		LoadPodType(s, sc.m);
+		Impl::AlignLoad(s, sizeof(sc.m));
+		bool empty;
+		LoadPodType(s, empty);
+		Impl::AlignLoad(s, sizeof(empty));
+		if (empty) {
+			sc.Alias(Null());
+		} else {
+			sc.ValidateLocals();
+			sc.m_buffer = Impl::NewSharedBuffer(sc.BufSize());
+			sc.Markup(sc.m_buffer);
+			Impl::AlignedLoadArray(s, sc.m_buffer, sc.BufSize());
+			sc.Validate();
+		}
+		Swap(sc);
+	}
+
+	// Returns the size of the memory buffer used (or required) by scanner.
+	size_t BufSize() const
+	{
+		return MaxChar * sizeof(size_t)
+			+ m.statesCount * sizeof(size_t)
+			+ Impl::AlignUp(m.statesCount * m.lettersCount * sizeof(Transition), sizeof(size_t))
+			+ (m.pairs ? Impl::AlignUp(m.statesCount * m.lettersCount * m.lettersCount * sizeof(Transition), sizeof(size_t)) : 0);
+	}
+
+private:
+	struct Locals {
+		size_t statesCount;
+		size_t lettersCount;
+		size_t initial;
+		size_t pairs;
+	} m;
+
+	char* m_buffer;
+
+	const size_t* m_letters;
+	const size_t* m_flags;
+	const Transition* m_next;   ///< Indices of next states, by state and letter
+	const Transition* m_pairs;  ///< Offsets of next states' rows, by state and pair of letters
+
+	// Only used to force Null() call during static initialization, when Null()::n can be
+	// initialized safely by compilers that don't support thread safe static local vars
+	// initialization
+	static const Stride2Scanner* m_null;
+
+	inline static const Stride2Scanner& Null()
+	{
+		static const Stride2Scanner n = Fsm::MakeFalse().Compile<Stride2Scanner>();
+		return n;
+	}
+
+	void Markup(void* buf)
+	{
+		m_letters = reinterpret_cast<const size_t*>(buf);
+		m_flags = m_letters + MaxChar;
+		m_next = reinterpret_cast<const Transition*>(m_flags + m.statesCount);
+		m_pairs = m.pairs
+			? reinterpret_cast<const Transition*>(reinterpret_cast<const char*>(m_next)
+				+ Impl::AlignUp(m.statesCount * m.lettersCount * sizeof(Transition), sizeof(size_t)))
+			: 0;
+	}
+
+	// Makes a shallow ("weak") copy of the given scanner.
+	// The copied scanner does not maintain lifetime of the original's entrails.
+	void Alias(const Stride2Scanner& s)
+	{
+		memcpy(&m, &s.m, sizeof(m));
+		m_buffer = 0;
+		m_letters = s.m_letters;
+		m_flags = s.m_flags;
+		m_next = s.m_next;
+		m_pairs = s.m_pairs;
+	}
+
+	// Whether every cell of the table of the given width can be addressed by a Transition
+	static bool Fits(size_t statesCount, size_t width)
+	{
+		return statesCount <= static_cast<Transition>(-1) / width;
+	}
+
+	// Checks the sizes before they are used to compute BufSize()
+	void ValidateLocals() const
+	{
+		if (m.initial >= m.statesCount || m.lettersCount == 0 || m.lettersCount > MaxChar || m.pairs > 1
+			|| !Fits(m.statesCount, m.pairs ? m.lettersCount * m.lettersCount : m.lettersCount))
+			throw Error("Serialized Pire::Stride2Scanner is corrupted");
+	}
+
+	// Run() follows the tables without any checks, so every entry must point to a valid row
+	void Validate() const
+	{
+		for (size_t ch = 0; ch != MaxChar; ++ch)
+			if (m_letters[ch] >= m.lettersCount)
+				throw Error("Serialized Pire::Stride2Scanner is corrupted");
+		for (size_t i = 0, ie = m.statesCount * m.lettersCount; i != ie; ++i)
+			if (m_next[i] >= m.statesCount)
+				throw Error("Serialized Pire::Stride2Scanner is corrupted");
+		if (m_pairs) {
+			size_t lettersSq = m.lettersCount * m.lettersCount;
+			for (size_t i = 0, ie = m.statesCount * lettersSq; i != ie; ++i)
+				if (m_pairs[i] % lettersSq != 0 || m_pairs[i] / lettersSq >= m.statesCount)
+					throw Error("Serialized Pire::Stride2Scanner is corrupted");
+		}
+	}
+
+#ifndef PIRE_DEBUG
+	friend struct Impl::AlignedRunner<Stride2Scanner>;
+#endif
+};
+
+inline Stride2Scanner::Stride2Scanner(Fsm& fsm, size_t budget /* = DefaultBudget */)
+{
+	fsm.Canonize();
+
+	m.statesCount = fsm.Size();
+	m.lettersCount = fsm.Letters().Size();
+	m.initial = fsm.Initial();
+	size_t lettersSq = m.lettersCount * m.lettersCount;
+	if (!Fits(m.statesCount, m.lettersCount))
+		throw Error("Regexp is too large for Pire::Stride2Scanner");
+	// Offsets in the pair table must fit into a Transition as well
+	m.pairs = (Fits(m.statesCount, lettersSq) && m.statesCount * lettersSq * sizeof(Transition) <= budget) ? 1 : 0;
+	m_buffer = Impl::NewSharedBuffer(BufSize());
+	memset(m_buffer, 0, BufSize());
+	Markup(m_buffer);
+
+	size_t* letters = const_cast<size_t*>(m_letters);
+	size_t* flags = const_cast<size_t*>(m_flags);
+	Transition* next = const_cast<Transition*>(m_next);
+	Transition* pairs = const_cast<Transition*>(m_pairs);
+
+	yset<size_t> dead = fsm.DeadStates();
+	for (size_t state = 0; state != m.statesCount; ++state) {
+		flags[state] = (fsm.IsFinal(state) ? FinalFlag : 0) | (dead.find(state) != dead.end() ? DeadFlag : 0);
+		for (Fsm::LettersTbl::ConstIterator lit = fsm.Letters().Begin(), lie = fsm.Letters().End(); lit != lie; ++lit) {
+			const Fsm::StatesSet& tos = fsm.Destinations(state, lit->first);
+			YASSERT(tos.size() <= 1);
+			// Missing transitions leave the state as is, just like in the SimpleScanner
+			next[state * m.lettersCount + lit->second.first] = static_cast<Transition>(tos.empty() ? state : *tos.begin());
+		}
+	}
+	for (Fsm::LettersTbl::ConstIterator lit = fsm.Letters().Begin(), lie = fsm.Letters().End(); lit != lie; ++lit)
+		for (yvector<Char>::const_iterator it = lit->second.second.begin(), ie = lit->second.second.end(); it != ie; ++it)
+			letters[*it] = lit->second.first;
+
+	if (pairs)
+		for (size_t state = 0; state != m.statesCount; ++state)
+			for (size_t l1 = 0; l1 != m.lettersCount; ++l1) {
+				const Transition* row = next + next[state * m.lettersCount + l1] * m.lettersCount;
+				for (size_t l2 = 0; l2 != m.lettersCount; ++l2)
+					pairs[state * lettersSq + l1 * m.lettersCount + l2] = static_cast<Transition>(row[l2] * lettersSq);
+			}
+}
+
+#ifndef PIRE_DEBUG
+
+namespace Impl {
+
+	template<>
+	struct AlignedRunner<Stride2Scanner> {
+		template<class Pred>
+		static inline PIRE_HOT_FUNCTION
+		Action RunAligned(const Stride2Scanner& scanner, Stride2Scanner::State& state, const size_t* begin, const size_t* end, Pred stop)
+		{
+			Stride2Scanner::State st = state;
+			Action ret = Continue;
+			for (; begin != end && (ret = RunChunk(scanner, st, begin, 0, sizeof(void*), stop)) == Continue; ++begin)
+				;
+			state = st;
+			return ret;
+		}
+
+		/// Follows the pair table, keeping the offset of the current row rather than
+		/// the state index, so there is nothing but a load on the dependency chain
+		static inline PIRE_HOT_FUNCTION
+		Action RunAligned(const Stride2Scanner& scanner, Stride2Scanner::State& state, const size_t* begin, const size_t* end, RunPred<Stride2Scanner> pred)
+		{
+			if (!scanner.HasPairs())
+				return RunAligned< RunPred<Stride2Scanner> >(scanner, state, begin, end, pred);
+
+			const size_t* letters = scanner.m_letters;
+			const Stride2Scanner::Transition* pairs = scanner.m_pairs;
+			size_t lettersCount = scanner.m.lettersCount;
+			size_t lettersSq = lettersCount * lettersCount;
+			size_t row = state * lettersSq;
+			for (; begin != end; ++begin) {
+				size_t chunk = ToLittleEndian(*begin);
+				for (size_t i = sizeof(chunk) / 2; i != 0; --i) {
+					row = pairs[row + letters[chunk & 0xFF] * lettersCount + letters[(chunk >> 8) & 0xFF]];
+					chunk >>= 16;
+				}
+			}
+			state = row / lettersSq;
+			return Continue;
+		}
+	};
+}
+
+#endif
+
+}
+
+#endif
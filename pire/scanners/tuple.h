@@ -0,0 +1,172 @@
+/*
+ * tuple.h -- definition of the tuple of scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_TUPLE_H
+#define PIRE_SCANNERS_TUPLE_H
+
+#include "../defs.h"
+#include "../platform.h"
+#include "../stub/stl.h"
+
+#ifdef PIRE_HAVE_VARIADIC_TEMPLATES
+
+#include <tuple>
+
+namespace Pire {
+
+namespace Impl {
+
+	/// Applies scanner operations to the I-th and all the following scanners of a tuple
+	template<size_t I, size_t N>
+	struct ScannerTupleOps {
+		typedef ScannerTupleOps<I + 1, N> Rest;
+
+		template<class Scanners, class State>
+		static void Initialize(const Scanners& scanners, State& state)
+		{
+			std::get<I>(scanners)->Initialize(std::get<I>(state));
+			Rest::Initialize(scanners, state);
+		}
+
+		template<class Scanners, class State, class Action>
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		void Next(const Scanners& scanners, State& state, Action& action, Char ch)
+		{
+			std::get<I>(action) = std::get<I>(scanners)->Next(std::get<I>(state), ch);
+			Rest::Next(scanners, state, action, ch);
+		}
+
+		template<class Scanners, class State, class Action>
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		void TakeAction(const Scanners& scanners, State& state, const Action& action)
+		{
+			std::get<I>(scanners)->TakeAction(std::get<I>(state), std::get<I>(action));
+			Rest::TakeAction(scanners, state, action);
+		}
+
+		template<class Scanners, class State>
+		static bool Final(const Scanners& scanners, const State& state)
+		{
+			return std::get<I>(scanners)->Final(std::get<I>(state)) || Rest::Final(scanners, state);
+		}
+
+		template<class Scanners, class State>
+		static bool Dead(const Scanners& scanners, const State& state)
+		{
+			return std::get<I>(scanners)->Dead(std::get<I>(state)) && Rest::Dead(scanners, state);
+		}
+
+		template<class Scanners, class State>
+		static void StateIndex(const Scanners& scanners, const State& state, yvector<size_t>& index)
+		{
+			index.push_back(std::get<I>(scanners)->StateIndex(std::get<I>(state)));
+			Rest::StateIndex(scanners, state, index);
+		}
+	};
+
+	template<size_t N>
+	struct ScannerTupleOps<N, N> {
+		template<class Scanners, class State>
+		static void Initialize(const Scanners&, State&) {}
+
+		template<class Scanners, class State, class Action>
+		static PIRE_FORCED_INLINE void Next(const Scanners&, State&, Action&, Char) {}
+
+		template<class Scanners, class State, class Action>
+		static PIRE_FORCED_INLINE void TakeAction(const Scanners&, State&, const Action&) {}
+
+		template<class Scanners, class State>
+		static bool Final(const Scanners&, const State&) { return false; }
+
+		template<class Scanners, class State>
+		static bool Dead(const Scanners&, const State&) { return true; }
+
+		template<class Scanners, class State>
+		static void StateIndex(const Scanners&, const State&, yvector<size_t>&) {}
+	};
+}
+
+/**
+ * Any number of scanners of any kinds, providing the interface of a scanner itself,
+ * so they can be run over the same input in a single pass (each byte is fed
+ * to all of them in turn). A generalization of ScannerPair.
+ *
+ * The state is a std::tuple of the scanners' states; it is final if any of them is,
+ * and dead if all of them are, so LongestPrefix() and ShortestPrefix()
+ * stop as soon as no scanner can change its mind.
+ *
+ * The tuple only keeps pointers to the scanners, which must outlive it.
+ */
+template<class... Scanners>
+class ScannerTuple {
+public:
+	typedef std::tuple<typename Scanners::State...> State;
+	typedef std::tuple<typename Scanners::Action...> Action;
+
+	ScannerTuple(): m_scanners() {}
+	explicit ScannerTuple(const Scanners&... scanners): m_scanners(&scanners...) {}
+
+	void Initialize(State& state) const { Ops::Initialize(m_scanners, state); }
+
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action Next(State& state, Char ch) const
+	{
+		Action action;
+		Ops::Next(m_scanners, state, action, ch);
+		return action;
+	}
+
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	void TakeAction(State& state, const Action& action) const { Ops::TakeAction(m_scanners, state, action); }
+
+	bool Final(const State& state) const { return Ops::Final(m_scanners, state); }
+	bool Dead(const State& state) const { return Ops::Dead(m_scanners, state); }
+
+	yvector<size_t> StateIndex(const State& state) const
+	{
+		yvector<size_t> index;
+		Ops::StateIndex(m_scanners, state, index);
+		return index;
+	}
+
+	/// Returns the I-th scanner
+	template<size_t I>
+	const typename std::tuple_element<I, std::tuple<Scanners...> >::type& Get() const { return *std::get<I>(m_scanners); }
+
+private:
+	typedef Impl::ScannerTupleOps<0, sizeof...(Scanners)> Ops;
+
+	std::tuple<const Scanners*...> m_scanners;
+};
+
+template<class... Scanners>
+inline ScannerTuple<Scanners...> MakeScannerTuple(const Scanners&... scanners)
+{
+	return ScannerTuple<Scanners...>(scanners...);
+}
+
+}
+
+#endif
+
+#endif
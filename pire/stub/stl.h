@@ -233,6 +233,16 @@ namespace Pire {
 		return stream;
 	}
 
+	template <class T, class Stream>
+	Stream& operator << (Stream& stream, const yvector<T>& val)
+	{
+		stream << "[";
+		for (typename yvector<T>::const_iterator i = val.begin(), ie = val.end(); i != ie; ++i)
+			stream << (i == val.begin() ? "" : ", ") << *i;
+		stream << "]";
+		return stream;
+	}
+
 }
 
 #if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 6)
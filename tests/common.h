@@ -112,7 +112,7 @@ inline ystring DbgState(const Pire::SimpleScanner& scanner, Pire::SimpleScanner:
 */
 inline ystring DbgState(const Pire::SlowScanner& scanner, const Pire::SlowScanner::State& state)
 {
-	return ystring("(") + Join(state.states.begin(), state.states.end(), ", ") + ystring(")") + (scanner.Final(state) ? ystring(" [final]") : ystring());
+	return ystring("(") + Join(state.Begin(), state.End(), ", ") + ystring(")") + (scanner.Final(state) ? ystring(" [final]") : ystring());
 }
 
 template<class Scanner>
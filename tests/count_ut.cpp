@@ -145,6 +145,49 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		UNIT_ASSERT_EQUAL(st.Result(1), size_t(2));
 	}
 	
+#ifdef PIRE_HAVE_VARIADIC_TEMPLATES
+	SIMPLE_UNIT_TEST(CountInTuple)
+	{
+		const Pire::Encoding& enc = Pire::Encodings::Utf8();
+		Pire::CountingScanner counter(MkFsm("[a-z]+", enc), MkFsm(".*", enc));
+		Pire::Scanner glued = Pire::Scanner::Glue(
+			MkFsm("[0-9]+", enc).Surround().Compile<Pire::Scanner>(),
+			MkFsm("xyz", enc).Surround().Compile<Pire::Scanner>());
+		const char* captured = "d([a-z]+)g";
+		Pire::Lexer lexer;
+		lexer.Assign(captured, captured + strlen(captured));
+		lexer.AddFeature(Pire::Features::Capture(1));
+		Pire::Fsm fsm = lexer.Parse();
+		fsm.Surround();
+		fsm.Determine();
+		Pire::CapturingScanner capturer = fsm.Compile<Pire::CapturingScanner>();
+
+		typedef Pire::ScannerTuple<Pire::CountingScanner, Pire::Scanner, Pire::CapturingScanner> Tuple;
+		Tuple tuple(counter, glued, capturer);
+		const char* text = "abc defg 123 jklmn 4567 opqrst";
+		Tuple::State st;
+		tuple.Initialize(st);
+		Pire::Step(tuple, st, Pire::BeginMark);
+		Pire::Run(tuple, st, text, text + strlen(text));
+		Pire::Step(tuple, st, Pire::EndMark);
+
+		UNIT_ASSERT_EQUAL(std::get<0>(st).Result(0), Run(counter, text).Result(0));
+		UNIT_ASSERT_EQUAL(std::get<0>(st).Result(0), size_t(4));
+		UNIT_ASSERT(glued.Final(std::get<1>(st)));
+		ypair<const size_t*, const size_t*> accepted = glued.AcceptedRegexps(std::get<1>(st));
+		UNIT_ASSERT(accepted.second - accepted.first == 1 && *accepted.first == 0);
+		Pire::CapturingScanner::State capState;
+		capturer.Initialize(capState);
+		Pire::Step(capturer, capState, Pire::BeginMark);
+		Pire::Run(capturer, capState, text, text + strlen(text));
+		Pire::Step(capturer, capState, Pire::EndMark);
+		UNIT_ASSERT(std::get<2>(st).Captured());
+		UNIT_ASSERT_EQUAL(std::get<2>(st).Begin(), capState.Begin());
+		UNIT_ASSERT_EQUAL(std::get<2>(st).End(), capState.End());
+		UNIT_ASSERT(tuple.Final(st));
+	}
+#endif
+
 	SIMPLE_UNIT_TEST(CountBoundaries)
 	{
 		const Pire::Encoding& enc = Pire::Encodings::Utf8();
@@ -91,4 +91,19 @@ SIMPLE_UNIT_TEST(InlineGlue)
 	UNIT_ASSERT(!Matches2(sc, "xxx"));
 }
 
+SIMPLE_UNIT_TEST(InlineCompiled)
+{
+	Pire::CompiledScanner scanner = PIRE_REGEXP("http://([a-z0-9]+\\.)+[a-z]{2,4}/?", "isc");
+	UNIT_ASSERT(Matches(scanner, "http://domain.vasya.ru/"));
+	UNIT_ASSERT(Matches(scanner, "prefix http://domain.vasya.ru/"));
+	UNIT_ASSERT(!Matches(scanner, "http://127.0.0.1/"));
+	UNIT_ASSERT(Matches2(scanner, "http://domain.vasya.ru/"));
+
+	Pire::CompiledScanner sc = PIRE_REGEXP("foo", "c", "bar", "", "baz", "");
+	UNIT_ASSERT_EQUAL(sc.RegexpsCount(), size_t(3));
+	std::pair<const size_t*, const size_t*> p = sc.AcceptedRegexps(Pire::Runner(sc).Run("bar").State());
+	UNIT_ASSERT(std::distance(p.first, p.second) == 1 && *p.first == 1);
+	UNIT_ASSERT(!Matches2(sc, "xxx"));
+}
+
 }
@@ -27,7 +27,15 @@
 #include <stub/memstreams.h>
 #include "stub/cppunit.h"
 #include <stdexcept>
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
 #include "common.h"
+#ifdef PIRE_HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 SIMPLE_UNIT_TEST_SUITE(TestPire) {
 
@@ -435,6 +443,40 @@ SIMPLE_UNIT_TEST(Copying)
 	TestCopying<Pire::ScannerNoMask, Pire::NonrelocScannerNoMask>();
 }
 
+template <class Scanner>
+void TestSharedTables()
+{
+	Scanner* sc = new Scanner(ParseRegexp("^a[bc]+$", "").Compile<Scanner>());
+	Scanner copy(*sc);
+	Scanner assigned;
+	assigned = copy;
+	assigned = assigned;
+	delete sc;
+	// Copies keep the tables alive after the original is gone
+	UNIT_ASSERT(Matches(copy, "abcb"));
+	UNIT_ASSERT(!Matches(copy, "abd"));
+	UNIT_ASSERT(Matches(assigned, "acb"));
+
+#ifdef PIRE_HAVE_RVALUE_REFERENCES
+	Scanner moved(static_cast<Scanner&&>(copy));
+	UNIT_ASSERT(copy.Empty());
+	UNIT_ASSERT(Matches(moved, "abcb"));
+	assigned = Scanner();
+	UNIT_ASSERT(assigned.Empty());
+	assigned = static_cast<Scanner&&>(moved);
+	UNIT_ASSERT(Matches(assigned, "abcb"));
+#endif
+}
+
+SIMPLE_UNIT_TEST(SharedTables)
+{
+	TestSharedTables<Pire::Scanner>();
+	TestSharedTables<Pire::ScannerNoMask>();
+	TestSharedTables<Pire::NonrelocScanner>();
+	TestSharedTables<Pire::SimpleScanner>();
+	TestSharedTables<Pire::SlowScanner>();
+}
+
 SIMPLE_UNIT_TEST(Serialization)
 {
 	Scanners s("^regexp$");
@@ -612,6 +654,1022 @@ SIMPLE_UNIT_TEST(Glue)
 	TestGlue<Pire::NonrelocScannerNoMask>();
 }
 
+template<class Scanner>
+typename Scanner::State RunPrefix(const Scanner& scanner, const char* str)
+{
+	typename Scanner::State state;
+	scanner.Initialize(state);
+	Pire::Step(scanner, state, Pire::BeginMark);
+	Pire::Run(scanner, state, str, str + strlen(str));
+	return state;
+}
+
+template<class Scanner>
+void TestAbsorbing()
+{
+	Scanner sc = ParseRegexp("ab").Compile<Scanner>();
+	UNIT_ASSERT(!sc.Absorbing(RunPrefix(sc, "xxa")));
+	UNIT_ASSERT(sc.Absorbing(RunPrefix(sc, "xxab")));
+	UNIT_ASSERT(sc.Final(RunPrefix(sc, "xxabxx")));
+
+	sc = ParseRegexp("^ab$", "n").Compile<Scanner>();
+	UNIT_ASSERT(!sc.Absorbing(RunPrefix(sc, "a")));
+	UNIT_ASSERT(sc.Absorbing(RunPrefix(sc, "x")));
+	UNIT_ASSERT(sc.Dead(RunPrefix(sc, "x")));
+
+	// A multiregexp can only stop when every regexp is decided
+	Scanner glued = Scanner::Glue(ParseRegexp("ab").Compile<Scanner>(), ParseRegexp("cd").Compile<Scanner>());
+	UNIT_ASSERT(!glued.Absorbing(RunPrefix(glued, "xab")));
+	UNIT_ASSERT(glued.Absorbing(RunPrefix(glued, "xabcd")));
+	glued = Scanner::Glue(ParseRegexp("ab").Compile<Scanner>(), ParseRegexp("^cd", "n").Compile<Scanner>());
+	UNIT_ASSERT(!glued.Absorbing(RunPrefix(glued, "c")));
+	UNIT_ASSERT(glued.Absorbing(RunPrefix(glued, "xab")));
+
+	// The scan stops early, but the outcome is the same
+	ystring text = "...ab" + ystring(4096, '.');
+	UNIT_ASSERT(Matches(sc, "ab"));
+	UNIT_ASSERT(Matches(glued, text.c_str()));
+	UNIT_ASSERT_EQUAL(Pire::LongestPrefix(glued, text.c_str(), text.c_str() + text.size()), text.c_str() + text.size());
+	UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(glued, text.c_str(), text.c_str() + text.size()), text.c_str() + 5);
+}
+
+SIMPLE_UNIT_TEST(Absorbing)
+{
+	TestAbsorbing<Pire::Scanner>();
+	TestAbsorbing<Pire::NonrelocScanner>();
+	TestAbsorbing<Pire::ScannerNoMask>();
+	TestAbsorbing<Pire::NonrelocScannerNoMask>();
+}
+
+SIMPLE_UNIT_TEST(DropRegexps)
+{
+	Pire::Scanner glued = Pire::Scanner::Glue(
+		Pire::Scanner::Glue(ParseRegexp("aaa").Compile<Pire::Scanner>(), ParseRegexp("bbb").Compile<Pire::Scanner>()),
+		ParseRegexp("ccc").Compile<Pire::Scanner>());
+	Pire::Scanner dropped = glued.DropRegexps(1, 2);
+	UNIT_ASSERT_EQUAL(dropped.RegexpsCount(), size_t(2));
+
+	ypair<const size_t*, const size_t*> res = dropped.AcceptedRegexps(RunRegexp(dropped, "aaabbbccc"));
+	UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(2));
+	UNIT_ASSERT_EQUAL(res.first[0], size_t(0));
+	UNIT_ASSERT_EQUAL(res.first[1], size_t(1));
+	UNIT_ASSERT(!dropped.Final(RunRegexp(dropped, "bbb")));
+	UNIT_ASSERT(dropped.Final(RunRegexp(dropped, "ccc")));
+
+	// Nothing but the compacted lists is left in the final table
+	dropped = glued.DropRegexps(0, 2);
+	yvector<size_t> buf(dropped.SerializedSize() / sizeof(size_t) + 1);
+	dropped.SaveTo(&buf[0]);
+	Pire::Scanner mapped;
+	mapped.Mmap(&buf[0], dropped.SerializedSize(), Pire::MmapTrust);
+	res = mapped.AcceptedRegexps(RunRegexp(mapped, "aaabbbccc"));
+	UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(1));
+	UNIT_ASSERT_EQUAL(res.first[0], size_t(0));
+
+	UNIT_ASSERT(glued.DropRegexps(0, 3).Empty());
+}
+
+SIMPLE_UNIT_TEST(AcceptedMasks)
+{
+	// More than 64 regexps, so the masks take two words
+	Pire::Scanner glued;
+	for (size_t i = 0; i != 70; ++i) {
+		ystring re = "^" + ToString(i) + "x?$";
+		glued = Pire::Scanner::Glue(glued, ParseRegexp(re.c_str(), "n").Compile<Pire::Scanner>());
+	}
+	UNIT_ASSERT_EQUAL(glued.RegexpsCount(), size_t(70));
+
+	Pire::AcceptedRegexpsMasks<Pire::Scanner> masks(glued);
+	UNIT_ASSERT_EQUAL(masks.Words(), size_t(2));
+	UNIT_ASSERT(masks.Distinct() < glued.Size());
+
+	const char* strings[] = { "", "1", "12", "65", "7x", "69", "100", 0 };
+	for (const char** str = strings; *str; ++str) {
+		Pire::Scanner::State state = RunRegexp(glued, *str);
+		const Pire::ui64* mask = masks.Mask(state);
+		ypair<const size_t*, const size_t*> accepted = glued.AcceptedRegexps(state);
+		size_t bits = 0;
+		for (size_t i = 0; i != masks.Words(); ++i)
+			for (Pire::ui64 word = mask[i]; word; word &= word - 1)
+				++bits;
+		UNIT_ASSERT_EQUAL(bits, size_t(accepted.second - accepted.first));
+		for (; accepted.first != accepted.second; ++accepted.first)
+			UNIT_ASSERT(masks.Accepts(state, *accepted.first));
+	}
+	UNIT_ASSERT(masks.Accepts(RunRegexp(glued, "65"), 65));
+	UNIT_ASSERT(!masks.Accepts(RunRegexp(glued, "65"), 6));
+	UNIT_ASSERT(masks.Accepts(RunRegexp(glued, "7x"), 7));
+	UNIT_ASSERT(masks.Mask(RunRegexp(glued, "")) == masks.Mask(RunRegexp(glued, "100")));
+
+	// Scanners without a mask table of their own get one built
+	Pire::JitScanner jit(glued, false);
+	Pire::AcceptedRegexpsMasks<Pire::JitScanner> jitMasks(jit);
+	UNIT_ASSERT_EQUAL(jitMasks.Words(), masks.Words());
+	for (const char** str = strings; *str; ++str)
+		UNIT_ASSERT(!memcmp(jitMasks.Mask(RunRegexp(jit, *str)), masks.Mask(RunRegexp(glued, *str)), masks.Words() * sizeof(Pire::ui64)));
+
+	// The table is saved along with the scanner and mmap()-ed right from the image
+	BufferOutput buf;
+	glued.Save(&buf);
+	size_t size = buf.Buffer().Size();
+	yvector<size_t> data(size / sizeof(size_t) + 1);
+	char* begin = reinterpret_cast<char*>(&data[0]);
+	memcpy(begin, buf.Buffer().Data(), size);
+	size_t masksOffset = size - glued.MasksBufSize();
+	size_t checksumsOffset = masksOffset - Pire::Impl::AlignUp(6 * sizeof(Pire::ui32), sizeof(size_t));
+
+	Pire::Scanner mapped;
+	mapped.Mmap(begin, size, Pire::MmapVerify);
+	MemoryInput in(begin, size);
+	Pire::Scanner loaded;
+	loaded.Load(&in);
+	UNIT_ASSERT_EQUAL(mapped.DistinctMasks(), glued.DistinctMasks());
+	for (const char** str = strings; *str; ++str) {
+		const Pire::ui64* mask = masks.Mask(RunRegexp(glued, *str));
+		const char* mappedMask = reinterpret_cast<const char*>(mapped.AcceptedMask(RunRegexp(mapped, *str)));
+		UNIT_ASSERT(mappedMask >= begin + masksOffset && mappedMask < begin + size);
+		UNIT_ASSERT(!memcmp(mappedMask, mask, masks.Words() * sizeof(Pire::ui64)));
+		UNIT_ASSERT(!memcmp(loaded.AcceptedMask(RunRegexp(loaded, *str)), mask, masks.Words() * sizeof(Pire::ui64)));
+	}
+
+	// Scanners saved before the table was introduced get it built when loaded
+	yvector<size_t> old(data.begin(), data.begin() + masksOffset / sizeof(size_t));
+	char* oldBegin = reinterpret_cast<char*>(&old[0]);
+	reinterpret_cast<Pire::Header*>(oldBegin)->Version = Pire::Header::RE_VERSION_WITH_CHECKSUMS;
+	memset(oldBegin + checksumsOffset + 5 * sizeof(Pire::ui32), 0, sizeof(Pire::ui32));
+	Pire::Scanner oldMapped;
+	UNIT_ASSERT_EQUAL(oldMapped.Mmap(oldBegin, masksOffset, Pire::MmapVerify), (const void*) (oldBegin + masksOffset));
+	MemoryInput oldIn(oldBegin, masksOffset);
+	Pire::Scanner oldLoaded;
+	oldLoaded.Load(&oldIn);
+	Pire::Scanner oldCopy = oldMapped;
+	oldMapped = Pire::Scanner();
+	for (const char** str = strings; *str; ++str) {
+		const Pire::ui64* mask = masks.Mask(RunRegexp(glued, *str));
+		UNIT_ASSERT(!memcmp(oldCopy.AcceptedMask(RunRegexp(oldCopy, *str)), mask, masks.Words() * sizeof(Pire::ui64)));
+		UNIT_ASSERT(!memcmp(oldLoaded.AcceptedMask(RunRegexp(oldLoaded, *str)), mask, masks.Words() * sizeof(Pire::ui64)));
+	}
+
+	// Offsets pointing outside the table are detected
+	reinterpret_cast<Pire::ui32*>(begin + masksOffset + 2 * sizeof(size_t))[glued.Size() - 1] = 0x7FFFFFFF;
+	try {
+		mapped.Mmap(begin, size, Pire::MmapTrust);
+		UNIT_ASSERT(!"Should report corrupted mask table");
+	}
+	catch (Pire::Error&) {}
+	try {
+		mapped.Mmap(begin, size, Pire::MmapVerify);
+		UNIT_ASSERT(!"Should report checksum mismatch");
+	}
+	catch (Pire::Error&) {}
+}
+
+SIMPLE_UNIT_TEST(GlueTree)
+{
+	const char* regexps[] = { "aaa", "bbb", "ccc", "ddd", "eee" };
+	yvector<Pire::Scanner> scanners;
+	for (size_t i = 0; i != sizeof(regexps) / sizeof(*regexps); ++i)
+		scanners.push_back(ParseRegexp(regexps[i]).Compile<Pire::Scanner>());
+
+	Pire::GlueTree<Pire::Scanner> tree(scanners.begin(), scanners.end());
+	UNIT_ASSERT_EQUAL(tree.Size(), size_t(5));
+	UNIT_ASSERT_EQUAL(tree.Result().RegexpsCount(), size_t(5));
+
+	ypair<const size_t*, const size_t*> res = tree.Result().AcceptedRegexps(RunRegexp(tree.Result(), "xxeeexx"));
+	UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(1));
+	UNIT_ASSERT_EQUAL(tree.Locate(*res.first).first, size_t(4));
+
+	tree.Remove(1);
+	UNIT_ASSERT_EQUAL(tree.Result().RegexpsCount(), size_t(4));
+	UNIT_ASSERT(!tree.Result().Final(RunRegexp(tree.Result(), "bbb")));
+	res = tree.Result().AcceptedRegexps(RunRegexp(tree.Result(), "cccddd"));
+	UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(2));
+	UNIT_ASSERT_EQUAL(tree.Locate(res.first[0]).first, size_t(2));
+	UNIT_ASSERT_EQUAL(tree.Locate(res.first[1]).first, size_t(3));
+
+	size_t handle = tree.Add(ParseRegexp("fff").Compile<Pire::Scanner>());
+	size_t handle2 = tree.Add(ParseRegexp("ggg").Compile<Pire::Scanner>());
+	UNIT_ASSERT(handle != handle2);
+	UNIT_ASSERT_EQUAL(tree.Size(), size_t(6));
+	res = tree.Result().AcceptedRegexps(RunRegexp(tree.Result(), "aaafffggg"));
+	UNIT_ASSERT_EQUAL(res.second - res.first, ssize_t(3));
+	yset<size_t> owners;
+	for (; res.first != res.second; ++res.first)
+		owners.insert(tree.Locate(*res.first).first);
+	UNIT_ASSERT_EQUAL(owners.size(), size_t(3));
+	UNIT_ASSERT(owners.find(0) != owners.end());
+	UNIT_ASSERT(owners.find(handle) != owners.end());
+	UNIT_ASSERT(owners.find(handle2) != owners.end());
+
+	Pire::GlueTree<Pire::Scanner> incremental;
+	for (size_t i = 0; i != scanners.size(); ++i)
+		UNIT_ASSERT_EQUAL(incremental.Add(scanners[i]), i);
+	UNIT_ASSERT_EQUAL(incremental.Result().RegexpsCount(), size_t(5));
+	UNIT_ASSERT(incremental.Result().Final(RunRegexp(incremental.Result(), "ddd")));
+
+	// Empty components can be removed just like any others
+	size_t empty = incremental.Add(Pire::Scanner());
+	UNIT_ASSERT_EQUAL(incremental.Size(), size_t(6));
+	incremental.Remove(empty);
+	UNIT_ASSERT_EQUAL(incremental.Size(), size_t(5));
+	UNIT_ASSERT_EQUAL(incremental.Result().RegexpsCount(), size_t(5));
+	try {
+		incremental.Remove(empty);
+		UNIT_ASSERT(!"Should report no such component");
+	}
+	catch (Pire::Error&) {}
+	UNIT_ASSERT_EQUAL(incremental.Add(scanners[0]), empty);
+
+	Pire::GlueTree<Pire::Scanner> limited(1);
+	limited.Add(scanners[0]);
+	bool thrown = false;
+	try {
+		limited.Add(scanners[1]);
+	} catch (Pire::Error&) {
+		thrown = true;
+	}
+	UNIT_ASSERT(thrown);
+	UNIT_ASSERT_EQUAL(limited.Size(), size_t(1));
+	UNIT_ASSERT_EQUAL(limited.Result().RegexpsCount(), size_t(1));
+}
+
+class CancellingProgress: public Pire::CompileProgress {
+public:
+	CancellingProgress(Pire::CompileBudget& budget): m_budget(&budget), m_calls(0) {}
+	void Progress(Stage, size_t, size_t) { ++m_calls; m_budget->Cancel(); }
+	size_t Calls() const { return m_calls; }
+private:
+	Pire::CompileBudget* m_budget;
+	size_t m_calls;
+};
+
+template<class Func>
+Pire::BudgetExceeded::Reason BudgetFailure(Pire::CompileBudget& budget, Func func)
+{
+	Pire::CompileBudget::Scope scope(&budget);
+	try {
+		func();
+	} catch (Pire::BudgetExceeded& e) {
+		return e.GetReason();
+	}
+	UNIT_ASSERT(!"BudgetExceeded expected");
+	return Pire::BudgetExceeded::Cancelled;
+}
+
+#ifdef PIRE_HAVE_PTHREAD_H
+// Cancels the budget from another thread as soon as the compilation reports progress
+class CancellingThread: public Pire::CompileProgress {
+public:
+	CancellingThread(Pire::CompileBudget& budget): m_budget(&budget), m_started(false) {}
+	void Progress(Stage, size_t, size_t) { m_started = true; }
+
+	static void* Run(void* p)
+	{
+		CancellingThread* self = static_cast<CancellingThread*>(p);
+		while (!self->m_started)
+			usleep(100);
+		self->m_budget->Cancel();
+		return 0;
+	}
+private:
+	Pire::CompileBudget* m_budget;
+	volatile bool m_started;
+};
+#endif
+
+void ParseAndCompile(const char* regexp) { ParseRegexp(regexp).Compile<Pire::Scanner>(); }
+void DetermineExploding() { ParseAndCompile("a.{20}b"); }
+void ParseRepetition() { ParseRegexp("(abcdefgh){300}", "n"); }
+void GlueMany()
+{
+	Pire::Scanner glued;
+	for (char c = 'a'; c != 'q'; ++c) {
+		const char re[] = { c, '.', '*', c, 0 };
+		glued = Pire::Scanner::Glue(glued, ParseRegexp(re).Compile<Pire::Scanner>());
+	}
+}
+
+SIMPLE_UNIT_TEST(Budget)
+{
+	{
+		Pire::CompileBudget budget;
+		budget.Cancel();
+		Pire::Lexer lexer("abc");
+		lexer.SetBudget(&budget);
+		bool thrown = false;
+		try {
+			lexer.Parse();
+		} catch (Pire::BudgetExceeded& e) {
+			thrown = true;
+			UNIT_ASSERT_EQUAL(e.GetReason(), Pire::BudgetExceeded::Cancelled);
+		}
+		UNIT_ASSERT(thrown);
+	}
+	{
+		Pire::CompileBudget budget;
+		budget.SetMemoryLimit(128 << 10);
+		UNIT_ASSERT_EQUAL(BudgetFailure(budget, DetermineExploding), Pire::BudgetExceeded::MemoryLimit);
+		UNIT_ASSERT_EQUAL(BudgetFailure(budget, ParseRepetition), Pire::BudgetExceeded::MemoryLimit);
+
+		// Budgets must not affect anything outside of their scope
+		ParseRepetition();
+	}
+	{
+		Pire::CompileBudget budget;
+		budget.SetMemoryLimit(1 << 20);
+		UNIT_ASSERT_EQUAL(BudgetFailure(budget, GlueMany), Pire::BudgetExceeded::MemoryLimit);
+	}
+	{
+		Pire::CompileBudget budget;
+		CancellingProgress progress(budget);
+		budget.SetProgress(&progress);
+		UNIT_ASSERT_EQUAL(BudgetFailure(budget, DetermineExploding), Pire::BudgetExceeded::Cancelled);
+		UNIT_ASSERT_EQUAL(progress.Calls(), size_t(1));
+	}
+	{
+		Pire::CompileBudget budget;
+		budget.SetTimeLimit(1).SetMemoryLimit(256 << 20);
+		UNIT_ASSERT_EQUAL(BudgetFailure(budget, DetermineExploding), Pire::BudgetExceeded::TimeLimit);
+	}
+#ifdef PIRE_HAVE_PTHREAD_H
+	{
+		Pire::CompileBudget budget;
+		CancellingThread canceller(budget);
+		budget.SetProgress(&canceller).SetMemoryLimit(256 << 20);
+		pthread_t thread;
+		UNIT_ASSERT(!pthread_create(&thread, 0, &CancellingThread::Run, &canceller));
+		Pire::BudgetExceeded::Reason reason = BudgetFailure(budget, DetermineExploding);
+		pthread_join(thread, 0);
+		UNIT_ASSERT_EQUAL(reason, Pire::BudgetExceeded::Cancelled);
+	}
+#endif
+	{
+		Pire::CompileBudget budget;
+		budget.SetTimeLimit(60 * 1000).SetMemoryLimit(64 << 20);
+		Pire::CompileBudget::Scope scope(&budget);
+		Pire::Scanner sc = ParseRegexp("ab+c").Compile<Pire::Scanner>();
+		UNIT_ASSERT(Matches(sc, "xxabbbcxx"));
+	}
+}
+
+SIMPLE_UNIT_TEST(Analysis)
+{
+	UNIT_ASSERT_EQUAL(Pire::Analysis::ForkDepth(ParseRegexp("abc")), size_t(1));
+	UNIT_ASSERT_EQUAL(Pire::Analysis::ForkDepth(ParseRegexp("a.{10}b")), size_t(11));
+
+	Pire::Analysis::SizeEstimate est = Pire::Analysis::DeterminedSize(ParseRegexp("a.{20}b"), 1000);
+	UNIT_ASSERT(!est.exact);
+	UNIT_ASSERT(est.states > 1000);
+	UNIT_ASSERT(!Pire::Analysis::DeterminedSize(ParseRegexp("a.{20}b"), 1000, Pire::Analysis::Exact).exact);
+	est = Pire::Analysis::DeterminedSize(ParseRegexp("abc"), 1000, Pire::Analysis::Exact);
+	UNIT_ASSERT(est.exact);
+	UNIT_ASSERT_EQUAL(est.states, ParseRegexp("abc").Compile<Pire::Scanner>().Size());
+	est = Pire::Analysis::DeterminedSize(ParseRegexp("abc"), 1000);
+	UNIT_ASSERT(est.exact);
+	UNIT_ASSERT(est.states >= ParseRegexp("abc").Compile<Pire::Scanner>().Size());
+	est = Pire::Analysis::DeterminedSize(ParseRegexp("a.{5}b"), 1000);
+	UNIT_ASSERT(est.exact);
+	UNIT_ASSERT(est.states >= ParseRegexp("a.{5}b").Compile<Pire::Scanner>().Size());
+
+	Pire::Scanner sc1 = ParseRegexp("a.*b").Compile<Pire::Scanner>();
+	Pire::Scanner sc2 = ParseRegexp("c.*d").Compile<Pire::Scanner>();
+	est = Pire::Analysis::GluedSize(sc1, sc2, 1000);
+	UNIT_ASSERT(est.exact);
+	UNIT_ASSERT_EQUAL(est.states, Pire::Scanner::Glue(sc1, sc2).Size());
+	UNIT_ASSERT(!Pire::Analysis::GluedSize(sc1, sc2, 2).exact);
+
+	yvector<Pire::Fsm> patterns;
+	patterns.push_back(ParseRegexp("abc"));
+	patterns.push_back(ParseRegexp("a.{20}b"));
+	patterns.push_back(ParseRegexp("x.{5}y"));
+	patterns.push_back(ParseRegexp("z.{5}w"));
+	patterns.push_back(ParseRegexp("def"));
+
+	Pire::Analysis::Report exact = Pire::Analysis::Analyze(patterns, 1000, Pire::Analysis::Exact);
+	Pire::Analysis::Report report = Pire::Analysis::Analyze(patterns, 1000);
+	UNIT_ASSERT_EQUAL(report.patterns.size(), size_t(5));
+	UNIT_ASSERT_EQUAL(report.patterns[1].verdict, Pire::Analysis::PatternReport::Rewrite);
+	UNIT_ASSERT_EQUAL(report.Culprits().front(), size_t(1));
+	UNIT_ASSERT_EQUAL(report.patterns[3].verdict, Pire::Analysis::PatternReport::NewShard);
+	UNIT_ASSERT_EQUAL(report.shards.size(), size_t(2));
+	UNIT_ASSERT_EQUAL(report.shards, exact.shards);
+	for (size_t i = 0; i != patterns.size(); ++i) {
+		UNIT_ASSERT_EQUAL(report.patterns[i].verdict, exact.patterns[i].verdict);
+		UNIT_ASSERT(report.patterns[i].size.states >= exact.patterns[i].size.states);
+		UNIT_ASSERT(report.patterns[i].gluedSize >= exact.patterns[i].gluedSize);
+	}
+	for (size_t i = 0; i != report.shards.size(); ++i) {
+		yvector<const Pire::Scanner*> members;
+		yvector<Pire::Scanner> scanners;
+		scanners.reserve(report.shards[i].size());
+		for (size_t j = 0; j != report.shards[i].size(); ++j) {
+			scanners.push_back(Pire::Fsm(patterns[report.shards[i][j]]).Compile<Pire::Scanner>());
+			members.push_back(&scanners.back());
+		}
+		UNIT_ASSERT(Pire::Analysis::GluedSize(members, 1000).exact);
+	}
+}
+
+namespace {
+	Pire::Fsm SaveLoadFsm(const Pire::Fsm& fsm)
+	{
+		BufferOutput wbuf;
+		fsm.Save(&wbuf);
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Pire::Fsm loaded;
+		loaded.Load(&rbuf);
+		return loaded;
+	}
+
+	ystring DumpFsm(const Pire::Fsm& fsm)
+	{
+		BufferOutput s;
+		fsm.DumpTo(s);
+		return ystring(s.Buffer().Data(), s.Buffer().Size());
+	}
+}
+
+SIMPLE_UNIT_TEST(FsmSaveLoad)
+{
+	Pire::Fsm fsm = ParseRegexp("a(b|c)*d");
+	Pire::Fsm loaded = SaveLoadFsm(fsm);
+	UNIT_ASSERT_EQUAL(DumpFsm(loaded), DumpFsm(fsm));
+
+	// Determined FSMs keep their letter classes
+	fsm.Determine();
+	fsm.Minimize();
+	loaded = SaveLoadFsm(fsm);
+	UNIT_ASSERT(loaded.IsDetermined());
+	UNIT_ASSERT_EQUAL(DumpFsm(loaded), DumpFsm(fsm));
+	UNIT_ASSERT(loaded.Letters() == fsm.Letters());
+	Pire::Scanner sc = loaded.Compile<Pire::Scanner>();
+	UNIT_ASSERT(Matches(sc, "xabcbdx"));
+	UNIT_ASSERT(!Matches(sc, "xabcbx"));
+
+	// Loaded FSMs can be built upon further
+	loaded = SaveLoadFsm(ParseRegexp("ab")) | SaveLoadFsm(ParseRegexp("cd"));
+	sc = loaded.Compile<Pire::Scanner>();
+	UNIT_ASSERT(Matches(sc, "xabx"));
+	UNIT_ASSERT(Matches(sc, "xcdx"));
+
+	fsm = Pire::Fsm();
+	fsm.Resize(3);
+	fsm.Connect(0, 1, 'a');
+	fsm.Connect(1, 2, 'b');
+	fsm.SetFinal(2, true);
+	fsm.SetTag(2, 1000000);
+	fsm.SetOutput(0, 1, 42);
+	loaded = SaveLoadFsm(fsm);
+	UNIT_ASSERT_EQUAL(loaded.Tag(2), 1000000ul);
+	UNIT_ASSERT_EQUAL(loaded.Output(0, 1), 42ul);
+	UNIT_ASSERT_EQUAL(DumpFsm(loaded), DumpFsm(fsm));
+
+	BufferOutput wbuf;
+	fsm.Save(&wbuf);
+	for (size_t len = sizeof(Pire::Header); len != wbuf.Buffer().Size(); ++len) {
+		MemoryInput rbuf(wbuf.Buffer().Data(), len);
+		try {
+			loaded.Load(&rbuf);
+			UNIT_ASSERT(!"Should report truncated input");
+		}
+		catch (Pire::Error&) {}
+	}
+}
+
+SIMPLE_UNIT_TEST(Archive)
+{
+	Pire::ArchiveWriter writer;
+	writer.Add("multi", Pire::Scanner::Glue(
+		ParseRegexp("abc").Compile<Pire::Scanner>(),
+		ParseRegexp("def").Compile<Pire::Scanner>()));
+	writer.Add("simple", ParseRegexp("x+y").Compile<Pire::SimpleScanner>());
+	writer.Add("slow", ParseRegexp("a.{30}$", "").Compile<Pire::SlowScanner>());
+	writer.Add("empty", Pire::Scanner());
+	try {
+		writer.Add("simple", Pire::SimpleScanner());
+		UNIT_ASSERT(!"Should report duplicate name");
+	}
+	catch (Pire::Error&) {}
+
+	BufferOutput wbuf;
+	writer.Save(&wbuf);
+	yvector<char> data(wbuf.Buffer().Begin(), wbuf.Buffer().End());
+
+	Pire::Archive archive;
+	const void* end = archive.Mmap(&data[0], data.size());
+	UNIT_ASSERT_EQUAL(end, (const void*) (&data[0] + data.size()));
+	UNIT_ASSERT_EQUAL(archive.Count(), size_t(4));
+	UNIT_ASSERT_EQUAL(archive.Find("nonexistent"), archive.Count());
+	UNIT_ASSERT(archive.Verify());
+
+	Pire::Scanner sc;
+	archive.Mmap("multi", sc);
+	UNIT_ASSERT_EQUAL(sc.RegexpsCount(), size_t(2));
+	UNIT_ASSERT(Matches(sc, "xxdefxx"));
+	archive.Mmap("empty", sc);
+	UNIT_ASSERT(sc.Empty());
+
+	Pire::SimpleScanner simple;
+	archive.Mmap("simple", simple);
+	UNIT_ASSERT_EQUAL(archive.Type(archive.Find("simple")), Pire::ui32(2));
+	UNIT_ASSERT(Matches(simple, "axxxyb"));
+	UNIT_ASSERT(!Matches(simple, "ayxb"));
+
+	Pire::SlowScanner slow;
+	archive.Mmap("slow", slow);
+	UNIT_ASSERT(Matches(slow, "....a.............................."));
+
+	try {
+		archive.Mmap("nonexistent", sc);
+		UNIT_ASSERT(!"Should report missing scanner");
+	}
+	catch (Pire::Error&) {}
+	try {
+		archive.Mmap("simple", sc);
+		UNIT_ASSERT(!"Should report type mismatch");
+	}
+	catch (Pire::Error&) {}
+
+	size_t i = archive.Find("multi");
+	const_cast<char*>(static_cast<const char*>(archive.Data(i)))[archive.Size(i) - 1] ^= 1;
+	UNIT_ASSERT(!archive.Verify(i));
+	UNIT_ASSERT(!archive.Verify());
+
+	try {
+		archive.Mmap(&data[0], data.size() - 1);
+		UNIT_ASSERT(!"Should report truncated archive");
+	}
+	catch (Pire::Error&) {}
+}
+
+namespace {
+	template<class Scanner>
+	ystring SaveToString(const Scanner& sc)
+	{
+		BufferOutput buf;
+		sc.Save(&buf);
+		return ystring(buf.Buffer().Data(), buf.Buffer().Size());
+	}
+}
+
+SIMPLE_UNIT_TEST(Portable)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("a[bc]+d").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]+").Compile<Pire::Scanner>());
+	ystring native = SaveToString(sc);
+
+	// Converted scanners can differ from the original in unused padding only,
+	// so converting them again must not change anything
+	BufferOutput pbuf;
+	sc.SavePortable(&pbuf, false);
+	yvector<char> data(pbuf.Buffer().Begin(), pbuf.Buffer().End());
+	Pire::Scanner converted;
+	converted.MmapPortable(&data[0], data.size());
+	UNIT_ASSERT_EQUAL(converted.Size(), sc.Size());
+	UNIT_ASSERT_EQUAL(converted.LettersCount(), sc.LettersCount());
+	const char* inputs[] = { "xabcbdx", "x123x", "abd12", "xyz" };
+	for (size_t i = 0; i != sizeof(inputs) / sizeof(*inputs); ++i) {
+		ypair<const size_t*, const size_t*> a = sc.AcceptedRegexps(Pire::Runner(sc).Begin().Run(inputs[i]).End().State());
+		ypair<const size_t*, const size_t*> b = converted.AcceptedRegexps(Pire::Runner(converted).Begin().Run(inputs[i]).End().State());
+		UNIT_ASSERT_EQUAL(yvector<size_t>(a.first, a.second), yvector<size_t>(b.first, b.second));
+	}
+	ystring reconverted = SaveToString(converted);
+
+	for (int withNative = 0; withNative != 2; ++withNative) {
+		BufferOutput wbuf;
+		sc.SavePortable(&wbuf, withNative != 0);
+		data.assign(wbuf.Buffer().Begin(), wbuf.Buffer().End());
+
+		Pire::Scanner sc2;
+		const void* end = sc2.MmapPortable(&data[0], data.size());
+		UNIT_ASSERT_EQUAL(end, (const void*) (&data[0] + data.size()));
+		UNIT_ASSERT_EQUAL(SaveToString(sc2), (withNative ? native : reconverted));
+		UNIT_ASSERT(Matches(sc2, "xabcbdx"));
+
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Pire::Scanner sc3;
+		sc3.LoadPortable(&rbuf);
+		UNIT_ASSERT_EQUAL(SaveToString(sc3), reconverted);
+
+		Pire::NonrelocScanner nsc;
+		nsc.MmapPortable(&data[0], data.size());
+		UNIT_ASSERT(Matches(nsc, "xabcbdx"));
+		UNIT_ASSERT(!Matches(nsc, "xabx"));
+	}
+
+	// A native part from a different host is ignored
+	BufferOutput wbuf;
+	sc.SavePortable(&wbuf);
+	data.assign(wbuf.Buffer().Begin(), wbuf.Buffer().End());
+	size_t nativeOffset = Pire::Impl::LoadLE64(&data[32]);
+	reinterpret_cast<Pire::Header*>(&data[nativeOffset])->MaxWordSize += 1;
+	Pire::Scanner sc4;
+	sc4.MmapPortable(&data[0], data.size());
+	UNIT_ASSERT_EQUAL(SaveToString(sc4), reconverted);
+
+	// Corrupted transitions are detected
+	data.assign(pbuf.Buffer().Begin(), pbuf.Buffer().End());
+	data[data.size() - 9] = 0x7F;
+	try {
+		sc4.MmapPortable(&data[0], data.size());
+		UNIT_ASSERT(!"Should report corrupted scanner");
+	}
+	catch (Pire::Error&) {}
+
+	BufferOutput wbuf3;
+	Pire::Scanner().SavePortable(&wbuf3);
+	data.assign(wbuf3.Buffer().Begin(), wbuf3.Buffer().End());
+	sc4.MmapPortable(&data[0], data.size());
+	UNIT_ASSERT(sc4.Empty());
+}
+
+SIMPLE_UNIT_TEST(Compressed)
+{
+	// Enough states for several independently decoded blocks
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("a[ab]{10}b").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]+x").Compile<Pire::Scanner>());
+	UNIT_ASSERT(sc.Size() > 2 * 1024);
+	ystring native = SaveToString(sc);
+
+	BufferOutput buf;
+	sc.SaveCompressed(&buf);
+	UNIT_ASSERT(buf.Buffer().Size() < native.size() / 4);
+
+	for (size_t threads = 1; threads != 8; threads *= 2) {
+		MemoryInput in(buf.Buffer().Data(), buf.Buffer().Size());
+		Pire::Scanner sc2;
+		sc2.LoadCompressed(&in, threads);
+		UNIT_ASSERT_EQUAL(SaveToString(sc2), native);
+		UNIT_ASSERT(Matches(sc2, "xaabababababbx"));
+		UNIT_ASSERT(!Matches(sc2, "xaabx"));
+	}
+
+	Pire::NonrelocScanner nsc(sc);
+	BufferOutput nbuf;
+	nsc.SaveCompressed(&nbuf);
+	MemoryInput nin(nbuf.Buffer().Data(), nbuf.Buffer().Size());
+	nsc = Pire::NonrelocScanner();
+	nsc.LoadCompressed(&nin, 2);
+	UNIT_ASSERT(Matches(nsc, "x123x"));
+
+	// Compressed scanners cannot be loaded as plain ones
+	MemoryInput in(buf.Buffer().Data(), buf.Buffer().Size());
+	Pire::Scanner sc3;
+	try {
+		sc3.Load(&in);
+		UNIT_ASSERT(!"Should report wrong scanner type");
+	}
+	catch (Pire::Error&) {}
+
+	BufferOutput ebuf;
+	Pire::Scanner().SaveCompressed(&ebuf);
+	MemoryInput ein(ebuf.Buffer().Data(), ebuf.Buffer().Size());
+	sc3.LoadCompressed(&ein);
+	UNIT_ASSERT(sc3.Empty());
+}
+
+SIMPLE_UNIT_TEST(MmapChecksums)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("a[bc]+d").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]+").Compile<Pire::Scanner>());
+	BufferOutput buf;
+	sc.Save(&buf);
+	size_t size = buf.Buffer().Size();
+	yvector<size_t> data(size / sizeof(size_t) + 1);
+	char* begin = reinterpret_cast<char*>(&data[0]);
+	memcpy(begin, buf.Buffer().Data(), size);
+
+	Pire::Scanner sc2;
+	UNIT_ASSERT_EQUAL(sc2.Mmap(begin, size, Pire::MmapVerify), (const void*) (begin + size));
+	UNIT_ASSERT(Matches(sc2, "xabcbdx"));
+	{
+		Pire::BackgroundVerifier verifier;
+		sc2.Mmap(begin, size, Pire::MmapVerifyInBackground, &verifier);
+		UNIT_ASSERT(Matches(sc2, "x123x"));
+		UNIT_ASSERT(verifier.Wait());
+		UNIT_ASSERT(verifier.Done());
+	}
+	try {
+		sc2.Mmap(begin, size, Pire::MmapVerifyInBackground);
+		UNIT_ASSERT(!"Should require a verifier");
+	}
+	catch (Pire::Error&) {}
+
+	// Fill the whole row of the initial state with garbage
+	sc2.Mmap(begin, size);
+	Pire::Scanner::State s0, s1;
+	sc2.Initialize(s0);
+	s1 = s0;
+	sc2.Next(s1, 'a');
+	UNIT_ASSERT(sc2.StateIndex(s1) != sc2.StateIndex(s0));
+	size_t rowBytes = (s1 > s0 ? s1 - s0 : s0 - s1) / (sc2.StateIndex(s1) > sc2.StateIndex(s0)
+		? sc2.StateIndex(s1) - sc2.StateIndex(s0) : sc2.StateIndex(s0) - sc2.StateIndex(s1));
+	memset(reinterpret_cast<char*>(s0), 0x7F, rowBytes);
+
+	try {
+		sc2.Mmap(begin, size, Pire::MmapVerify);
+		UNIT_ASSERT(!"Should report checksum mismatch");
+	}
+	catch (Pire::Error&) {}
+	try {
+		sc2.Mmap(begin, size);
+		UNIT_ASSERT(!"Should report a jump outside the table");
+	}
+	catch (Pire::Error&) {}
+	{
+		// Jumps are checked right away, not when the verifier gets to them
+		Pire::BackgroundVerifier verifier;
+		try {
+			sc2.Mmap(begin, size, Pire::MmapVerifyInBackground, &verifier);
+			UNIT_ASSERT(!"Should report a jump outside the table");
+		}
+		catch (Pire::Error&) {}
+		UNIT_ASSERT(verifier.Wait());
+	}
+
+	MemoryInput in(begin, size);
+	try {
+		sc2.Load(&in);
+		UNIT_ASSERT(!"Should report checksum mismatch");
+	}
+	catch (Pire::Error&) {}
+
+	// Only Pire::Scanner has got checksums; other formats keep their version
+	BufferOutput sbuf;
+	ParseRegexp("abc").Compile<Pire::SimpleScanner>().Save(&sbuf);
+	UNIT_ASSERT_EQUAL(reinterpret_cast<const Pire::Header*>(sbuf.Buffer().Data())->Version, Pire::Header::RE_VERSION);
+	UNIT_ASSERT_EQUAL(reinterpret_cast<const Pire::Header*>(buf.Buffer().Data())->Version, Pire::Header::RE_VERSION_WITH_MASKS);
+}
+
+template<class Scanner>
+void TestSaveTo(const Scanner& sc, const ystring& saved)
+{
+	UNIT_ASSERT_EQUAL(sc.SerializedSize(), saved.size());
+	yvector<char> buf(saved.size() + 1, 'X');
+	UNIT_ASSERT_EQUAL(sc.SaveTo(&buf[0]), (void*) (&buf[0] + saved.size()));
+	UNIT_ASSERT_EQUAL(ystring(&buf[0], saved.size()), saved);
+	UNIT_ASSERT_EQUAL(buf.back(), 'X');
+
+#ifndef _WIN32
+	FILE* f = tmpfile();
+	UNIT_ASSERT(f);
+	sc.SaveToFd(fileno(f));
+	rewind(f);
+	buf.assign(saved.size() + 1, 'X');
+	UNIT_ASSERT_EQUAL(fread(&buf[0], 1, buf.size(), f), saved.size());
+	UNIT_ASSERT_EQUAL(ystring(&buf[0], saved.size()), saved);
+	fclose(f);
+#endif
+}
+
+SIMPLE_UNIT_TEST(SaveTo)
+{
+	Pire::Scanner sc = Pire::Scanner::Glue(
+		ParseRegexp("a[bc]+d").Compile<Pire::Scanner>(),
+		ParseRegexp("[0-9]+").Compile<Pire::Scanner>());
+	ystring saved = SaveToString(sc);
+	TestSaveTo(sc, saved);
+	TestSaveTo(Pire::NonrelocScanner(sc), saved);
+	TestSaveTo(Pire::Scanner(), SaveToString(Pire::Scanner()));
+
+	// The buffer is ready for mmap()-ing
+	yvector<size_t> buf(sc.SerializedSize() / sizeof(size_t) + 1);
+	sc.SaveTo(&buf[0]);
+	Pire::Scanner sc2;
+	sc2.Mmap(&buf[0], sc.SerializedSize(), Pire::MmapVerify);
+	UNIT_ASSERT(Matches(sc2, "xabcbdx"));
+	UNIT_ASSERT(!Matches(sc2, "xabx"));
+}
+
+SIMPLE_UNIT_TEST(MapScannerFile)
+{
+#ifndef _WIN32
+	Pire::Scanner sc = ParseRegexp("a[ab]{10}b").Compile<Pire::Scanner>();
+	char name[] = "/tmp/pire_map_ut.XXXXXX";
+	int fd = mkstemp(name);
+	UNIT_ASSERT(fd != -1);
+	sc.SaveToFd(fd);
+	close(fd);
+
+	Pire::MapOptions options;
+	options.Populate = options.WillNeed = options.HugePages = options.WarmUp = true;
+	options.Mode = Pire::MmapVerify;
+	Pire::MappedScanner<Pire::Scanner> mapped = Pire::MapScannerFile<Pire::Scanner>(name, options);
+	UNIT_ASSERT_EQUAL(mapped.File().Size(), sc.SerializedSize());
+	UNIT_ASSERT(Matches(*mapped, "xaabababababb"));
+	mapped.WaitWarmUp();
+	UNIT_ASSERT(mapped.WarmedUp());
+	{
+		// Copies share the mapping
+		Pire::MappedScanner<Pire::Scanner> copy = mapped;
+		mapped = Pire::MappedScanner<Pire::Scanner>();
+		UNIT_ASSERT(mapped.Empty());
+		UNIT_ASSERT(Matches(copy.Get(), "abbbbbbbbbbb"));
+		UNIT_ASSERT(!Matches(copy.Get(), "abbbbbbbbbb"));
+	}
+
+	// Destroying a handle stops its warm-up
+	Pire::MappedScanner<Pire::Scanner>(name, options);
+
+	try {
+		Pire::MapScannerFile<Pire::SimpleScanner>(name, options);
+		UNIT_ASSERT(!"Should not verify scanners without checksums");
+	}
+	catch (Pire::Error&) {}
+	unlink(name);
+	try {
+		Pire::MapScannerFile<Pire::Scanner>(name);
+		UNIT_ASSERT(!"Should report a missing file");
+	}
+	catch (Pire::Error&) {}
+#endif
+}
+
+SIMPLE_UNIT_TEST(SharedRegistry)
+{
+#ifdef PIRE_HAVE_SHM_OPEN
+	char name[64];
+	snprintf(name, sizeof(name), "/pire_registry_ut.%ld", static_cast<long>(getpid()));
+	Pire::SharedRegistry registry(name);
+	registry.Remove();
+	UNIT_ASSERT_EQUAL(registry.Generation(), ui64(0));
+	try {
+		registry.Attach();
+		UNIT_ASSERT(!"Should report an empty registry");
+	}
+	catch (Pire::Error&) {}
+
+	Pire::ArchiveWriter writer;
+	writer.Add("digits", ParseRegexp("^[0-9]+$").Compile<Pire::Scanner>());
+	writer.Add("simple", ParseRegexp("ab+c").Compile<Pire::SimpleScanner>());
+	UNIT_ASSERT_EQUAL(registry.Publish(writer), ui64(1));
+
+	Pire::SharedGeneration first = registry.Attach();
+	UNIT_ASSERT_EQUAL(first.Number(), ui64(1));
+	Pire::Scanner digits = first.Get<Pire::Scanner>("digits");
+	UNIT_ASSERT(Matches(digits, "12345"));
+	UNIT_ASSERT(!Matches(digits, "123a45"));
+	UNIT_ASSERT(Matches(first.Get<Pire::SimpleScanner>("simple"), "xabbbcx"));
+
+	// Old readers keep their generation while a new one is published
+	Pire::ArchiveWriter writer2;
+	writer2.Add("digits", ParseRegexp("^[0-9]+a$").Compile<Pire::Scanner>());
+	UNIT_ASSERT_EQUAL(registry.Publish(writer2), ui64(2));
+	UNIT_ASSERT_EQUAL(Pire::SharedRegistry(name).Generation(), ui64(2));
+	UNIT_ASSERT(Matches(digits, "12345"));
+
+	Pire::SharedGeneration second = registry.Attach();
+	UNIT_ASSERT_EQUAL(second.Number(), ui64(2));
+	UNIT_ASSERT(Matches(second.Get<Pire::Scanner>("digits"), "123a"));
+	UNIT_ASSERT_EQUAL(second.Scanners().Find("simple"), second.Scanners().Count());
+
+	registry.Remove();
+	UNIT_ASSERT_EQUAL(registry.Generation(), ui64(0));
+	UNIT_ASSERT(Matches(second.Get<Pire::Scanner>("digits"), "123a"));
+#endif
+}
+
+#ifdef PIRE_HAVE_PTHREAD_H
+namespace {
+	struct HandleReader {
+		const Pire::ScannerHandle<Pire::Scanner>* Handle;
+		volatile bool* Stop;
+		size_t Errors;
+
+		static void* Run(void* ctx)
+		{
+			HandleReader* self = static_cast<HandleReader*>(ctx);
+			while (!*self->Stop) {
+				Pire::ScannerHandle<Pire::Scanner>::ReadGuard guard(*self->Handle);
+				// Every published scanner matches this
+				if (!Matches(*guard, "xabcx"))
+					++self->Errors;
+			}
+			return 0;
+		}
+	};
+}
+#endif
+
+SIMPLE_UNIT_TEST(ScannerHandle)
+{
+	Pire::ScannerHandle<Pire::Scanner> handle(ParseRegexp("abc").Compile<Pire::Scanner>());
+	{
+		Pire::ScannerHandle<Pire::Scanner>::ReadGuard guard(handle);
+		Pire::ScannerHandle<Pire::Scanner>::ReadGuard nested(handle);
+		UNIT_ASSERT(Matches(*guard, "xabcx"));
+		UNIT_ASSERT(Matches(nested.Get(), "xabcx"));
+	}
+	handle.Publish(ParseRegexp("b").Compile<Pire::Scanner>());
+	{
+		Pire::ScannerHandle<Pire::Scanner>::ReadGuard guard(handle);
+		UNIT_ASSERT(Matches(*guard, "xbx"));
+		UNIT_ASSERT(!Matches(*guard, "xcx"));
+	}
+
+#ifndef _WIN32
+	// File-backed scanners stay mapped until they are replaced
+	char name[] = "/tmp/pire_handle_ut.XXXXXX";
+	int fd = mkstemp(name);
+	UNIT_ASSERT(fd != -1);
+	ParseRegexp("c").Compile<Pire::Scanner>().SaveToFd(fd);
+	close(fd);
+	handle.Publish(Pire::MapScannerFile<Pire::Scanner>(name));
+	unlink(name);
+	{
+		Pire::ScannerHandle<Pire::Scanner>::ReadGuard guard(handle);
+		UNIT_ASSERT(Matches(*guard, "xcx"));
+		UNIT_ASSERT(!Matches(*guard, "xbx"));
+	}
+#endif
+
+#ifdef PIRE_HAVE_PTHREAD_H
+	volatile bool stop = false;
+	HandleReader readers[2] = { { &handle, &stop, 0 }, { &handle, &stop, 0 } };
+	pthread_t threads[2];
+	for (size_t i = 0; i != 2; ++i)
+		UNIT_ASSERT(!pthread_create(&threads[i], 0, &HandleReader::Run, &readers[i]));
+	const char* regexps[] = { "a", "b", "c", "ab", "bc" };
+	for (size_t i = 0; i != 20; ++i)
+		handle.Publish(ParseRegexp(regexps[i % 5]).Compile<Pire::Scanner>());
+	stop = true;
+	for (size_t i = 0; i != 2; ++i) {
+		pthread_join(threads[i], 0);
+		UNIT_ASSERT_EQUAL(readers[i].Errors, size_t(0));
+	}
+#endif
+}
+
+namespace {
+	struct RegexpBuilder {
+		const char* regexp;
+		size_t* calls;
+		Pire::Fsm operator()() const { ++*calls; return ParseRegexp(regexp); }
+	};
+}
+
+SIMPLE_UNIT_TEST(CompileCache)
+{
+#ifndef _WIN32
+	char dir[] = "/tmp/pire_cache_ut.XXXXXX";
+	UNIT_ASSERT(mkdtemp(dir));
+
+	size_t calls = 0;
+	RegexpBuilder build = { "a.*b", &calls };
+	Pire::CacheKey key("a.*b");
+	{
+		Pire::CompileCache cache(dir);
+		Pire::Scanner sc = cache.Get<Pire::Scanner>(key, build);
+		UNIT_ASSERT(Matches(sc, "xaxxbx"));
+		UNIT_ASSERT_EQUAL(cache.Misses(), size_t(1));
+	}
+	{
+		Pire::CompileCache cache(dir);
+		Pire::Scanner sc = cache.Get<Pire::Scanner>(key, build);
+		UNIT_ASSERT(Matches(sc, "xaxxbx"));
+		UNIT_ASSERT(!Matches(sc, "xbxxax"));
+		UNIT_ASSERT_EQUAL(cache.Hits(), size_t(1));
+		UNIT_ASSERT_EQUAL(calls, size_t(1));
+
+		// Different scanner types do not clash
+		Pire::SimpleScanner ssc;
+		UNIT_ASSERT(!cache.Find(key, ssc));
+		Pire::SlowScanner slow = cache.Get<Pire::SlowScanner>(key, build);
+		UNIT_ASSERT(Matches(slow, "xaxxbx"));
+		UNIT_ASSERT_EQUAL(calls, size_t(2));
+	}
+	// Leftovers of crashed writers
+	ystring stale = ystring(dir) + "/0123456789abcdef.pire.tmp.aBcDeF";
+	ystring fresh = ystring(dir) + "/0123456789abcdef.pire.tmp.GhIjKl";
+	fclose(fopen(stale.c_str(), "w"));
+	fclose(fopen(fresh.c_str(), "w"));
+	struct utimbuf old = { time(0) - 24 * 3600, time(0) - 24 * 3600 };
+	UNIT_ASSERT(!utime(stale.c_str(), &old));
+	{
+		// Evict everything but the latest entry
+		Pire::CompileCache cache(dir, 1);
+		RegexpBuilder other = { "cd", &calls };
+		cache.Get<Pire::Scanner>(Pire::CacheKey("cd"), other);
+		Pire::Scanner sc;
+		UNIT_ASSERT(!cache.Find(key, sc));
+		UNIT_ASSERT(cache.Find(Pire::CacheKey("cd"), sc));
+		UNIT_ASSERT(Matches(sc, "xcdx"));
+	}
+	UNIT_ASSERT(access(stale.c_str(), F_OK));
+	UNIT_ASSERT(!access(fresh.c_str(), F_OK));
+
+	DIR* d = opendir(dir);
+	while (struct dirent* entry = readdir(d))
+		if (entry->d_name[0] != '.')
+			unlink((ystring(dir) + "/" + entry->d_name).c_str());
+	closedir(d);
+	rmdir(dir);
+#endif
+}
+
 SIMPLE_UNIT_TEST(Slow)
 {
 	Pire::SlowScanner sc = ParseRegexp("a.{30}$", "").Compile<Pire::SlowScanner>();
@@ -619,6 +1677,351 @@ SIMPLE_UNIT_TEST(Slow)
 	UNIT_ASSERT( Matches(sc, "....a.............................."));
 	UNIT_ASSERT(!Matches(sc, "....a..............................."));
 	UNIT_ASSERT(!Matches(sc, "....a............................."));
+
+	// Stepping in place and into another state must agree
+	Pire::SlowScanner::State st1, st2, st3;
+	sc.Initialize(st1);
+	sc.Initialize(st2);
+	yvector<Pire::Char> text;
+	text.push_back(Pire::BeginMark);
+	text.insert(text.end(), 2, 'x');
+	text.push_back('a');
+	text.insert(text.end(), 30, '.');
+	text.push_back(Pire::EndMark);
+	for (yvector<Pire::Char>::const_iterator it = text.begin(), ie = text.end(); it != ie; ++it) {
+		sc.Next(st1, *it);
+		sc.Next(st2, st3, *it);
+		st2.Swap(st3);
+		UNIT_ASSERT(yvector<unsigned>(st1.Begin(), st1.End()) == yvector<unsigned>(st2.Begin(), st2.End()));
+	}
+	UNIT_ASSERT(sc.Final(st1));
+
+	// Mmap()-ed scanners can be saved as well
+	BufferOutput buf1;
+	Save(&buf1, sc);
+	Pire::SlowScanner mapped;
+	mapped.Mmap(buf1.Buffer().Data(), buf1.Buffer().Size());
+	BufferOutput buf2;
+	Save(&buf2, mapped);
+	UNIT_ASSERT_EQUAL(buf1.Buffer().Size(), buf2.Buffer().Size());
+	UNIT_ASSERT(!memcmp(buf1.Buffer().Data(), buf2.Buffer().Data(), buf1.Buffer().Size()));
+	UNIT_ASSERT( Matches(mapped, "....a.............................."));
+	UNIT_ASSERT(!Matches(mapped, "....a..............................."));
+}
+
+template<class Scanner>
+void TestBitParallel(const char* regexp, const char** strings)
+{
+	Pire::SlowScanner slow = ParseRegexp(regexp, "").Compile<Pire::SlowScanner>();
+	Scanner sc = ParseRegexp(regexp, "").Compile<Scanner>();
+
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Scanner loaded;
+	Load(&rbuf, loaded);
+	Scanner mapped;
+	const char* ptr = (const char*) mapped.Mmap(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	UNIT_ASSERT(ptr == wbuf.Buffer().Data() + wbuf.Buffer().Size());
+
+	for (const char** str = strings; *str; ++str) {
+		bool expected = Matches(slow, *str);
+		UNIT_ASSERT_EQUAL(Matches(sc, *str), expected);
+		UNIT_ASSERT_EQUAL(Matches(loaded, *str), expected);
+		UNIT_ASSERT_EQUAL(Matches(mapped, *str), expected);
+	}
+}
+
+SIMPLE_UNIT_TEST(BitParallel)
+{
+	const char* strings[] = {
+		"", "a", "ab", "abd", "acbd", "xabcbd", "abcbdx", "a..........................b",
+		"a.............................b", "....a..............................",
+		"....a...............................", "ab..............................b", 0
+	};
+	const char* regexps[] = { "a[bc]+d$", "^a.*b$", "a.{30}$", "(ab|a.)+b", "x?a(b|c|d)*", 0 };
+	for (const char** regexp = regexps; *regexp; ++regexp) {
+		TestBitParallel<Pire::BitParallelScanner64>(*regexp, strings);
+		TestBitParallel<Pire::BitParallelScanner128>(*regexp, strings);
+		TestBitParallel<Pire::BitParallelScanner>(*regexp, strings);
+	}
+
+	// Determinization of this one blows up exponentially
+	Pire::BitParallelScanner sc = ParseRegexp("a.{30}b", "").Compile<Pire::BitParallelScanner>();
+	//                            123456789012345678901234567890
+	UNIT_ASSERT( Matches(sc, "....a..............................b...."));
+	UNIT_ASSERT( Matches(sc, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab"));
+	UNIT_ASSERT(!Matches(sc, "....a.............................b...."));
+	UNIT_ASSERT_EQUAL(sc.RegexpsCount(), size_t(1));
+
+	try {
+		ParseRegexp("a.{70}b", "").Compile<Pire::BitParallelScanner64>();
+		UNIT_ASSERT(!"Too large regexp compiled into Pire::BitParallelScanner64");
+	}
+	catch (Pire::Error&) {}
+}
+
+SIMPLE_UNIT_TEST(Sheng)
+{
+	const char* regexps[] = { "ab+c", "^[a-c]*d$", "x(y|z)?", "hello", 0 };
+	const char* strings[] = {
+		"", "abc", "abbbbbc", "ac", "aabcd", "cabad", "abcabcabcd", "x", "..xz..",
+		"hellhello", "hell", "the quick brown fox jumps over the lazy dog", 0
+	};
+	for (const char** regexp = regexps; *regexp; ++regexp) {
+		Pire::SimpleScanner simple = ParseRegexp(*regexp, "").Compile<Pire::SimpleScanner>();
+		Pire::ShengScanner sc = ParseRegexp(*regexp, "").Compile<Pire::ShengScanner>();
+		UNIT_ASSERT(sc.Size() <= Pire::ShengScanner::MaxStates);
+
+		BufferOutput wbuf;
+		Save(&wbuf, sc);
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Pire::ShengScanner loaded;
+		Load(&rbuf, loaded);
+		Pire::ShengScanner mapped;
+		const char* ptr = (const char*) mapped.Mmap(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		UNIT_ASSERT(ptr == wbuf.Buffer().Data() + wbuf.Buffer().Size());
+
+		for (const char** str = strings; *str; ++str) {
+			bool expected = Matches(simple, *str);
+			UNIT_ASSERT_EQUAL(Matches(sc, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(loaded, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(mapped, *str), expected);
+			UNIT_ASSERT_EQUAL(bool(Pire::Runner(sc).Run(*str, strlen(*str)).End()), bool(Pire::Runner(simple).Run(*str, strlen(*str)).End()));
+		}
+	}
+
+	Pire::ShengScanner sc = Pire::Lexer("ab+").Parse().Compile<Pire::ShengScanner>();
+	const char* text = "abbbbbc";
+	UNIT_ASSERT_EQUAL(Pire::LongestPrefix(sc, text, text + strlen(text)), text + 6);
+	UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(sc, text, text + strlen(text)), text + 2);
+
+	try {
+		ParseRegexp("a.{20}b", "").Compile<Pire::ShengScanner>();
+		UNIT_ASSERT(!"Too large regexp compiled into Pire::ShengScanner");
+	}
+	catch (Pire::Error&) {}
+}
+
+SIMPLE_UNIT_TEST(Stride2)
+{
+	const char* regexps[] = { "ab+c", "^[a-c]*d$", "[0-9]{3}-[0-9]{4}", "(foo|bar)+baz", 0 };
+	const char* strings[] = {
+		"", "abc", "abbbbbc", "...............abbc..", "aabcd", "cabad", "abcabcabcd", "abcabcabcabcabcabcabcd",
+		"call 555-1234 now", "555-123", "foobarfoobaz", "the quick brown fox jumps over the lazy dog foobar", 0
+	};
+	for (const char** regexp = regexps; *regexp; ++regexp) {
+		Pire::SimpleScanner simple = ParseRegexp(*regexp, "").Compile<Pire::SimpleScanner>();
+		Pire::Fsm fsm = ParseRegexp(*regexp, "");
+		Pire::Stride2Scanner sc = Pire::Fsm(fsm).Compile<Pire::Stride2Scanner>();
+		Pire::Fsm fsm2 = fsm;
+		Pire::Stride2Scanner narrow(fsm2, 0);
+		UNIT_ASSERT(sc.HasPairs());
+		UNIT_ASSERT(!narrow.HasPairs());
+
+		BufferOutput wbuf;
+		Save(&wbuf, sc);
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Pire::Stride2Scanner loaded;
+		Load(&rbuf, loaded);
+		Pire::Stride2Scanner mapped;
+		const char* ptr = (const char*) mapped.Mmap(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		UNIT_ASSERT(ptr == wbuf.Buffer().Data() + wbuf.Buffer().Size());
+		UNIT_ASSERT(mapped.HasPairs());
+
+		// Scanners without the pair table survive saving as well
+		BufferOutput nbuf;
+		Save(&nbuf, narrow);
+		MemoryInput nrbuf(nbuf.Buffer().Data(), nbuf.Buffer().Size());
+		Pire::Stride2Scanner narrowLoaded;
+		Load(&nrbuf, narrowLoaded);
+		Pire::Stride2Scanner narrowMapped;
+		ptr = (const char*) narrowMapped.Mmap(nbuf.Buffer().Data(), nbuf.Buffer().Size());
+		UNIT_ASSERT(ptr == nbuf.Buffer().Data() + nbuf.Buffer().Size());
+		UNIT_ASSERT(!narrowLoaded.HasPairs());
+		UNIT_ASSERT(!narrowMapped.HasPairs());
+
+		for (const char** str = strings; *str; ++str) {
+			bool expected = Matches(simple, *str);
+			UNIT_ASSERT_EQUAL(Matches(sc, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(narrow, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(loaded, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(mapped, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(narrowLoaded, *str), expected);
+			UNIT_ASSERT_EQUAL(Matches(narrowMapped, *str), expected);
+			// Various alignments of the aligned part
+			for (size_t skip = 1; skip < 4 && skip < strlen(*str); ++skip)
+				UNIT_ASSERT_EQUAL(bool(Pire::Runner(sc).Run(*str + skip, strlen(*str) - skip).End()),
+					bool(Pire::Runner(simple).Run(*str + skip, strlen(*str) - skip).End()));
+		}
+	}
+
+	Pire::Stride2Scanner sc = Pire::Lexer("ab+").Parse().Compile<Pire::Stride2Scanner>();
+	Pire::Stride2Scanner::State st;
+	sc.Initialize(st);
+	sc.Next(st, 'a', 'b');
+	UNIT_ASSERT(sc.Final(st));
+	sc.Next(st, 'b', 'c');
+	UNIT_ASSERT(!sc.Final(st));
+
+	// Out-of-range transitions are detected, both in the letter table and in the pair table
+	Pire::Fsm fsm = Pire::Lexer("ab+").Parse();
+	Pire::Stride2Scanner narrow(fsm, 0);
+	for (size_t pairs = 0; pairs != 2; ++pairs) {
+		BufferOutput wbuf;
+		Save(&wbuf, pairs ? sc : narrow);
+		yvector<size_t> data(wbuf.Buffer().Size() / sizeof(size_t));
+		memcpy(&data[0], wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		data.back() = static_cast<size_t>(-1);
+		const char* ptr = reinterpret_cast<const char*>(&data[0]);
+		try {
+			Pire::Stride2Scanner mapped;
+			mapped.Mmap(ptr, data.size() * sizeof(size_t));
+			UNIT_ASSERT(!"Should report corrupted scanner");
+		}
+		catch (Pire::Error&) {}
+		try {
+			MemoryInput rbuf(ptr, data.size() * sizeof(size_t));
+			Pire::Stride2Scanner loaded;
+			Load(&rbuf, loaded);
+			UNIT_ASSERT(!"Should report corrupted scanner");
+		}
+		catch (Pire::Error&) {}
+	}
+}
+
+SIMPLE_UNIT_TEST(Jit)
+{
+	const char* regexps[] = { "ab+c", "^[a-c]*d$", "[0-9]{3}-[0-9]{4}", "(foo|bar)+baz", "[^x]*x", 0 };
+	const char* strings[] = {
+		"", "abc", "abbbbbc", "...............abbc..", "aabcd", "cabad", "abcabcabcd", "abcabcabcabcabcabcabcd",
+		"call 555-1234 now", "555-123", "foobarfoobaz", "the quick brown fox jumps over the lazy dog foobar",
+		"a rather long line without the character we are looking for, but with an x at the end", 0
+	};
+	Pire::Scanner glued;
+	for (const char** regexp = regexps; *regexp; ++regexp) {
+		Pire::Scanner sc = ParseRegexp(*regexp, "").Compile<Pire::Scanner>();
+		Pire::Scanner surrounded = ParseRegexp(*regexp, "").Surround().Compile<Pire::Scanner>();
+		glued = (regexp == regexps) ? surrounded : Pire::Scanner::Glue(glued, surrounded);
+		Pire::JitScanner jit(sc);
+		Pire::JitScanner fallback(sc, false);
+		Pire::JitScanner jitSurrounded = Pire::JitScanner(surrounded);
+#if defined(__x86_64__) && !defined(_WIN32)
+		UNIT_ASSERT(jit.Native());
+#endif
+		UNIT_ASSERT(!fallback.Native());
+
+		for (const char** str = strings; *str; ++str) {
+			const char* end = *str + strlen(*str);
+			UNIT_ASSERT(RunRegexp(jit, *str) == RunRegexp(sc, *str));
+			UNIT_ASSERT(RunRegexp(fallback, *str) == RunRegexp(sc, *str));
+			UNIT_ASSERT(RunRegexp(jitSurrounded, *str) == RunRegexp(surrounded, *str));
+			UNIT_ASSERT_EQUAL(Pire::LongestPrefix(jit, *str, end), Pire::LongestPrefix(sc, *str, end));
+			UNIT_ASSERT_EQUAL(Pire::LongestPrefix(fallback, *str, end), Pire::LongestPrefix(sc, *str, end));
+			UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(jit, *str, end), Pire::ShortestPrefix(sc, *str, end));
+		}
+	}
+
+	Pire::JitScanner jit(glued);
+	for (const char** str = strings; *str; ++str) {
+		Pire::Scanner::State st = RunRegexp(glued, *str);
+		UNIT_ASSERT(RunRegexp(jit, *str) == st);
+		ypair<const size_t*, const size_t*> expected = glued.AcceptedRegexps(st);
+		ypair<const size_t*, const size_t*> accepted = jit.AcceptedRegexps(RunRegexp(jit, *str));
+		UNIT_ASSERT_EQUAL(yvector<size_t>(accepted.first, accepted.second), yvector<size_t>(expected.first, expected.second));
+	}
+
+	Pire::JitScanner empty;
+	UNIT_ASSERT(empty.Empty());
+	UNIT_ASSERT(!Pire::Runner(empty).Begin().Run("a string", 7).End());
+}
+
+#ifdef PIRE_HAVE_VARIADIC_TEMPLATES
+SIMPLE_UNIT_TEST(Tuple)
+{
+	Pire::Scanner scanner = ParseRegexp("ab+c", "").Compile<Pire::Scanner>();
+	Pire::SimpleScanner simple = ParseRegexp("a[a-z]{2}", "").Compile<Pire::SimpleScanner>();
+	Pire::SlowScanner slow = ParseRegexp("(a|b)*b.{3}", "").Compile<Pire::SlowScanner>();
+	typedef Pire::ScannerTuple<Pire::Scanner, Pire::SimpleScanner, Pire::SlowScanner> Tuple;
+	Tuple tuple = Pire::MakeScannerTuple(scanner, simple, slow);
+	UNIT_ASSERT(&tuple.Get<1>() == &simple);
+
+	const char* strings[] = { "", "abc", "abbbc", "axy", "abbbb", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", "abbbbbbbbbbbbbbbbbbbbbbbcxyz", "xyz", 0 };
+	for (const char** str = strings; *str; ++str) {
+		const char* end = *str + strlen(*str);
+		Tuple::State st = RunRegexp(tuple, *str);
+		UNIT_ASSERT_EQUAL(scanner.Final(std::get<0>(st)), Matches(scanner, *str));
+		UNIT_ASSERT_EQUAL(simple.Final(std::get<1>(st)), Matches(simple, *str));
+		UNIT_ASSERT_EQUAL(slow.Final(std::get<2>(st)), Matches(slow, *str));
+		UNIT_ASSERT_EQUAL(tuple.Final(st), Matches(scanner, *str) || Matches(simple, *str) || Matches(slow, *str));
+
+		// Any final state makes a prefix, all dead states stop the scan
+		const char* longest[] = { Pire::LongestPrefix(scanner, *str, end), Pire::LongestPrefix(simple, *str, end), Pire::LongestPrefix(slow, *str, end) };
+		const char* shortest[] = { Pire::ShortestPrefix(scanner, *str, end), Pire::ShortestPrefix(simple, *str, end), Pire::ShortestPrefix(slow, *str, end) };
+		const char* expectedLongest = 0;
+		const char* expectedShortest = 0;
+		for (size_t i = 0; i != 3; ++i) {
+			if (longest[i] && (!expectedLongest || longest[i] > expectedLongest))
+				expectedLongest = longest[i];
+			if (shortest[i] && (!expectedShortest || shortest[i] < expectedShortest))
+				expectedShortest = shortest[i];
+		}
+		UNIT_ASSERT_EQUAL(Pire::LongestPrefix(tuple, *str, end), expectedLongest);
+		UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(tuple, *str, end), expectedShortest);
+	}
+}
+#endif
+
+yvector<size_t> AcceptedRegexps(const Pire::SlowScanner& sc, const char* str)
+{
+	Pire::SlowScanner::State st = RunRegexp(sc, str);
+	ypair<const size_t*, const size_t*> accepted = sc.AcceptedRegexps(st);
+	return yvector<size_t>(accepted.first, accepted.second);
+}
+
+SIMPLE_UNIT_TEST(GlueSlow)
+{
+	yvector<Pire::SlowScanner> scanners;
+	scanners.push_back(ParseRegexp("a.{20}b", "").Compile<Pire::SlowScanner>());
+	scanners.push_back(Pire::SlowScanner());
+	scanners.push_back(ParseRegexp("^c.*d$", "").Compile<Pire::SlowScanner>());
+	scanners.push_back(ParseRegexp("x*", "").Compile<Pire::SlowScanner>());
+	Pire::SlowScanner sc = Pire::SlowScanner::Glue(scanners);
+	UNIT_ASSERT_EQUAL(sc.RegexpsCount(), size_t(3));
+
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::SlowScanner loaded;
+	Load(&rbuf, loaded);
+	Pire::SlowScanner mapped;
+	mapped.Mmap(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+
+	const Pire::SlowScanner* all[] = { &sc, &loaded, &mapped };
+	for (size_t i = 0; i != sizeof(all) / sizeof(*all); ++i) {
+		//                                                  12345678901234567890
+		yvector<size_t> accepted = AcceptedRegexps(*all[i], "c...a....................b..d");
+		UNIT_ASSERT_EQUAL(accepted.size(), size_t(3));
+		UNIT_ASSERT_EQUAL(accepted[0], size_t(0));
+		UNIT_ASSERT_EQUAL(accepted[1], size_t(1));
+		UNIT_ASSERT_EQUAL(accepted[2], size_t(2));
+
+		accepted = AcceptedRegexps(*all[i], "ca...................b..d");
+		UNIT_ASSERT_EQUAL(accepted.size(), size_t(2));
+		UNIT_ASSERT_EQUAL(accepted[0], size_t(1));
+		UNIT_ASSERT_EQUAL(accepted[1], size_t(2));
+
+		accepted = AcceptedRegexps(*all[i], "xa....................bdc");
+		UNIT_ASSERT_EQUAL(accepted.size(), size_t(2));
+		UNIT_ASSERT_EQUAL(accepted[0], size_t(0));
+		UNIT_ASSERT_EQUAL(accepted[1], size_t(2));
+	}
+
+	Pire::SlowScanner pair = Pire::SlowScanner::Glue(scanners[0], scanners[2]);
+	UNIT_ASSERT_EQUAL(pair.RegexpsCount(), size_t(2));
+	UNIT_ASSERT( Matches(pair, "cd"));
+	UNIT_ASSERT(!Matches(pair, "dc"));
+	UNIT_ASSERT(Pire::SlowScanner::Glue(Pire::SlowScanner(), Pire::SlowScanner()).Empty());
 }
 
 class AlignedString {
@@ -709,6 +2112,12 @@ SIMPLE_UNIT_TEST(EmptyScanner)
 	UNIT_ASSERT_EQUAL(Pire::Scanner::Glue(Pire::Scanner::Glue(scsc, sc2), sc).RegexpsCount(), size_t(1));
 	UNIT_CHECKPOINT(); Pire::Runner(Pire::Scanner::Glue(Pire::Scanner::Glue(scsc, sc2), sc)).Begin().Run("a string", 7).End();
 
+	// Tests for CompiledScanner
+	Pire::CompiledScanner csc;
+	UNIT_ASSERT(csc.Empty());
+	UNIT_ASSERT_EQUAL(csc.RegexpsCount(), size_t(0));
+	UNIT_ASSERT(!Pire::Runner(csc).Begin().Run("a string", 7).End());
+
 	// Tests for NonrelocScanner
 	Pire::NonrelocScanner nsc;
 	UNIT_ASSERT(nsc.Empty());
@@ -733,6 +2142,12 @@ SIMPLE_UNIT_TEST(EmptyScanner)
 	BasicTestEmptySaveLoadMmap<Pire::SimpleScanner>();
 
 	BasicTestEmptySaveLoadMmap<Pire::SlowScanner>();
+
+	BasicTestEmptySaveLoadMmap<Pire::BitParallelScanner>();
+
+	BasicTestEmptySaveLoadMmap<Pire::ShengScanner>();
+
+	BasicTestEmptySaveLoadMmap<Pire::Stride2Scanner>();
 }
 
 SIMPLE_UNIT_TEST(NullPointer)
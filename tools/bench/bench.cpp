@@ -131,6 +131,15 @@ struct CompileRe< Pire::Impl::Scanner<Relocation, Shortcutting> > {
 	}
 };
 
+// Native code for a multi regexp scanner
+template<>
+struct CompileRe<Pire::JitScanner> {
+	static Pire::JitScanner Do(const Patterns& patterns, bool surround)
+	{
+		return Pire::JitScanner(CompileRe<Pire::Scanner>::Do(patterns, surround));
+	}
+};
+
 // Single regexp
 template<class Scanner>
 struct PrintResult {
@@ -158,6 +167,14 @@ struct PrintResult< Pire::Impl::Scanner<Relocation, Shortcutting> > {
 	}
 };
 
+template<>
+struct PrintResult<Pire::JitScanner> {
+	static void Do(const Pire::JitScanner& sc, Pire::JitScanner::State st)
+	{
+		PrintResult<Pire::Scanner>::Do(sc.Tables(), st);
+	}
+};
+
 // Pair result
 template<class Scanner1, class Scanner2>
 struct PrintResult< Pire::ScannerPair<Scanner1, Scanner2> > {
@@ -308,7 +325,7 @@ public:
 std::runtime_error usage(
 	"Usage: bench -f file [-c repetition_count] "
 	"[-a run|shortestprefix|longestprefix] "
-	"-t {multi|nonreloc|multinomask|nonrelocnomask|simple|slow|null"
+	"-t {multi|nonreloc|multinomask|nonrelocnomask|simple|stride2|jit|slow|null"
 #ifdef BENCH_EXTRA_ENABLED
 	"count|capture"
 #endif
@@ -327,6 +344,10 @@ ITester* CreateTester(const std::vector<std::string>& types)
 		return new Tester<Pire::NonrelocScannerNoMask>;
 	else if (types.size() == 1 && types[0] == "simple")
 		return new Tester<Pire::SimpleScanner>;
+	else if (types.size() == 1 && types[0] == "stride2")
+		return new Tester<Pire::Stride2Scanner>;
+	else if (types.size() == 1 && types[0] == "jit")
+		return new Tester<Pire::JitScanner>;
 	else if (types.size() == 1 && types[0] == "slow")
 		return new Tester<Pire::SlowScanner>;
 	else if (types.size() == 1 && types[0] == "null")
@@ -0,0 +1,461 @@
+/*
+ * compile.cpp -- compiles sets of regexps into an archive of scanners,
+ *                ready to be mmap()-ed.
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+/*
+ * Each line of a pattern file looks like
+ *
+ *     name <TAB> flags <TAB> regexp
+ *
+ * (or just `name <TAB> regexp' if no flags are needed). Empty lines
+ * and lines starting with '#' are ignored. Flags are:
+ *     i -- case insensitive;
+ *     u -- the regexp is in UTF-8 (Latin-1 is assumed otherwise);
+ *     a -- enable the & and ~ operators;
+ *     s -- surround the regexp with .* (i.e. search instead of match);
+ *     - -- no flags.
+ *
+ * All regexps with the same name are glued into a single multi-regexp scanner.
+ * If that scanner would have more than the allowed number of states,
+ * it is split into several shards, named `name', `name.1', `name.2' and so on.
+ * Regexps within a shard are numbered in the order of their appearance.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <pire/pire.h>
+#include <pire/stub/lexical_cast.h>
+#include "../common/filemap.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+long long GetUsec()
+{
+	struct timeval tm;
+	gettimeofday(&tm, 0);
+	return tm.tv_sec * 1000000LL + tm.tv_usec;
+}
+
+#else // _WIN32
+#include <windows.h>
+
+long long GetUsec()
+{
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	long long res = ft.dwHighDateTime;
+	res <<= 32;
+	res |= ft.dwLowDateTime;
+	return res / 10;
+}
+
+#endif // _WIN32
+
+std::runtime_error usage(
+	"Usage: pire_compile [options] -o <archive> [<pattern file>...]\n"
+	"       pire_compile -l <archive>\n"
+	"Options:\n"
+	"  -o <file>   write the archive to <file>\n"
+	"  -s <n>      maximum number of states in a single scanner (default: 80000)\n"
+	"  -j <n>      number of compilation threads (default: 1)\n"
+	"  -q          do not print statistics\n"
+	"  -l <file>   list scanners in an existing archive\n"
+	"Patterns are read from standard input if no files are given.");
+
+struct Pattern {
+	std::string group;
+	std::string flags;
+	std::string regexp;
+	std::string location;
+
+	Pire::Scanner scanner;
+	std::string error;
+};
+
+struct Group {
+	std::string name;
+	std::vector<size_t> patterns;
+
+	std::vector<Pire::Scanner> shards;
+	std::vector<size_t> shardSizes; ///< Number of regexps in each shard
+	std::string error;
+};
+
+struct Options {
+	size_t maxStates;
+	size_t threads;
+	bool quiet;
+
+	Options(): maxStates(80000), threads(1), quiet(false) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading patterns
+
+void ReadPatterns(std::istream& in, const std::string& source, std::vector<Pattern>& patterns)
+{
+	std::string line;
+	for (size_t lineno = 1; std::getline(in, line); ++lineno) {
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		Pattern p;
+		p.location = source + ":" + Pire::ToString(lineno);
+		size_t tab1 = line.find('\t');
+		if (tab1 == std::string::npos || !tab1)
+			throw std::runtime_error(p.location + ": expected `name <TAB> [flags <TAB>] regexp'");
+		p.group = line.substr(0, tab1);
+		size_t tab2 = line.find('\t', tab1 + 1);
+		if (tab2 == std::string::npos) {
+			p.regexp = line.substr(tab1 + 1);
+		} else {
+			p.flags = line.substr(tab1 + 1, tab2 - tab1 - 1);
+			p.regexp = line.substr(tab2 + 1);
+		}
+		if (p.flags.find_first_not_of("iuas-") != std::string::npos)
+			throw std::runtime_error(p.location + ": unknown flags `" + p.flags + "'");
+		patterns.push_back(p);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Running jobs in parallel
+
+class Job {
+public:
+	virtual ~Job() {}
+	virtual void Do(size_t i) = 0;
+};
+
+#ifndef _WIN32
+
+class Workers {
+public:
+	Workers(Job& job, size_t count): m_job(&job), m_count(count), m_next(0)
+	{
+		pthread_mutex_init(&m_lock, 0);
+	}
+	~Workers() { pthread_mutex_destroy(&m_lock); }
+
+	void Run(size_t threads)
+	{
+		std::vector<pthread_t> tids;
+		for (size_t i = 1; i < threads; ++i) {
+			pthread_t tid;
+			if (pthread_create(&tid, 0, &Workers::ThreadFunc, this))
+				break;
+			tids.push_back(tid);
+		}
+		Work();
+		for (std::vector<pthread_t>::iterator i = tids.begin(), ie = tids.end(); i != ie; ++i)
+			pthread_join(*i, 0);
+	}
+
+private:
+	Job* m_job;
+	size_t m_count;
+	size_t m_next;
+	pthread_mutex_t m_lock;
+
+	void Work()
+	{
+		for (;;) {
+			pthread_mutex_lock(&m_lock);
+			size_t i = m_next++;
+			pthread_mutex_unlock(&m_lock);
+			if (i >= m_count)
+				break;
+			m_job->Do(i);
+		}
+	}
+
+	static void* ThreadFunc(void* self)
+	{
+		static_cast<Workers*>(self)->Work();
+		return 0;
+	}
+};
+
+void RunParallel(Job& job, size_t count, size_t threads)
+{
+	Workers(job, count).Run(threads);
+}
+
+#else
+
+void RunParallel(Job& job, size_t count, size_t /*threads*/)
+{
+	for (size_t i = 0; i != count; ++i)
+		job.Do(i);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Compilation
+
+class CompilePattern: public Job {
+public:
+	CompilePattern(std::vector<Pattern>& patterns, const Options& opts): m_patterns(&patterns), m_opts(&opts) {}
+
+	void Do(size_t i)
+	{
+		Pattern& p = (*m_patterns)[i];
+		try {
+			Pire::Lexer lexer;
+			bool surround = false;
+			for (std::string::const_iterator f = p.flags.begin(), fe = p.flags.end(); f != fe; ++f) {
+				if (*f == 'i')
+					lexer.AddFeature(Pire::Features::CaseInsensitive());
+				else if (*f == 'u')
+					lexer.SetEncoding(Pire::Encodings::Utf8());
+				else if (*f == 'a')
+					lexer.AddFeature(Pire::Features::AndNotSupport());
+				else if (*f == 's')
+					surround = true;
+			}
+			std::vector<Pire::wchar32> ucs4;
+			lexer.Encoding().FromLocal(p.regexp.c_str(), p.regexp.c_str() + p.regexp.size(), std::back_inserter(ucs4));
+			lexer.Assign(ucs4.begin(), ucs4.end());
+
+			Pire::Fsm fsm = lexer.Parse();
+			if (surround)
+				fsm.Surround();
+			if (!fsm.Determine(m_opts->maxStates))
+				throw std::runtime_error("regexp is too complicated (more than " + Pire::ToString(m_opts->maxStates) + " states)");
+			p.scanner = fsm.Compile<Pire::Scanner>();
+		}
+		catch (std::exception& e) {
+			p.error = p.location + ": " + e.what();
+		}
+	}
+
+private:
+	std::vector<Pattern>* m_patterns;
+	const Options* m_opts;
+};
+
+class GlueGroup: public Job {
+public:
+	GlueGroup(std::vector<Group>& groups, const std::vector<Pattern>& patterns, const Options& opts)
+		: m_groups(&groups), m_patterns(&patterns), m_opts(&opts)
+	{}
+
+	void Do(size_t i)
+	{
+		Group& g = (*m_groups)[i];
+		try {
+			Pire::Scanner shard;
+			size_t count = 0;
+			for (std::vector<size_t>::const_iterator p = g.patterns.begin(), pe = g.patterns.end(); p != pe; ++p) {
+				const Pire::Scanner& sc = (*m_patterns)[*p].scanner;
+				Pire::Scanner glued;
+				if (count)
+					glued = Pire::Scanner::Glue(shard, sc, m_opts->maxStates);
+				if (glued.Empty()) {
+					if (count) {
+						g.shards.push_back(shard);
+						g.shardSizes.push_back(count);
+					}
+					shard = sc;
+					count = 1;
+				} else {
+					shard.Swap(glued);
+					++count;
+				}
+			}
+			if (count) {
+				g.shards.push_back(shard);
+				g.shardSizes.push_back(count);
+			}
+		}
+		catch (std::exception& e) {
+			g.error = g.name + ": " + e.what();
+		}
+	}
+
+private:
+	std::vector<Group>* m_groups;
+	const std::vector<Pattern>* m_patterns;
+	const Options* m_opts;
+};
+
+std::string ShardName(const Group& g, size_t shard)
+{
+	return shard ? g.name + "." + Pire::ToString(shard) : g.name;
+}
+
+void Compile(const std::vector<std::string>& inputs, const std::string& output, const Options& opts)
+{
+	long long start = GetUsec();
+
+	std::vector<Pattern> patterns;
+	if (inputs.empty())
+		ReadPatterns(std::cin, "<stdin>", patterns);
+	for (std::vector<std::string>::const_iterator i = inputs.begin(), ie = inputs.end(); i != ie; ++i) {
+		if (*i == "-") {
+			ReadPatterns(std::cin, "<stdin>", patterns);
+			continue;
+		}
+		std::ifstream in(i->c_str());
+		if (!in)
+			throw std::runtime_error("cannot open " + *i);
+		ReadPatterns(in, *i, patterns);
+	}
+
+	std::vector<Group> groups;
+	std::map<std::string, size_t> groupIndex;
+	for (size_t i = 0; i != patterns.size(); ++i) {
+		std::map<std::string, size_t>::iterator it = groupIndex.find(patterns[i].group);
+		if (it == groupIndex.end()) {
+			it = groupIndex.insert(std::make_pair(patterns[i].group, groups.size())).first;
+			groups.push_back(Group());
+			groups.back().name = patterns[i].group;
+		}
+		groups[it->second].patterns.push_back(i);
+	}
+
+	CompilePattern compile(patterns, opts);
+	RunParallel(compile, patterns.size(), opts.threads);
+	long long compiled = GetUsec();
+
+	std::string errors;
+	for (std::vector<Pattern>::const_iterator i = patterns.begin(), ie = patterns.end(); i != ie; ++i)
+		if (!i->error.empty())
+			errors += i->error + "\n";
+	if (!errors.empty())
+		throw std::runtime_error("compilation failed:\n" + errors);
+
+	GlueGroup glue(groups, patterns, opts);
+	RunParallel(glue, groups.size(), opts.threads);
+	long long glued = GetUsec();
+
+	for (std::vector<Group>::const_iterator i = groups.begin(), ie = groups.end(); i != ie; ++i)
+		if (!i->error.empty())
+			errors += i->error + "\n";
+	if (!errors.empty())
+		throw std::runtime_error("gluing failed:\n" + errors);
+
+	Pire::ArchiveWriter writer;
+	for (std::vector<Group>::const_iterator g = groups.begin(), ge = groups.end(); g != ge; ++g)
+		for (size_t i = 0; i != g->shards.size(); ++i)
+			writer.Add(ShardName(*g, i), g->shards[i]);
+	std::ofstream out(output.c_str(), std::ios::out | std::ios::binary);
+	if (!out)
+		throw std::runtime_error("cannot open " + output);
+	writer.Save(&out);
+	out.close();
+	if (!out)
+		throw std::runtime_error("failed to write " + output);
+
+	if (opts.quiet)
+		return;
+	size_t totalStates = 0;
+	size_t totalShards = 0;
+	for (std::vector<Group>::const_iterator g = groups.begin(), ge = groups.end(); g != ge; ++g)
+		for (size_t i = 0; i != g->shards.size(); ++i) {
+			std::cout << ShardName(*g, i) << ": " << g->shardSizes[i] << " regexps, "
+				<< g->shards[i].Size() << " states, " << g->shards[i].LettersCount() << " letters, "
+				<< g->shards[i].BufSize() << " bytes" << std::endl;
+			totalStates += g->shards[i].Size();
+			++totalShards;
+		}
+	std::cout << "total: " << patterns.size() << " regexps in " << groups.size() << " groups, "
+		<< totalShards << " scanners, " << totalStates << " states" << std::endl;
+	std::cout << "time: " << (compiled - start) / 1000 << " ms compiling, "
+		<< (glued - compiled) / 1000 << " ms gluing, "
+		<< (GetUsec() - glued) / 1000 << " ms writing" << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Listing
+
+void List(const std::string& file)
+{
+	FileMmap map(file.c_str());
+	Pire::Archive archive;
+	archive.Mmap(map.Begin(), map.Size());
+	for (size_t i = 0; i != archive.Count(); ++i) {
+		Pire::Scanner sc;
+		archive.Mmap(i, sc);
+		std::cout << archive.Name(i) << ": " << sc.RegexpsCount() << " regexps, "
+			<< sc.Size() << " states, " << archive.Size(i) << " bytes"
+			<< (archive.Verify(i) ? "" : " [checksum mismatch]") << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		Options opts;
+		std::string output;
+		std::string list;
+		std::vector<std::string> inputs;
+		for (--argc, ++argv; argc; --argc, ++argv) {
+			if (!strcmp(*argv, "-o") && argc >= 2) {
+				output = argv[1];
+				--argc, ++argv;
+			} else if (!strcmp(*argv, "-s") && argc >= 2) {
+				opts.maxStates = Pire::FromString<size_t>(argv[1]);
+				--argc, ++argv;
+			} else if (!strcmp(*argv, "-j") && argc >= 2) {
+				opts.threads = Pire::FromString<size_t>(argv[1]);
+				--argc, ++argv;
+			} else if (!strcmp(*argv, "-q")) {
+				opts.quiet = true;
+			} else if (!strcmp(*argv, "-l") && argc >= 2) {
+				list = argv[1];
+				--argc, ++argv;
+			} else if (**argv == '-' && (*argv)[1]) {
+				throw usage;
+			} else
+				inputs.push_back(*argv);
+		}
+
+		if (!list.empty()) {
+			if (!output.empty() || !inputs.empty())
+				throw usage;
+			List(list);
+		} else {
+			if (output.empty() || !opts.maxStates || !opts.threads)
+				throw usage;
+			Compile(inputs, output, opts);
+		}
+		return 0;
+	}
+	catch (std::exception& e) {
+		std::cerr << "pire_compile: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Smoke test of pire_compile: compiling, listing, and reporting bad input
+
+set -e
+tmp=${TMPDIR:-/tmp}/pire_compile_test.$$
+mkdir "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+
+printf 'greet\thello\n# a comment\n\ngreet\ts\tworld\nnum\t[0-9]+\n' > "$tmp/good.tsv"
+./pire_compile -q -o "$tmp/good.pire" "$tmp/good.tsv"
+./pire_compile -l "$tmp/good.pire" > "$tmp/list"
+test "`wc -l < "$tmp/list"`" -eq 2
+grep -q '^greet: 2 regexps, [0-9]* states, [0-9]* bytes$' "$tmp/list"
+grep -q '^num: 1 regexps, [0-9]* states, [0-9]* bytes$' "$tmp/list"
+
+# A line without a tab
+printf 'ok\tabc\n\nno tabs here\n' > "$tmp/bad.tsv"
+status=0
+./pire_compile -q -o "$tmp/bad.pire" "$tmp/bad.tsv" 2> "$tmp/err" || status=$?
+test $status -eq 1
+grep -q "^pire_compile: $tmp/bad.tsv:3: expected" "$tmp/err"
+test ! -e "$tmp/bad.pire"
+
+# A malformed regexp
+printf 'ok\tabc\nbroken\ta(b\n' > "$tmp/bad.tsv"
+status=0
+./pire_compile -q -o "$tmp/bad.pire" "$tmp/bad.tsv" 2> "$tmp/err" || status=$?
+test $status -eq 1
+grep -q "$tmp/bad.tsv:2" "$tmp/err"
+test ! -e "$tmp/bad.pire"